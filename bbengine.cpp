@@ -22,11 +22,10 @@
 #include <stdio.h>
 #include <string.h>
 #include <math.h>
+#include <limits.h>
 #include <algorithm>
 #include <pthread.h>
-#include <limits.h>
 #include <platformstl/performance/performance_counter.hpp>
-#include <platformstl/synch/sleep_functions.h>
 #include "bbconst.h"
 #include "bblua.h"
 #include "printhandler.h"
@@ -34,12 +33,14 @@
 #include "filemanager.h"
 #include "replaybuilder.h"
 #include "bbengine.h"
+#include "cpuwatchdog.h"
+#include "programcache.h"
 
 BerryBotsEngine::BerryBotsEngine(PrintHandler *printHandler,
     FileManager *fileManager, const char *replayTemplateDir) {
   stage_ = new Stage(DEFAULT_STAGE_WIDTH, DEFAULT_STAGE_HEIGHT);
-  consoleHandler_ = new ConsoleEventHandler(this);
-  stage_->addEventHandler(consoleHandler_);
+  random_ = new RandomGenerator(rand());
+  consoleHandler_ = 0;
   printHandler_ = printHandler;
   fileManager_ = fileManager;
 
@@ -67,6 +68,7 @@ BerryBotsEngine::BerryBotsEngine(PrintHandler *printHandler,
   stageShips_ = 0;
   oldShips_ = 0;
   prevShips_ = 0;
+  stageShipsSynced_ = 0;
   shipProperties_ = 0;
   worlds_ = 0;
   shipGfxs_ = 0;
@@ -74,15 +76,10 @@ BerryBotsEngine::BerryBotsEngine(PrintHandler *printHandler,
   teamVision_ = 0;
   sensorHandler_ = 0;
 
-  timerSettings_ = new TickTimerSettings;
-  timerSettings_->L = 0;
-  timerSettings_->timerTick = 0;
-  timerSettings_->timerExpiration = LONG_MAX;
-  timerSettings_->enabled = true;
-  pthread_create(&timerThread_, 0, BerryBotsEngine::timer,
-                 (void*) timerSettings_);
-  pthread_detach(timerThread_);
-  // TODO: how to handle failure to create thread
+  numTeamRunThreads_ = 1;
+  teamRunWorkers_ = 0;
+  teamRunBuffers_ = 0;
+  teamRunJobs_ = 0;
 
   replayHandler_ = 0;
   if (replayTemplateDir == 0) {
@@ -93,10 +90,44 @@ BerryBotsEngine::BerryBotsEngine(PrintHandler *printHandler,
   }
   replayBuilder_ = new ReplayBuilder(replayTemplateDir_);
   deleteReplayBuilder_ = true;
+  headless_ = false;
+  programCache_ = 0;
+  profiler_ = 0;
+  memoryLimit_ = DEFAULT_MEMORY_LIMIT;
+  stageAllocator_ = 0;
 }
 
 BerryBotsEngine::~BerryBotsEngine() {
-  timerSettings_->enabled = false;
+  if (numTeamRunThreads_ > 1) {
+    pthread_mutex_lock(&teamRunMutex_);
+    teamRunShutdown_ = true;
+    pthread_cond_broadcast(&teamRunStart_);
+    pthread_mutex_unlock(&teamRunMutex_);
+    for (int x = 1; x < numTeamRunThreads_; x++) {
+      pthread_join(teamRunWorkers_[x].thread, 0);
+    }
+    delete teamRunWorkers_;
+    pthread_key_delete(teamRunKey_);
+    pthread_mutex_destroy(&teamRunMutex_);
+    pthread_mutex_destroy(&stageQueryMutex_);
+    pthread_cond_destroy(&teamRunStart_);
+    pthread_cond_destroy(&teamRunDone_);
+  }
+  if (teamRunBuffers_ != 0) {
+    for (int x = 0; x < numTeams_; x++) {
+      TeamRunBuffer *buffer = &(teamRunBuffers_[x]);
+      for (int y = 0; y < buffer->numActions; y++) {
+        if (buffer->actions[y].text != 0) {
+          delete buffer->actions[y].text;
+        }
+      }
+      if (buffer->actions != 0) {
+        delete buffer->actions;
+      }
+    }
+    delete teamRunBuffers_;
+    delete teamRunJobs_;
+  }
   if (stagesDir_ != 0) {
     delete stagesDir_;
   }
@@ -127,6 +158,9 @@ BerryBotsEngine::~BerryBotsEngine() {
     }
     delete prevShips_;
   }
+  if (stageShipsSynced_ != 0) {
+    delete stageShipsSynced_;
+  }
 
   for (int x = 0; x < numInitializedTeams_; x++) {
     Team *team = teams_[x];
@@ -137,8 +171,10 @@ BerryBotsEngine::~BerryBotsEngine() {
       delete stat;
     }
     if (team->ownedByLua) {
+      team->allocator->detach(team->state);
       lua_close(team->state);
     }
+    delete team->allocator;
     for (int y = 0; y < team->numRectangles; y++) {
       delete team->gfxRectangles[y];
     }
@@ -155,7 +191,9 @@ BerryBotsEngine::~BerryBotsEngine() {
   }
   delete teams_;
   if (stageState_ != 0) {
+    stageAllocator_->detach(stageState_);
     lua_close(stageState_);
+    delete stageAllocator_;
   }
 
   if (worlds_ != 0) {
@@ -171,10 +209,14 @@ BerryBotsEngine::~BerryBotsEngine() {
     delete teamVision_;
   }
   delete stage_;
+  delete random_;
+  if (profiler_ != 0) {
+    delete profiler_;
+  }
   if (sensorHandler_ != 0) {
     delete sensorHandler_;
   }
-  if (deleteReplayBuilder_) {
+  if (deleteReplayBuilder_ && replayBuilder_ != 0) {
     delete replayBuilder_;
   }
   if (replayHandler_ != 0) {
@@ -183,7 +225,9 @@ BerryBotsEngine::~BerryBotsEngine() {
   if (replayTemplateDir_ != 0) {
     delete replayTemplateDir_;
   }
-  delete consoleHandler_;
+  if (consoleHandler_ != 0) {
+    delete consoleHandler_;
+  }
 }
 
 Stage* BerryBotsEngine::getStage() {
@@ -202,12 +246,33 @@ Ship* BerryBotsEngine::getStageProgramShip(const char *name) {
   for (int x = 0; x < numShips_; x++) {
     Ship *ship = stageShips_[x];
     if (strcmp(name, ship->properties->name) == 0) {
+      syncStageShip(ship);
       return ship;
     }
   }
   return 0;
 }
 
+// Brings the stage program's copy of a ship up to date, if it's one that
+// hasn't been touched yet during this stage 'run'. Any other ship is left
+// alone, so it's safe to call this on any ship passed in from Lua.
+void BerryBotsEngine::syncStageShip(Ship *ship) {
+  int index = ship->index;
+  if (stageShipsSynced_ != 0 && !stageShipsSynced_[index]
+      && ship == stageShips_[index]) {
+    *ship = *(ships_[index]);
+    stageShipsSynced_[index] = true;
+  }
+}
+
+// For stage code that looks at every ship, like checking for overlaps when
+// moving one.
+void BerryBotsEngine::syncStageShips() {
+  for (int x = 0; x < numShips_; x++) {
+    syncStageShip(stageShips_[x]);
+  }
+}
+
 int BerryBotsEngine::getGameTime() {
   return gameTime_;
 }
@@ -220,6 +285,123 @@ int BerryBotsEngine::getTeamSize() {
   return teamSize_;
 }
 
+// Runs each tick's team 'run' calls on up to numThreads threads, counting the
+// calling thread. Everything a team's 'run' does to shared state is held until
+// all the teams have run, then carried out in team order, so the results don't
+// depend on the number of threads. Unlike the normal mode, teams don't see
+// each other's fire events until the next tick. Can only be turned on once.
+void BerryBotsEngine::setTeamRunThreads(int numThreads) {
+  numThreads = std::max(1, std::min(numThreads, MAX_TEAM_RUN_THREADS));
+  if (numTeamRunThreads_ > 1 || numThreads == 1) {
+    return;
+  }
+
+  pthread_key_create(&teamRunKey_, 0);
+  pthread_mutex_init(&teamRunMutex_, 0);
+  pthread_mutex_init(&stageQueryMutex_, 0);
+  pthread_cond_init(&teamRunStart_, 0);
+  pthread_cond_init(&teamRunDone_, 0);
+  teamRunGeneration_ = 0;
+  numTeamRunJobs_ = nextTeamRunJob_ = numTeamRunJobsDone_ = 0;
+  teamRunShutdown_ = false;
+
+  numTeamRunThreads_ = numThreads;
+  teamRunWorkers_ = new TeamRunWorker[numThreads];
+  for (int x = 1; x < numThreads; x++) {
+    teamRunWorkers_[x].engine = this;
+    pthread_create(&(teamRunWorkers_[x].thread), 0,
+                   BerryBotsEngine::teamRunWorker,
+                   (void*) &(teamRunWorkers_[x]));
+  }
+}
+
+int BerryBotsEngine::getTeamRunThreads() {
+  return numTeamRunThreads_;
+}
+
+// For runs that only care about the results. A headless engine doesn't build
+// a replay, store user gfx or print anything. Has to be set before initStage.
+void BerryBotsEngine::setHeadless(bool headless) {
+  if (stageState_ != 0 || headless == headless_) {
+    return;
+  }
+
+  headless_ = headless;
+  if (headless) {
+    if (deleteReplayBuilder_) {
+      delete replayBuilder_;
+    }
+    replayBuilder_ = 0;
+  } else {
+    replayBuilder_ = new ReplayBuilder(replayTemplateDir_);
+    deleteReplayBuilder_ = true;
+  }
+}
+
+bool BerryBotsEngine::isHeadless() {
+  return headless_;
+}
+
+// Ship placement and every Lua state's math.random are seeded from the
+// engine's own stream, so the seed reproduces the match. Only works before the
+// stage is initialized.
+void BerryBotsEngine::setRandomSeed(unsigned int randomSeed) {
+  if (stageState_ == 0) {
+    random_->setSeed(randomSeed);
+  }
+}
+
+// Times each phase of processTick, per team where it applies. Off by default,
+// since the clock reads aren't free.
+void BerryBotsEngine::setProfiling(bool profiling) {
+  if (profiling == (profiler_ != 0)) {
+    return;
+  }
+
+  if (profiling) {
+    profiler_ = new TickProfiler();
+  } else {
+    delete profiler_;
+    profiler_ = 0;
+  }
+  stage_->setProfiler(profiler_);
+}
+
+TickProfiler* BerryBotsEngine::getProfiler() {
+  return profiler_;
+}
+
+// The most memory each team's Lua state, and the stage's, can use. A team
+// that runs out is disabled, like one that runs out of CPU time; a stage that
+// runs out ends the match with an error. Has to be set before initStage, and
+// 0 means no limit.
+void BerryBotsEngine::setMemoryLimit(size_t maxBytes) {
+  if (stageState_ == 0) {
+    memoryLimit_ = maxBytes;
+  }
+}
+
+size_t BerryBotsEngine::getMemoryLimit() {
+  return memoryLimit_;
+}
+
+// Lets the engine reuse programs compiled by other engines. The cache isn't
+// owned by the engine and has to outlive it.
+void BerryBotsEngine::setProgramCache(ProgramCache *programCache) {
+  programCache_ = programCache;
+}
+
+int BerryBotsEngine::loadUserFile(lua_State *L, const char *dir,
+                                  const char *filename) {
+  if (programCache_ == 0) {
+    return luaL_loadfile(L, filename);
+  }
+  char *filePath = fileManager_->getFilePath(dir, filename);
+  int r = programCache_->loadFile(L, filePath, filename);
+  delete filePath;
+  return r;
+}
+
 bool BerryBotsEngine::isStageConfigureComplete() {
   return stageConfigureComplete_;
 }
@@ -455,13 +637,22 @@ int BerryBotsEngine::callUserLuaCode(lua_State *L, int nargs,
   lua_pushcfunction(L, traceback);
   lua_insert(L, base);
 
-  // TODO: I'm not completely convinced we're safe without a mutex here. Do
-  //       more tests and maybe add one.
-  timerSettings_->timerExpiration = timerSettings_->timerTick + 2;
-  timerSettings_->L = L;
-  int pcallValue = lua_pcall(L, nargs, 0, base);
-  timerSettings_->L = 0;
-  timerSettings_->timerExpiration = LONG_MAX;
+  LuaAllocator *allocator = LuaAllocator::getAllocator(L);
+  bool wasLimited = (allocator != 0 && allocator->setLimited(true));
+  int watchId = CpuWatchdog::watch(L);
+  int pcallValue;
+  if (watchId == -1) {
+    // Never run user code without a CPU time limit.
+    lua_settop(L, base);
+    lua_pushstring(L, "Couldn't start the CPU time watchdog.");
+    pcallValue = LUA_ERRRUN;
+  } else {
+    pcallValue = lua_pcall(L, nargs, 0, base);
+    CpuWatchdog::unwatch(watchId);
+  }
+  if (allocator != 0) {
+    allocator->setLimited(wasLimited);
+  }
 
   lua_remove(L, base);
 
@@ -478,22 +669,6 @@ int BerryBotsEngine::callUserLuaCode(lua_State *L, int nargs,
   return pcallValue;
 }
 
-void *BerryBotsEngine::timer(void *vargs) {
-  TickTimerSettings *settings = (TickTimerSettings *) vargs;
-  while (settings->enabled) {
-    platformstl::micro_sleep(PCALL_TIME_LIMIT);
-    if (settings->timerExpiration <= ++(settings->timerTick)) {
-      if (settings->L != 0) {
-        lua_State *killState = settings->L;
-        settings->L = 0;
-        lua_sethook(killState, killHook, LUA_MASKCOUNT, 1);
-      }
-    }
-  }
-  delete settings;
-  return 0;
-}
-
 // Loads the stage in the file stageName, which may include a relative path,
 // from the root directory stagesBaseDir. Note that the file may be either a
 // .lua file, in which case we just load it directly; or a stage packaged as a
@@ -521,10 +696,19 @@ void BerryBotsEngine::initStage(const char *stagesBaseDir,
     delete pse;
     throw eie;
   }
-  initStageState(&stageState_, stagesDir_);
+  if (headless_) {
+    stage_->disableUserGfx();
+  } else {
+    consoleHandler_ = new ConsoleEventHandler(this);
+    stage_->addEventHandler(consoleHandler_);
+  }
+  stage_->setRandomSeed(random_->next());
+  initStageState(&stageState_, stagesDir_, random_->next());
+  stageAllocator_ = new LuaAllocator(memoryLimit_);
+  stageAllocator_->attach(stageState_);
   lua_setprinter(stageState_, this);
 
-  if (luaL_loadfile(stageState_, stageFilename_)) {
+  if (loadUserFile(stageState_, stagesDir_, stageFilename_)) {
     throwForLuaError(stageState_, "Cannot load stage file: %s");
   }
   callUserLuaCode(stageState_, 0, "Cannot load stage file", PCALL_STAGE);
@@ -547,6 +731,9 @@ void BerryBotsEngine::initStage(const char *stagesBaseDir,
   stage_->buildBaseWalls();
   stagePrint("");
   stageConfigureComplete_ = true;
+  if (headless_) {
+    return;
+  }
 
   replayBuilder_->addStageProperties(stage_->getName(), stage_->getWidth(),
                                      stage_->getHeight());
@@ -579,7 +766,9 @@ void BerryBotsEngine::initShips(const char *shipsBaseDir, char **teamNames,
   int numStageShips = stage_->getStageShipCount();
   numShips_ = (userTeams * teamSize_) + numStageShips;
   numTeams_ = userTeams + numStageShips;
-  replayBuilder_->initShips(numTeams_, numShips_);
+  if (!headless_) {
+    replayBuilder_->initShips(numTeams_, numShips_);
+  }
 
   ships_ = new Ship*[numShips_];
   shipProperties_ = new ShipProperties*[numShips_];
@@ -656,15 +845,19 @@ void BerryBotsEngine::initShips(const char *shipsBaseDir, char **teamNames,
       delete pse;
       throw eie;
     }
-    initShipState(&teamState, shipDir);
+    initShipState(&teamState, shipDir, random_->next());
     lua_setprinter(teamState, this);
 
     Team *team = new Team;
     team->index = x;
     team->firstShipIndex = shipIndex;
     team->state = teamState;
+    team->allocator = new LuaAllocator(memoryLimit_);
+    team->allocator->attach(teamState);
     team->errored = false;
     team->gfxEnabled = false;
+    team->enemyShipViews = false;
+    team->ffiMethods = false;
     team->tooManyRectangles = team->tooManyLines = false;
     team->tooManyCircles = team->tooManyTexts = false;
     if (printHandler_ != 0) {
@@ -674,7 +867,7 @@ void BerryBotsEngine::initShips(const char *shipsBaseDir, char **teamNames,
     int numStateShips = (stageShip ? 1 : teamSize_);
     Ship **stateShips = new Ship*[numStateShips];
     bool disabled;
-    if (luaL_loadfile(teamState, shipFilename)) {
+    if (loadUserFile(teamState, shipDir, shipFilename)) {
       printLuaErrorToShipConsole(teamState, "Error loading file: %s");
       disabled = true;
       team->ownedByLua = false;
@@ -706,6 +899,7 @@ void BerryBotsEngine::initShips(const char *shipsBaseDir, char **teamNames,
     team->numLines = 0;
     team->numCircles = 0;
     team->numTexts = 0;
+    team->gfxExpiry = INT_MAX;
 
     lua_getglobal(teamState, "roundOver");
     team->hasRoundOver = (strcmp(luaL_typename(teamState, -1), "nil") != 0);
@@ -818,11 +1012,13 @@ void BerryBotsEngine::initShips(const char *shipsBaseDir, char **teamNames,
   // TODO: print to output console if ship or team name changes
   uniqueShipNames(ships_, numShips_);
   uniqueTeamNames(teams_, numTeams_);
-  for (int x = 0; x < numShips_; x++) {
-    replayBuilder_->addShipProperties(ships_[x]);
-  }
-  for (int x = 0; x < numTeams_; x++) {
-    replayBuilder_->addTeamProperties(teams_[x]);
+  if (!headless_) {
+    for (int x = 0; x < numShips_; x++) {
+      replayBuilder_->addShipProperties(ships_[x]);
+    }
+    for (int x = 0; x < numTeams_; x++) {
+      replayBuilder_->addTeamProperties(teams_[x]);
+    }
   }
 
   teamVision_ = new bool*[numTeams_];
@@ -835,6 +1031,10 @@ void BerryBotsEngine::initShips(const char *shipsBaseDir, char **teamNames,
   lua_getglobal(stageState_, "init");
   stageShips_ = new Ship*[numShips_];
   pushCopyOfShips(stageState_, ships_, stageShips_, numShips_);
+  stageShipsSynced_ = new bool[numShips_];
+  for (int x = 0; x < numShips_; x++) {
+    stageShipsSynced_[x] = true;
+  }
   stage_->setTeamsAndShips(teams_, numTeams_, stageShips_, numShips_);
   if (strcmp(luaL_typename(stageState_, -2), "nil") != 0) {
     stageWorld_ = pushWorld(stageState_, stage_, numShips_, teamSize_);
@@ -847,7 +1047,7 @@ void BerryBotsEngine::initShips(const char *shipsBaseDir, char **teamNames,
                     PCALL_STAGE);
   }
 
-  copyShips(stageShips_, ships_, numShips_);
+  commitStageShips();
   oldShips_ = new Ship*[numShips_];
   prevShips_ = new Ship*[numShips_];
   for (int x = 0; x < numShips_; x++) {
@@ -856,7 +1056,9 @@ void BerryBotsEngine::initShips(const char *shipsBaseDir, char **teamNames,
   }
   copyShips(ships_, oldShips_, numShips_);
 
-  replayBuilder_->addShipStates(ships_, gameTime_);
+  if (!headless_) {
+    replayBuilder_->addShipStates(ships_, gameTime_);
+  }
 
   lua_getglobal(stageState_, "run");
   stageRun_ = (strcmp(luaL_typename(stageState_, -1), "nil") != 0);
@@ -881,12 +1083,13 @@ void BerryBotsEngine::initShipRound(Ship *ship) {
   ship->hitWall = ship->hitShip = false;
 
   bool safeStart;
+  int tries = 0;
   do {
     Point2D *startPosition = stage_->getStart();
     ship->x = startPosition->getX();
     ship->y = startPosition->getY();
     safeStart = true;
-    for (int y = 0; y < ship->index; y++) {
+    for (int y = 0; y < ship->index && safeStart; y++) {
       if (ships_[y]->alive
           && square(ship->x - ships_[y]->x) + square(ship->y - ships_[y]->y)
                 < square(SHIP_RADIUS * 2)) {
@@ -894,6 +1097,9 @@ void BerryBotsEngine::initShipRound(Ship *ship) {
       }
     }
     delete startPosition;
+    if (!safeStart && ++tries == MAX_PLACEMENT_STEPS) {
+      safeStart = stage_->findFreePosition(ship, &(ship->x), &(ship->y));
+    }
   } while (!safeStart);
 }
 
@@ -912,6 +1118,9 @@ void BerryBotsEngine::updateTeamShipsAlive() {
 }
 
 void BerryBotsEngine::stagePrint(const char *text) {
+  if (headless_) {
+    return;
+  }
   if (printHandler_ != 0) {
     printHandler_->stagePrint(text);
   }
@@ -919,6 +1128,14 @@ void BerryBotsEngine::stagePrint(const char *text) {
 }
 
 void BerryBotsEngine::shipPrint(lua_State *L, const char *text) {
+  if (headless_) {
+    return;
+  }
+  TeamRunBuffer *buffer = getTeamRunBuffer();
+  if (buffer != 0) {
+    addTeamRunAction(buffer, TEAM_RUN_PRINT, 0, 0, 0, text);
+    return;
+  }
   if (printHandler_ != 0) {
     printHandler_->shipPrint(L, text);
   }
@@ -928,11 +1145,149 @@ void BerryBotsEngine::shipPrint(lua_State *L, const char *text) {
 void BerryBotsEngine::processTick() throw (EngineException*) {
   gameTime_++;
   physicsOver_ = false;
+  unsigned long long profileTime = 0;
+  if (profiler_ != 0) {
+    profiler_->startTick(gameTime_);
+    profileTime = profiler_->now();
+  }
   updateTeamShipsAlive();    
   stage_->updateTeamVision(teams_, numTeams_, ships_, numShips_, teamVision_);
+  if (profiler_ != 0) {
+    profileTime = profiler_->record(PROFILE_TEAM_VISION, -1, profileTime);
+  }
   stage_->clearStaleUserGfxs(gameTime_);
-  copyShips(oldShips_, prevShips_, numShips_);
+  Ship **prevShips = prevShips_;
+  prevShips_ = oldShips_;
+  oldShips_ = prevShips;
   copyShips(ships_, oldShips_, numShips_);
+  if (profiler_ != 0) {
+    profiler_->record(PROFILE_TICK_SETUP, -1, profileTime);
+  }
+  if (numTeamRunThreads_ > 1) {
+    processTeamRuns();
+  } else {
+    for (int x = 0; x < numTeams_; x++) {
+      Team *team = teams_[x];
+      if (team->shipsAlive > 0 && !team->disabled) {
+        worlds_[x]->time = gameTime_;
+        for (int y = 0; y < team->numShips; y++) {
+          int shipIndex = y + team->firstShipIndex;
+          Ship *ship = ships_[shipIndex];
+          ship->thrusterForce = 0;
+          ship->laserGunHeat = std::max(0, ship->laserGunHeat - 1);
+          ship->torpedoGunHeat = std::max(0, ship->torpedoGunHeat - 1);
+        }
+
+        if (profiler_ != 0) {
+          profileTime = profiler_->now();
+        }
+        lua_getglobal(team->state, "run");
+        if (team->enemyShipViews) {
+          pushVisibleEnemyShipViews(team->state, teamVision_[x], x, oldShips_,
+                                    numShips_, gameTime_);
+        } else {
+          pushVisibleEnemyShips(
+              team->state, teamVision_[x], x, oldShips_, numShips_);
+        }
+        Sensors *sensors =
+            pushSensors(team, sensorHandler_, shipProperties_);
+        if (profiler_ != 0) {
+          profileTime = profiler_->record(PROFILE_SENSORS, x, profileTime);
+        }
+        team->counter.start();
+        int r = callUserLuaCode(team->state, 2,
+            "Error calling ship function: 'run'", PCALL_SHIP);
+        monitorCpuTimer(team, isFatalError(team, r));
+        if (profiler_ != 0) {
+          profileTime = profiler_->record(PROFILE_TEAM_RUN, x, profileTime);
+        }
+        cleanupSensorsTables(team->state, sensors);
+        lua_settop(team->state, 0);
+        if (profiler_ != 0) {
+          profiler_->record(PROFILE_SENSOR_CLEANUP, x, profileTime);
+        }
+      }
+    }
+  }
+  stage_->moveAndCheckCollisions(oldShips_, ships_, numShips_, gameTime_);
+  physicsOver_ = true;
+  if (!headless_) {
+    if (profiler_ != 0) {
+      profileTime = profiler_->now();
+    }
+    replayBuilder_->addShipStates(ships_, gameTime_);
+    if (profiler_ != 0) {
+      profiler_->record(PROFILE_REPLAY, -1, profileTime);
+    }
+  }
+
+  if (stageRun_) {
+    this->setRoundOver(false);
+    this->setGameOver(false);
+    if (profiler_ != 0) {
+      profileTime = profiler_->now();
+    }
+    processStageRun();
+    if (profiler_ != 0) {
+      profiler_->record(PROFILE_STAGE_RUN, -1, profileTime);
+    }
+  }
+}
+
+// Runs up to numTicks ticks, stopping early when the game ends or on the
+// events in the stopCondition bitmask (STOP_ON_ROUND_OVER,
+// STOP_ON_SHIP_DESTROYED).
+TickSummary BerryBotsEngine::runTicks(int numTicks, int stopCondition)
+    throw (EngineException*) {
+  TickSummary summary;
+  summary.ticks = summary.roundsOver = summary.shipsDestroyed = 0;
+  summary.gameOver = gameOver_;
+  summary.stopped = false;
+  bool stopOnRoundOver = (stopCondition & STOP_ON_ROUND_OVER);
+  bool stopOnShipDestroyed = (stopCondition & STOP_ON_SHIP_DESTROYED);
+  while (summary.ticks < numTicks && !gameOver_) {
+    processTick();
+    summary.ticks++;
+
+    // oldShips_ still has the ships from the start of the tick.
+    int shipsDestroyed = 0;
+    for (int x = 0; x < numShips_; x++) {
+      if (oldShips_[x]->alive && !ships_[x]->alive) {
+        shipsDestroyed++;
+      }
+    }
+    summary.shipsDestroyed += shipsDestroyed;
+    if (roundOver_) {
+      summary.roundsOver++;
+    }
+    if ((stopOnRoundOver && roundOver_)
+        || (stopOnShipDestroyed && shipsDestroyed > 0)) {
+      summary.stopped = true;
+      break;
+    }
+  }
+  summary.gameOver = gameOver_;
+  return summary;
+}
+
+// Same as the team loop in processTick, but the 'run' calls are spread across
+// the team run threads. Sensors are pushed and cleaned up on this thread.
+void BerryBotsEngine::processTeamRuns() {
+  if (teamRunBuffers_ == 0) {
+    teamRunBuffers_ = new TeamRunBuffer[numTeams_];
+    for (int x = 0; x < numTeams_; x++) {
+      TeamRunBuffer *buffer = &(teamRunBuffers_[x]);
+      buffer->team = teams_[x];
+      buffer->sensors = 0;
+      buffer->pcallValue = 0;
+      buffer->actions = 0;
+      buffer->numActions = buffer->maxActions = 0;
+      buffer->runStart = buffer->runEnd = 0;
+    }
+    teamRunJobs_ = new int[numTeams_];
+  }
+
+  int numJobs = 0;
   for (int x = 0; x < numTeams_; x++) {
     Team *team = teams_[x];
     if (team->shipsAlive > 0 && !team->disabled) {
@@ -945,31 +1300,195 @@ void BerryBotsEngine::processTick() throw (EngineException*) {
         ship->torpedoGunHeat = std::max(0, ship->torpedoGunHeat - 1);
       }
 
+      unsigned long long profileTime = 0;
+      if (profiler_ != 0) {
+        profileTime = profiler_->now();
+      }
       lua_getglobal(team->state, "run");
-      pushVisibleEnemyShips(
-          team->state, teamVision_[x], x, oldShips_, numShips_);
-      Sensors *sensors = pushSensors(team, sensorHandler_, shipProperties_);
-      team->counter.start();
-      int r = callUserLuaCode(team->state, 2,
-                              "Error calling ship function: 'run'", PCALL_SHIP);
-      monitorCpuTimer(team, (r != 0 && lua_gethookcount(team->state) > 0));
-      cleanupSensorsTables(team->state, sensors);
-      lua_settop(team->state, 0);
+      if (team->enemyShipViews) {
+        pushVisibleEnemyShipViews(team->state, teamVision_[x], x, oldShips_,
+                                  numShips_, gameTime_);
+      } else {
+        pushVisibleEnemyShips(
+            team->state, teamVision_[x], x, oldShips_, numShips_);
+      }
+      teamRunBuffers_[x].sensors =
+          pushSensors(team, sensorHandler_, shipProperties_);
+      if (profiler_ != 0) {
+        profiler_->record(PROFILE_SENSORS, x, profileTime);
+      }
+      teamRunJobs_[numJobs++] = x;
     }
   }
-  stage_->moveAndCheckCollisions(oldShips_, ships_, numShips_, gameTime_);
-  physicsOver_ = true;
-  replayBuilder_->addShipStates(ships_, gameTime_);
 
-  if (stageRun_) {
-    this->setRoundOver(false);
-    this->setGameOver(false);
-    processStageRun();
+  pthread_mutex_lock(&teamRunMutex_);
+  numTeamRunJobs_ = numJobs;
+  nextTeamRunJob_ = numTeamRunJobsDone_ = 0;
+  teamRunGeneration_++;
+  pthread_cond_broadcast(&teamRunStart_);
+  pthread_mutex_unlock(&teamRunMutex_);
+  runTeamJobs();
+  pthread_mutex_lock(&teamRunMutex_);
+  while (numTeamRunJobsDone_ < numTeamRunJobs_) {
+    pthread_cond_wait(&teamRunDone_, &teamRunMutex_);
+  }
+  pthread_mutex_unlock(&teamRunMutex_);
+
+  for (int x = 0; x < numJobs; x++) {
+    TeamRunBuffer *buffer = &(teamRunBuffers_[teamRunJobs_[x]]);
+    Team *team = buffer->team;
+    if (profiler_ != 0) {
+      profiler_->record(PROFILE_TEAM_RUN, team->index, buffer->runStart,
+                        buffer->runEnd);
+    }
+    applyTeamRunActions(buffer);
+    recordCpuTime(team, isFatalError(team, buffer->pcallValue));
+    unsigned long long profileTime = 0;
+    if (profiler_ != 0) {
+      profileTime = profiler_->now();
+    }
+    cleanupSensorsTables(team->state, buffer->sensors);
+    lua_settop(team->state, 0);
+    if (profiler_ != 0) {
+      profiler_->record(PROFILE_SENSOR_CLEANUP, team->index, profileTime);
+    }
+  }
+}
+
+void *BerryBotsEngine::teamRunWorker(void *vargs) {
+  TeamRunWorker *worker = (TeamRunWorker *) vargs;
+  worker->engine->waitForTeamRunJobs();
+  return 0;
+}
+
+void BerryBotsEngine::waitForTeamRunJobs() {
+  unsigned long generation = 0;
+  pthread_mutex_lock(&teamRunMutex_);
+  while (true) {
+    while (teamRunGeneration_ == generation && !teamRunShutdown_) {
+      pthread_cond_wait(&teamRunStart_, &teamRunMutex_);
+    }
+    if (teamRunShutdown_) {
+      break;
+    }
+    generation = teamRunGeneration_;
+    pthread_mutex_unlock(&teamRunMutex_);
+    runTeamJobs();
+    pthread_mutex_lock(&teamRunMutex_);
+  }
+  pthread_mutex_unlock(&teamRunMutex_);
+}
+
+// Takes teams off the job list and calls their 'run' until there are none
+// left. The buffer is tied to this thread so prints and fires end up in it.
+void BerryBotsEngine::runTeamJobs() {
+  while (true) {
+    pthread_mutex_lock(&teamRunMutex_);
+    if (nextTeamRunJob_ >= numTeamRunJobs_) {
+      pthread_mutex_unlock(&teamRunMutex_);
+      return;
+    }
+    TeamRunBuffer *buffer =
+        &(teamRunBuffers_[teamRunJobs_[nextTeamRunJob_++]]);
+    pthread_mutex_unlock(&teamRunMutex_);
+
+    Team *team = buffer->team;
+    pthread_setspecific(teamRunKey_, buffer);
+    if (profiler_ != 0) {
+      buffer->runStart = profiler_->now();
+    }
+    team->counter.start();
+    buffer->pcallValue = callUserLuaCode(team->state, 2,
+        "Error calling ship function: 'run'", PCALL_SHIP);
+    team->counter.stop();
+    if (profiler_ != 0) {
+      buffer->runEnd = profiler_->now();
+    }
+    pthread_setspecific(teamRunKey_, 0);
+
+    pthread_mutex_lock(&teamRunMutex_);
+    if (++numTeamRunJobsDone_ == numTeamRunJobs_) {
+      pthread_cond_signal(&teamRunDone_);
+    }
+    pthread_mutex_unlock(&teamRunMutex_);
+  }
+}
+
+// The buffer of the team 'run' call on this thread, if there is one.
+TeamRunBuffer* BerryBotsEngine::getTeamRunBuffer() {
+  if (numTeamRunThreads_ == 1) {
+    return 0;
+  }
+  return (TeamRunBuffer *) pthread_getspecific(teamRunKey_);
+}
+
+void BerryBotsEngine::addTeamRunAction(TeamRunBuffer *buffer, int type,
+    Ship *ship, double heading, double distance, const char *text) {
+  if (buffer->numActions == buffer->maxActions) {
+    int maxActions = std::max(16, buffer->maxActions * 2);
+    TeamRunAction *actions = new TeamRunAction[maxActions];
+    for (int x = 0; x < buffer->numActions; x++) {
+      actions[x] = buffer->actions[x];
+    }
+    if (buffer->actions != 0) {
+      delete buffer->actions;
+    }
+    buffer->actions = actions;
+    buffer->maxActions = maxActions;
+  }
+  TeamRunAction *action = &(buffer->actions[buffer->numActions++]);
+  action->type = type;
+  action->ship = ship;
+  action->heading = heading;
+  action->distance = distance;
+  if (text == 0) {
+    action->text = 0;
+  } else {
+    action->text = new char[strlen(text) + 1];
+    strcpy(action->text, text);
+  }
+}
+
+// Fires were already accepted on gun heat alone, so clear the heat and let the
+// stage decide. If it turns one down, like for the laser limit, the gun stays
+// cool, just as if the fire had failed in the first place.
+void BerryBotsEngine::applyTeamRunActions(TeamRunBuffer *buffer) {
+  lua_State *teamState = buffer->team->state;
+  for (int x = 0; x < buffer->numActions; x++) {
+    TeamRunAction *action = &(buffer->actions[x]);
+    Ship *ship = action->ship;
+    switch (action->type) {
+      case TEAM_RUN_LASER:
+        ship->laserGunHeat = 0;
+        if (stage_->fireLaser(ship, action->heading, gameTime_)) {
+          ship->laserGunHeat = LASER_HEAT;
+        }
+        break;
+      case TEAM_RUN_TORPEDO:
+        ship->torpedoGunHeat = 0;
+        if (stage_->fireTorpedo(
+                ship, action->heading, action->distance, gameTime_)) {
+          ship->torpedoGunHeat = TORPEDO_HEAT;
+        }
+        break;
+      case TEAM_RUN_PRINT:
+        shipPrint(teamState, action->text);
+        break;
+      case TEAM_RUN_ERROR:
+        if (printHandler_ != 0) {
+          printHandler_->shipError(teamState, action->text);
+        }
+        replayBuilder_->addLogEntry(buffer->team, gameTime_, action->text);
+        break;
+    }
+    if (action->text != 0) {
+      delete action->text;
+    }
   }
+  buffer->numActions = 0;
 }
 
 void BerryBotsEngine::processStageRun() throw (EngineException*) {
-  copyShips(ships_, stageShips_, numShips_);
   if (stageWorld_ != 0) {
     stageWorld_->time = gameTime_;
   }
@@ -980,11 +1499,12 @@ void BerryBotsEngine::processStageRun() throw (EngineException*) {
                   PCALL_STAGE);
   cleanupStageSensorsTables(stageState_, stageSensors);
   lua_settop(stageState_, 0);
-  copyShips(stageShips_, ships_, numShips_);
+  commitStageShips();
 }
 
 void BerryBotsEngine::processRoundOver() {
-  copyShips(stageShips_, ships_, numShips_);
+  commitStageShips();
+  syncStageShips();
   stage_->reset(gameTime_);
   for (int x = 0; x < numTeams_; x++) {
     Team *team = teams_[x];
@@ -993,7 +1513,7 @@ void BerryBotsEngine::processRoundOver() {
       team->counter.start();
       int r = callUserLuaCode(team->state, 0,
           "Error calling ship function: 'roundOver'", PCALL_SHIP);
-      monitorCpuTimer(team, (r != 0 && lua_gethookcount(team->state) > 0));
+      monitorCpuTimer(team, isFatalError(team, r));
     }
     for (int y = 0; y < team->numShips; y++) {
       Ship *ship = ships_[team->firstShipIndex + y];
@@ -1006,7 +1526,8 @@ void BerryBotsEngine::processRoundOver() {
 }
 
 void BerryBotsEngine::processGameOver() {
-  copyShips(stageShips_, ships_, numShips_);
+  commitStageShips();
+  syncStageShips();
   for (int x = 0; x < numTeams_; x++) {
     Team *team = teams_[x];
     if (team->hasGameOver) {
@@ -1014,15 +1535,26 @@ void BerryBotsEngine::processGameOver() {
       team->counter.start();
       int r = callUserLuaCode(team->state, 0,
           "Error calling ship function: 'gameOver'", PCALL_SHIP);
-      monitorCpuTimer(team, (r != 0 && lua_gethookcount(team->state) > 0));
+      monitorCpuTimer(team, isFatalError(team, r));
     }
   }
   copyShips(ships_, stageShips_, numShips_);
 }
 
 void BerryBotsEngine::monitorCpuTimer(Team *team, bool fatal) {
-  unsigned int cpuTimeSlot = team->totalCpuTicks % CPU_TIME_TICKS;
   team->counter.stop();
+  recordCpuTime(team, fatal);
+}
+
+// Running out of CPU time or memory disables a team. Going over the memory
+// limit counts even if the team caught the error itself.
+bool BerryBotsEngine::isFatalError(Team *team, int pcallValue) {
+  return (pcallValue != 0 && lua_gethookcount(team->state) > 0)
+      || (!team->disabled && team->allocator->isExceeded());
+}
+
+void BerryBotsEngine::recordCpuTime(Team *team, bool fatal) {
+  unsigned int cpuTimeSlot = team->totalCpuTicks % CPU_TIME_TICKS;
   team->totalCpuTime +=
   (team->cpuTime[cpuTimeSlot] = team->counter.get_microseconds());
   team->totalCpuTicks++;
@@ -1037,10 +1569,56 @@ void BerryBotsEngine::monitorCpuTimer(Team *team, bool fatal) {
   }
 }
 
+// During a parallel team 'run', fires are held until all the teams are done.
+int BerryBotsEngine::fireLaser(Ship *ship, double heading) {
+  TeamRunBuffer *buffer = getTeamRunBuffer();
+  if (buffer == 0) {
+    return stage_->fireLaser(ship, heading, gameTime_);
+  } else if (ship->laserGunHeat > 0
+             || stage_->getLaserCount() >= stage_->getMaxLasers()) {
+    return 0;
+  }
+  addTeamRunAction(buffer, TEAM_RUN_LASER, ship, heading, 0, 0);
+  return 1;
+}
+
+int BerryBotsEngine::fireTorpedo(Ship *ship, double heading,
+                                 double distance) {
+  TeamRunBuffer *buffer = getTeamRunBuffer();
+  if (buffer == 0) {
+    return stage_->fireTorpedo(ship, heading, distance, gameTime_);
+  } else if (ship->torpedoGunHeat > 0
+             || stage_->getTorpedoCount() >= stage_->getMaxTorpedos()) {
+    return 0;
+  }
+  addTeamRunAction(buffer, TEAM_RUN_TORPEDO, ship, heading, distance, 0);
+  return 1;
+}
+
+// The stage's queries share candidate buffers and caches, so team 'run'
+// threads take turns with them.
+pthread_mutex_t* BerryBotsEngine::getStageQueryMutex() {
+  if (numTeamRunThreads_ == 1) {
+    return 0;
+  }
+  return &stageQueryMutex_;
+}
+
+bool BerryBotsEngine::inZone(Ship *ship, const char *zoneTag) {
+  StageQueryLock lock(getStageQueryMutex());
+  return stage_->inZone(ship, zoneTag);
+}
+
+bool BerryBotsEngine::inAnyZone(Ship *ship) {
+  StageQueryLock lock(getStageQueryMutex());
+  return stage_->inAnyZone(ship);
+}
+
 bool BerryBotsEngine::touchedZone(Ship *ship, const char *zoneTag) {
   Ship *oldShip =
       (physicsOver_ ? oldShips_[ship->index] : prevShips_[ship->index]);
   Ship *newShip = (physicsOver_ ? ship : oldShips_[ship->index]);
+  StageQueryLock lock(getStageQueryMutex());
   return stage_->touchedZone(oldShip, newShip, zoneTag);
 }
 
@@ -1048,9 +1626,70 @@ bool BerryBotsEngine::touchedAnyZone(Ship *ship) {
   Ship *oldShip =
       (physicsOver_ ? oldShips_[ship->index] : prevShips_[ship->index]);
   Ship *newShip = (physicsOver_ ? ship : oldShips_[ship->index]);
+  StageQueryLock lock(getStageQueryMutex());
   return stage_->touchedAnyZone(oldShip, newShip);
 }
 
+int BerryBotsEngine::touchedZones(Ship *ship, int *zoneIndexes) {
+  Ship *oldShip =
+      (physicsOver_ ? oldShips_[ship->index] : prevShips_[ship->index]);
+  Ship *newShip = (physicsOver_ ? ship : oldShips_[ship->index]);
+  StageQueryLock lock(getStageQueryMutex());
+  return stage_->touchedZones(oldShip, newShip, zoneIndexes);
+}
+
+// The wall queries take a batch at a time, so a batch only takes the lock
+// once. Each ray is (x, y, angle, maxDistance) and each hit is (distance, x,
+// y), with a distance of -1 if the ray hit nothing.
+void BerryBotsEngine::raycasts(double *rays, int numRays, double *hits) {
+  StageQueryLock lock(getStageQueryMutex());
+  for (int x = 0; x < numRays; x++) {
+    double *ray = &(rays[x * 4]);
+    double *hit = &(hits[x * 3]);
+    if (!stage_->raycast(ray[0], ray[1], ray[2], ray[3], &(hit[1]),
+                         &(hit[2]), &(hit[0]))) {
+      hit[0] = hit[1] = hit[2] = -1;
+    }
+  }
+}
+
+// Each line is (x1, y1, x2, y2).
+void BerryBotsEngine::linesOfSight(double *lines, int numLines,
+                                   bool *results) {
+  StageQueryLock lock(getStageQueryMutex());
+  for (int x = 0; x < numLines; x++) {
+    double *line = &(lines[x * 4]);
+    results[x] = stage_->lineOfSight(line[0], line[1], line[2], line[3]);
+  }
+}
+
+// Each point is (x, y) and each wall is (distance, x, y).
+void BerryBotsEngine::nearestWalls(double *points, int numPoints,
+                                   double *walls) {
+  StageQueryLock lock(getStageQueryMutex());
+  for (int x = 0; x < numPoints; x++) {
+    double *point = &(points[x * 2]);
+    double *wall = &(walls[x * 3]);
+    if (!stage_->nearestWall(point[0], point[1], &(wall[1]), &(wall[2]),
+                             &(wall[0]))) {
+      wall[0] = wall[1] = wall[2] = -1;
+    }
+  }
+}
+
+// The stage's navigation grid caches paths and distance fields as it goes.
+int BerryBotsEngine::findPath(double x1, double y1, double x2, double y2,
+                              double *waypoints, int maxWaypoints) {
+  StageQueryLock lock(getStageQueryMutex());
+  return stage_->findPath(x1, y1, x2, y2, waypoints, maxWaypoints);
+}
+
+double BerryBotsEngine::pathDistance(
+    double x1, double y1, double x2, double y2) {
+  StageQueryLock lock(getStageQueryMutex());
+  return stage_->getPathDistance(x1, y1, x2, y2);
+}
+
 void BerryBotsEngine::destroyShip(Ship *ship) {
   stage_->destroyShip(ship, gameTime_);
 }
@@ -1099,6 +1738,17 @@ void BerryBotsEngine::copyShips(
   }
 }
 
+// Copies back the stage ships the stage program touched since they were last
+// brought up to date. The others all need to be brought up to date again.
+void BerryBotsEngine::commitStageShips() {
+  for (int x = 0; x < numShips_; x++) {
+    if (stageShipsSynced_[x]) {
+      *(ships_[x]) = *(stageShips_[x]);
+      stageShipsSynced_[x] = false;
+    }
+  }
+}
+
 ReplayBuilder* BerryBotsEngine::getReplayBuilder() {
   deleteReplayBuilder_ = false;
   return replayBuilder_;
@@ -1109,12 +1759,17 @@ ReplayBuilder* BerryBotsEngine::getReplayBuilder() {
 //       GUI or CLI displays them appropriately.
 void BerryBotsEngine::printLuaErrorToShipConsole(lua_State *L,
                                                  const char *formatString) {
-  if (printHandler_ != 0) {
+  TeamRunBuffer *buffer = getTeamRunBuffer();
+  if (printHandler_ != 0 && !headless_) {
     char *errorMessage = formatLuaError(L, formatString);
-    if (printHandler_ != 0) {
-      printHandler_->shipError(L, errorMessage);
+    if (buffer != 0) {
+      addTeamRunAction(buffer, TEAM_RUN_ERROR, 0, 0, 0, errorMessage);
+    } else {
+      if (printHandler_ != 0) {
+        printHandler_->shipError(L, errorMessage);
+      }
+      replayBuilder_->addLogEntry(this->getTeam(L), gameTime_, errorMessage);
     }
-    replayBuilder_->addLogEntry(this->getTeam(L), gameTime_, errorMessage);
     delete errorMessage;
   }
   for (int x = 0; x < numInitializedTeams_; x++) {
@@ -1162,6 +1817,19 @@ EngineException::~EngineException() throw() {
   delete message_;
 }
 
+StageQueryLock::StageQueryLock(pthread_mutex_t *mutex) {
+  mutex_ = mutex;
+  if (mutex_ != 0) {
+    pthread_mutex_lock(mutex_);
+  }
+}
+
+StageQueryLock::~StageQueryLock() {
+  if (mutex_ != 0) {
+    pthread_mutex_unlock(mutex_);
+  }
+}
+
 ConsoleEventHandler::ConsoleEventHandler(BerryBotsEngine *engine) {
   engine_ = engine;
   tooManyStageRectangles_ = tooManyStageLines_ = false;
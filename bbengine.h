@@ -31,11 +31,27 @@
 #include "sensorhandler.h"
 #include "replaybuilder.h"
 #include "printhandler.h"
+#include "programcache.h"
+#include "randomgenerator.h"
+#include "tickprofiler.h"
+#include "luaallocator.h"
 
 #define PCALL_STAGE     1
 #define PCALL_SHIP      2
 #define PCALL_VALIDATE  3
 
+#define MAX_TEAM_RUN_THREADS      16
+#define DEFAULT_TEAM_RUN_THREADS  4
+
+#define TEAM_RUN_LASER    1
+#define TEAM_RUN_TORPEDO  2
+#define TEAM_RUN_PRINT    3
+#define TEAM_RUN_ERROR    4
+
+#define STOP_ON_GAME_OVER       0
+#define STOP_ON_ROUND_OVER      1
+#define STOP_ON_SHIP_DESTROYED  2
+
 #define TOO_MANY_RECTANGLES  "== Warning: Tried to draw too many DebugGfx rectangles (max 4096)."
 #define TOO_MANY_LINES       "== Warning: Tried to draw too many DebugGfx lines (max 4096)."
 #define TOO_MANY_CIRCLES     "== Warning: Tried to draw too many DebugGfx circles (max 4096)."
@@ -58,12 +74,56 @@ class EngineException : public std::exception {
     virtual const char* what() const throw();
 };
 
+// Holds a mutex until it goes out of scope, for the engine's wrappers around
+// stage queries. A null mutex, when teams don't run on their own threads, is
+// never locked.
+class StageQueryLock {
+  pthread_mutex_t *mutex_;
+
+  public:
+    StageQueryLock(pthread_mutex_t *mutex);
+    ~StageQueryLock();
+  private:
+    StageQueryLock(const StageQueryLock &);
+    StageQueryLock& operator=(const StageQueryLock &);
+};
+
+// Something a team's 'run' did that touches shared state, held until all the
+// teams have run, then carried out in team order.
 typedef struct {
-  lua_State *L;
-  volatile unsigned long timerTick;
-  volatile unsigned long timerExpiration;
-  volatile bool enabled;
-} TickTimerSettings;
+  int type;
+  Ship *ship;
+  double heading;
+  double distance;
+  char *text;
+} TeamRunAction;
+
+typedef struct {
+  Team *team;
+  Sensors *sensors;
+  int pcallValue;
+  TeamRunAction *actions;
+  int numActions;
+  int maxActions;
+  unsigned long long runStart;
+  unsigned long long runEnd;
+} TeamRunBuffer;
+
+// What happened during a call to runTicks.
+typedef struct {
+  int ticks;
+  int roundsOver;
+  int shipsDestroyed;
+  bool gameOver;
+  bool stopped;
+} TickSummary;
+
+class BerryBotsEngine;
+
+typedef struct {
+  BerryBotsEngine *engine;
+  pthread_t thread;
+} TeamRunWorker;
 
 class ConsoleEventHandler;
 
@@ -84,6 +144,9 @@ class BerryBotsEngine {
   Ship **stageShips_;  // the copy of all ships owned by the stage program
   Ship **oldShips_;    // the ships at the start of the current tick
   Ship **prevShips_;   // the ships at the start of the previous tick
+  // Which stage ship copies are up to date during the stage's 'run'. The rest
+  // are copied over the first time the stage program touches them.
+  bool *stageShipsSynced_;
   ShipProperties **shipProperties_;
   int numTeams_;
   int numInitializedTeams_;
@@ -94,8 +157,21 @@ class BerryBotsEngine {
   ShipGfx **shipGfxs_;
   StageGfx *stageGfx_;
   bool** teamVision_;
-  pthread_t timerThread_;
-  TickTimerSettings *timerSettings_;
+  // Parallel team 'run' calls, off unless setTeamRunThreads is called.
+  int numTeamRunThreads_;
+  TeamRunWorker *teamRunWorkers_;
+  TeamRunBuffer *teamRunBuffers_;
+  pthread_key_t teamRunKey_;
+  pthread_mutex_t teamRunMutex_;
+  pthread_mutex_t stageQueryMutex_;
+  pthread_cond_t teamRunStart_;
+  pthread_cond_t teamRunDone_;
+  unsigned long teamRunGeneration_;
+  int *teamRunJobs_;
+  int numTeamRunJobs_;
+  int nextTeamRunJob_;
+  int numTeamRunJobsDone_;
+  bool teamRunShutdown_;
 
   int gameTime_;
   SensorHandler *sensorHandler_;
@@ -114,6 +190,13 @@ class BerryBotsEngine {
   bool deleteReplayBuilder_;
   ReplayEventHandler *replayHandler_;
   char *replayTemplateDir_;
+  // Headless engines skip the replay, user gfx and console output entirely.
+  bool headless_;
+  ProgramCache *programCache_;
+  RandomGenerator *random_;
+  TickProfiler *profiler_;
+  size_t memoryLimit_;
+  LuaAllocator *stageAllocator_;
 
   public:
     BerryBotsEngine(PrintHandler *printHandler, FileManager *manager,
@@ -146,9 +229,21 @@ class BerryBotsEngine {
     void stagePrint(const char *text);
     void shipPrint(lua_State *L, const char *text);
     void processTick() throw (EngineException*);
+    TickSummary runTicks(int numTicks, int stopCondition)
+        throw (EngineException*);
     void processRoundOver();
     void processGameOver();
     void monitorCpuTimer(Team *team, bool fatal);
+    void setTeamRunThreads(int numThreads);
+    int getTeamRunThreads();
+    void setHeadless(bool headless);
+    bool isHeadless();
+    void setRandomSeed(unsigned int randomSeed);
+    void setProgramCache(ProgramCache *programCache);
+    void setProfiling(bool profiling);
+    void setMemoryLimit(size_t maxBytes);
+    size_t getMemoryLimit();
+    TickProfiler* getProfiler();
 
     Stage* getStage();
     Team** getTeams();
@@ -159,14 +254,27 @@ class BerryBotsEngine {
     Ship** getShips();
     int getNumShips();
     Ship* getStageProgramShip(const char *name);
+    void syncStageShip(Ship *ship);
+    void syncStageShips();
     int getGameTime();
     void setTeamSize(int teamSize);
     int getTeamSize();
 
+    int fireLaser(Ship *ship, double heading);
+    int fireTorpedo(Ship *ship, double heading, double distance);
+    bool inZone(Ship *ship, const char *zoneTag);
+    bool inAnyZone(Ship *ship);
     bool touchedZone(Ship *ship, const char *zoneTag);
     bool touchedAnyZone(Ship *ship);
+    int touchedZones(Ship *ship, int *zoneIndexes);
+    void raycasts(double *rays, int numRays, double *hits);
+    void linesOfSight(double *lines, int numLines, bool *results);
+    void nearestWalls(double *points, int numPoints, double *walls);
+    int findPath(double x1, double y1, double x2, double y2,
+                 double *waypoints, int maxWaypoints);
+    double pathDistance(double x1, double y1, double x2, double y2);
     void destroyShip(Ship *ship);
-    static void* timer(void *vargs);
+    static void* teamRunWorker(void *vargs);
     int callUserLuaCode(lua_State *L,int nargs, const char *errorMsg,
                         int callStyle) throw (EngineException*);
     ReplayBuilder* getReplayBuilder();
@@ -175,9 +283,21 @@ class BerryBotsEngine {
     void initShipRound(Ship *ship);
     void updateTeamShipsAlive();
     void processStageRun() throw (EngineException*);
+    void processTeamRuns();
+    void runTeamJobs();
+    void waitForTeamRunJobs();
+    void addTeamRunAction(TeamRunBuffer *buffer, int type, Ship *ship,
+                          double heading, double distance, const char *text);
+    void applyTeamRunActions(TeamRunBuffer *buffer);
+    TeamRunBuffer* getTeamRunBuffer();
+    pthread_mutex_t* getStageQueryMutex();
+    bool isFatalError(Team *team, int pcallValue);
+    void recordCpuTime(Team *team, bool fatal);
     void uniqueShipNames(Ship** ships, int numShips);
     void uniqueTeamNames(Team** teams, int numTeams);
     void copyShips(Ship **srcShips, Ship **destShips, int numShips);
+    void commitStageShips();
+    int loadUserFile(lua_State *L, const char *dir, const char *filename);
     void printLuaErrorToShipConsole(lua_State *L, const char *formatString);
     void throwForLuaError(lua_State *L, const char *formatString)
         throw (EngineException*);
@@ -20,6 +20,7 @@
 
 #include <string.h>
 #include <stdlib.h>
+#include <math.h>
 #include <algorithm>
 #include <sstream>
 #include <stdio.h>
@@ -35,6 +36,7 @@
 #include "gamerunner.h"
 #include "bbrunner.h"
 #include "bblua.h"
+#include "ffiapi.h"
 
 // TODO: Consider moving some stuff between stage and engine.
 // TODO: Consider adding stage pointer to StageBuilder and Admin, for speed.
@@ -43,9 +45,9 @@
 //       by Lua (C -> Lua -> C). They are not fatal to the host app and are
 //       handled appropriately (CLI vs GUI) by the original C caller.
 
-void luaSrand(lua_State *L) {
+void luaSrand(lua_State *L, unsigned int randomSeed) {
   char *luaSrand = new char[100];
-  sprintf(luaSrand, "math.randomseed(%d)", rand());
+  sprintf(luaSrand, "math.randomseed(%u)", randomSeed);
   luaL_dostring(L, luaSrand);
   delete luaSrand;
 }
@@ -58,11 +60,12 @@ void abortHook(lua_State *L, lua_Debug *ar) {
   luaL_error(L, "Game Runner aborted.");
 }
 
-void initStageState(lua_State **stageState, const char *stageCwd) {
+void initStageState(lua_State **stageState, const char *stageCwd,
+                    unsigned int randomSeed) {
   *stageState = luaL_newstate();
   lua_setcwd(*stageState, stageCwd);
   luaL_openlibs(*stageState);
-  luaSrand(*stageState);
+  luaSrand(*stageState, randomSeed);
   registerStageBuilder(*stageState);
   registerShip(*stageState);
   registerWorld(*stageState);
@@ -72,12 +75,14 @@ void initStageState(lua_State **stageState, const char *stageCwd) {
   registerStageGlobals(*stageState);
 }
 
-void initShipState(lua_State **shipState, const char *shipCwd) {
+void initShipState(lua_State **shipState, const char *shipCwd,
+                   unsigned int randomSeed) {
   *shipState = luaL_newstate();
   lua_setcwd(*shipState, shipCwd);
   luaL_openlibs(*shipState);
-  luaSrand(*shipState);
+  luaSrand(*shipState, randomSeed);
   registerShip(*shipState);
+  registerEnemyShip(*shipState);
   registerSensors(*shipState);
   registerWorld(*shipState);
   registerShipGfx(*shipState);
@@ -88,7 +93,7 @@ void initRunnerState(lua_State **runnerState, const char *runnerCwd) {
   *runnerState = luaL_newstate();
   lua_setcwd(*runnerState, runnerCwd);
   luaL_openlibs(*runnerState);
-  luaSrand(*runnerState);
+  luaSrand(*runnerState, rand());
   registerRunnerForm(*runnerState);
   registerGameRunner(*runnerState);
   registerRunnerFiles(*runnerState);
@@ -163,6 +168,7 @@ Ship* checkShip(lua_State *L, int index) {
   luaL_checktype(L, index, LUA_TUSERDATA);
   Ship *ship = (Ship *) luaL_checkudata(L, index, SHIP);
   if (ship == NULL) luaL_error(L, "error in checkShip");
+  ship->properties->engine->syncStageShip(ship);
   return ship;
 }
 
@@ -192,9 +198,8 @@ int Ship_fireThruster(lua_State *L) {
 int Ship_fireLaser(lua_State *L) {
   Ship *ship = checkShip(L, 1);
   if (ship->alive && ship->laserEnabled
-      && ship->properties->engine->getStage()->fireLaser(
-          ship, luaL_checknumber(L, 2),
-          ship->properties->engine->getGameTime())) {
+      && ship->properties->engine->fireLaser(
+          ship, luaL_checknumber(L, 2))) {
     ship->laserGunHeat = LASER_HEAT;
     lua_pushboolean(L, true);
   } else {
@@ -206,10 +211,9 @@ int Ship_fireLaser(lua_State *L) {
 int Ship_fireTorpedo(lua_State *L) {
   Ship *ship = checkShip(L, 1);
   if (ship->alive && ship->torpedoEnabled
-      && ship->properties->engine->getStage()->fireTorpedo(
+      && ship->properties->engine->fireTorpedo(
           ship, luaL_checknumber(L, 2),
-          std::max(0.0, (double) luaL_checknumber(L, 3)),
-          ship->properties->engine->getGameTime())) {
+          std::max(0.0, (double) luaL_checknumber(L, 3)))) {
     ship->torpedoGunHeat = TORPEDO_HEAT;
     lua_pushboolean(L, true);
   } else {
@@ -420,6 +424,26 @@ int Ship_teamName(lua_State *L) {
   return 1;
 }
 
+// Views are used from the next time the team's 'run' is called.
+int Ship_setEnemyShipViews(lua_State *L) {
+  Ship *ship = checkShip(L, 1);
+  Team *team = ship->properties->engine->getTeam(ship->teamIndex);
+  if (team->state == L) {
+    team->enemyShipViews = lua_toboolean(L, 2);
+  }
+  return 0;
+}
+
+int Ship_enableFfiMethods(lua_State *L) {
+  Ship *ship = checkShip(L, 1);
+  Team *team = ship->properties->engine->getTeam(ship->teamIndex);
+  if (team->state == L && !team->ffiMethods) {
+    team->ffiMethods = true;
+    registerFfiMethods(L);
+  }
+  return 0;
+}
+
 const luaL_Reg Ship_methods[] = {
   {"fireThruster",      Ship_fireThruster},
   {"fireLaser",         Ship_fireLaser},
@@ -442,6 +466,8 @@ const luaL_Reg Ship_methods[] = {
   {"setThrusterColor",  Ship_setThrusterColor},
   {"name",              Ship_name},
   {"teamName",          Ship_teamName},
+  {"setEnemyShipViews", Ship_setEnemyShipViews},
+  {"enableFfiMethods",  Ship_enableFfiMethods},
   {0, 0}
 };
 
@@ -471,6 +497,123 @@ void pushVisibleEnemyShips(
   }
 }
 
+// Like pushVisibleEnemyShips, but each enemy ship is a small userdata that
+// reads its fields from the engine's snapshot of the ships, so we don't build
+// a table for every enemy ship on every tick.
+void pushVisibleEnemyShipViews(lua_State *L, bool *teamVision,
+    int teamIndex, Ship **ships, int numShips, int gameTime) {
+  lua_newtable(L);
+  luaL_getmetatable(L, ENEMY_SHIP);
+  int visibleIndex = 1;
+  for (int x = 0; x < numShips; x++) {
+    Ship *ship = ships[x];
+    if (ship->teamIndex != teamIndex && teamVision[x]) {
+      EnemyShip *enemyShip =
+          (EnemyShip *) lua_newuserdata(L, sizeof(EnemyShip));
+      enemyShip->ship = ship;
+      enemyShip->gameTime = gameTime;
+      lua_pushvalue(L, -2);
+      lua_setmetatable(L, -2);
+      lua_rawseti(L, -3, visibleIndex++);
+    }
+  }
+  lua_pop(L, 1);
+}
+
+EnemyShip* checkEnemyShip(lua_State *L, int index) {
+  luaL_checktype(L, index, LUA_TUSERDATA);
+  EnemyShip *enemyShip = (EnemyShip *) luaL_checkudata(L, index, ENEMY_SHIP);
+  if (enemyShip == NULL) luaL_error(L, "error in checkEnemyShip");
+  return enemyShip;
+}
+
+// Lua strings are interned, so a key is one of these fields if its pointer is
+// the same as the one for the field name we saved.
+typedef struct {
+  const char *x;
+  const char *y;
+  const char *heading;
+  const char *speed;
+  const char *energy;
+  const char *isStageShip;
+  const char *name;
+  const char *teamName;
+} EnemyShipKeys;
+
+int EnemyShip_index(lua_State *L) {
+  EnemyShip *enemyShip = checkEnemyShip(L, 1);
+  Ship *ship = enemyShip->ship;
+  BerryBotsEngine *engine = ship->properties->engine;
+  if (enemyShip->gameTime != engine->getGameTime()) {
+    luaL_error(L,
+        "Enemy ship views can only be used on the tick they're from.");
+  }
+  if (lua_type(L, 2) != LUA_TSTRING) {
+    lua_pushnil(L);
+    return 1;
+  }
+
+  const char *key = lua_tostring(L, 2);
+  EnemyShipKeys *keys =
+      (EnemyShipKeys *) lua_touserdata(L, lua_upvalueindex(1));
+  if (key == keys->x) {
+    lua_pushnumber(L, ship->x);
+  } else if (key == keys->y) {
+    lua_pushnumber(L, ship->y);
+  } else if (key == keys->heading) {
+    lua_pushnumber(L, ship->heading);
+  } else if (key == keys->speed) {
+    lua_pushnumber(L, ship->speed);
+  } else if (key == keys->energy) {
+    lua_pushnumber(L, ship->energy);
+  } else if (key == keys->isStageShip) {
+    lua_pushboolean(L, ship->properties->stageShip);
+  } else if (key == keys->name) {
+    lua_pushstring(L, ship->properties->name);
+  } else if (key == keys->teamName) {
+    lua_pushstring(L, engine->getTeam(ship->teamIndex)->name);
+  } else {
+    lua_pushnil(L);
+  }
+  return 1;
+}
+
+int EnemyShip_newindex(lua_State *L) {
+  luaL_error(L, "Enemy ship views are read-only.");
+  return 0;
+}
+
+const char* pushEnemyShipKey(lua_State *L, const char *key) {
+  lua_pushstring(L, key);
+  return lua_tostring(L, -1);
+}
+
+int registerEnemyShip(lua_State *L) {
+  luaL_newmetatable(L, ENEMY_SHIP);
+  lua_pushliteral(L, "__index");
+  EnemyShipKeys *keys =
+      (EnemyShipKeys *) lua_newuserdata(L, sizeof(EnemyShipKeys));
+  // The key strings are upvalues too, so they're never collected.
+  keys->x = pushEnemyShipKey(L, "x");
+  keys->y = pushEnemyShipKey(L, "y");
+  keys->heading = pushEnemyShipKey(L, "heading");
+  keys->speed = pushEnemyShipKey(L, "speed");
+  keys->energy = pushEnemyShipKey(L, "energy");
+  keys->isStageShip = pushEnemyShipKey(L, "isStageShip");
+  keys->name = pushEnemyShipKey(L, "name");
+  keys->teamName = pushEnemyShipKey(L, "teamName");
+  lua_pushcclosure(L, EnemyShip_index, 9);
+  lua_rawset(L, -3);
+  lua_pushliteral(L, "__newindex");
+  lua_pushcfunction(L, EnemyShip_newindex);
+  lua_rawset(L, -3);
+  lua_pushliteral(L, "__metatable");
+  lua_pushliteral(L, ENEMY_SHIP);
+  lua_rawset(L, -3);
+  lua_pop(L, 1);
+  return 1;
+}
+
 Sensors* checkSensors(lua_State *L, int index) {
   luaL_checktype(L, index, LUA_TUSERDATA);
   Sensors *sensors = (Sensors *) luaL_checkudata(L, index, SENSORS);
@@ -484,12 +627,96 @@ Sensors* pushSensors(
   Sensors *sensors = (Sensors *) lua_newuserdata(L, sizeof(Sensors));
   luaL_getmetatable(L, SENSORS);
   lua_setmetatable(L, -2);
+  // Kept from GC until cleanupSensorsTables, which still needs it.
+  sensors->sensorsRef = luaL_ref(L, LUA_REGISTRYINDEX);
+  lua_rawgeti(L, LUA_REGISTRYINDEX, sensors->sensorsRef);
   int teamIndex = team->index;
+  sensors->sensorHandler = sensorHandler;
+  sensors->properties = properties;
+  sensors->teamIndex = teamIndex;
+
+  // Events that come in while the team is running are left for next tick.
+  sensors->numHitByShips = sensorHandler->numHitByShips(teamIndex);
+  sensors->numHitByLasers = sensorHandler->numHitByLasers(teamIndex);
+  sensors->numHitByTorpedos = sensorHandler->numHitByTorpedos(teamIndex);
+  sensors->numHitWalls = sensorHandler->numHitWalls(teamIndex);
+  sensors->numShipDestroyeds = sensorHandler->numShipDestroyeds(teamIndex);
+  sensors->numShipFiredLasers = sensorHandler->numShipFiredLasers(teamIndex);
+  sensors->numShipFiredTorpedos =
+      sensorHandler->numShipFiredTorpedos(teamIndex);
+  sensors->numLaserHitShips = sensorHandler->numLaserHitShips(teamIndex);
+
+  sensors->hitByShipRef = LUA_NOREF;
+  sensors->hitByLaserRef = LUA_NOREF;
+  sensors->hitByTorpedoRef = LUA_NOREF;
+  sensors->hitWallRef = LUA_NOREF;
+  sensors->shipDestroyedRef = LUA_NOREF;
+  sensors->shipFiredLaserRef = LUA_NOREF;
+  sensors->shipFiredTorpedoRef = LUA_NOREF;
+  sensors->laserHitShipRef = LUA_NOREF;
+  sensors->stageEventRef =
+      (team->stageEventRef == 0) ? LUA_NOREF : team->stageEventRef;
+  team->stageEventRef = 0;
 
-  lua_newtable(L);
-  int numHitByShips = sensorHandler->numHitByShips(teamIndex);
-  HitByShip** hitByShipEvents = sensorHandler->getHitByShips(teamIndex);
-  for (int x = 0; x < numHitByShips; x++) {
+  return sensors;
+}
+
+// Clears the events the team was shown and expires the Sensors, so a bot that
+// holds on to them only gets empty tables after this tick.
+void cleanupSensorsTables(lua_State *L, Sensors *sensors) {
+  SensorHandler *sensorHandler = sensors->sensorHandler;
+  int teamIndex = sensors->teamIndex;
+  sensorHandler->clearHitByShips(teamIndex, sensors->numHitByShips);
+  sensorHandler->clearHitByLasers(teamIndex, sensors->numHitByLasers);
+  sensorHandler->clearHitByTorpedos(teamIndex, sensors->numHitByTorpedos);
+  sensorHandler->clearHitWalls(teamIndex, sensors->numHitWalls);
+  sensorHandler->clearShipDestroyeds(teamIndex, sensors->numShipDestroyeds);
+  sensorHandler->clearShipFiredLasers(teamIndex, sensors->numShipFiredLasers);
+  sensorHandler->clearShipFiredTorpedos(
+      teamIndex, sensors->numShipFiredTorpedos);
+  sensorHandler->clearLaserHitShips(teamIndex, sensors->numLaserHitShips);
+  sensors->sensorHandler = 0;
+
+  luaL_unref(L, LUA_REGISTRYINDEX, sensors->hitByShipRef);
+  luaL_unref(L, LUA_REGISTRYINDEX, sensors->hitByLaserRef);
+  luaL_unref(L, LUA_REGISTRYINDEX, sensors->hitByTorpedoRef);
+  luaL_unref(L, LUA_REGISTRYINDEX, sensors->hitWallRef);
+  luaL_unref(L, LUA_REGISTRYINDEX, sensors->shipDestroyedRef);
+  luaL_unref(L, LUA_REGISTRYINDEX, sensors->shipFiredLaserRef);
+  luaL_unref(L, LUA_REGISTRYINDEX, sensors->shipFiredTorpedoRef);
+  luaL_unref(L, LUA_REGISTRYINDEX, sensors->laserHitShipRef);
+  luaL_unref(L, LUA_REGISTRYINDEX, sensors->stageEventRef);
+  sensors->hitByShipRef = sensors->hitByLaserRef = LUA_NOREF;
+  sensors->hitByTorpedoRef = sensors->hitWallRef = LUA_NOREF;
+  sensors->shipDestroyedRef = sensors->shipFiredLaserRef = LUA_NOREF;
+  sensors->shipFiredTorpedoRef = sensors->laserHitShipRef = LUA_NOREF;
+  sensors->stageEventRef = LUA_NOREF;
+  luaL_unref(L, LUA_REGISTRYINDEX, sensors->sensorsRef);
+}
+
+// Event tables are only built the first time a bot asks for them each tick.
+int pushSensorsTable(lua_State *L, Sensors *sensors, int *ref,
+                     void (*fillTable)(lua_State *L, Sensors *sensors)) {
+  if (*ref != LUA_NOREF) {
+    lua_rawgeti(L, LUA_REGISTRYINDEX, *ref);
+  } else {
+    lua_newtable(L);
+    if (sensors->sensorHandler != 0) {
+      if (fillTable != 0) {
+        fillTable(L, sensors);
+      }
+      lua_pushvalue(L, -1);
+      *ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    }
+  }
+  return 1;
+}
+
+void fillHitByShips(lua_State *L, Sensors *sensors) {
+  ShipProperties **properties = sensors->properties;
+  HitByShip** hitByShipEvents =
+      sensors->sensorHandler->getHitByShips(sensors->teamIndex);
+  for (int x = 0; x < sensors->numHitByShips; x++) {
     HitByShip* hitByShip = hitByShipEvents[x];
     lua_newtable(L);
     setField(L, "time", hitByShip->time);
@@ -505,13 +732,13 @@ Sensors* pushSensors(
     setField(L, "outForce", hitByShip->outForce);
     lua_rawseti(L, -2, x + 1);
   }
-  sensors->hitByShipRef = luaL_ref(L, LUA_REGISTRYINDEX);
-  sensorHandler->clearHitByShips(teamIndex);
+}
 
-  lua_newtable(L);
-  int numHitByLasers = sensorHandler->numHitByLasers(teamIndex);
-  HitByLaser** hitByLaserEvents = sensorHandler->getHitByLasers(teamIndex);
-  for (int x = 0; x < numHitByLasers; x++) {
+void fillHitByLasers(lua_State *L, Sensors *sensors) {
+  ShipProperties **properties = sensors->properties;
+  HitByLaser** hitByLaserEvents =
+      sensors->sensorHandler->getHitByLasers(sensors->teamIndex);
+  for (int x = 0; x < sensors->numHitByLasers; x++) {
     HitByLaser* hitByLaser = hitByLaserEvents[x];
     lua_newtable(L);
     setField(L, "time", hitByLaser->time);
@@ -521,13 +748,13 @@ Sensors* pushSensors(
     setField(L, "laserHeading", hitByLaser->laserHeading);
     lua_rawseti(L, -2, x + 1);
   }
-  sensors->hitByLaserRef = luaL_ref(L, LUA_REGISTRYINDEX);
-  sensorHandler->clearHitByLasers(teamIndex);
+}
 
-  lua_newtable(L);
-  int numHitByTorpedos = sensorHandler->numHitByTorpedos(teamIndex);
-  HitByTorpedo** hitByTorpedoEvents = sensorHandler->getHitByTorpedos(teamIndex);
-  for (int x = 0; x < numHitByTorpedos; x++) {
+void fillHitByTorpedos(lua_State *L, Sensors *sensors) {
+  ShipProperties **properties = sensors->properties;
+  HitByTorpedo** hitByTorpedoEvents =
+      sensors->sensorHandler->getHitByTorpedos(sensors->teamIndex);
+  for (int x = 0; x < sensors->numHitByTorpedos; x++) {
     HitByTorpedo* hitByTorpedo = hitByTorpedoEvents[x];
     lua_newtable(L);
     setField(L, "time", hitByTorpedo->time);
@@ -537,13 +764,13 @@ Sensors* pushSensors(
     setField(L, "hitDamage", hitByTorpedo->hitDamage);
     lua_rawseti(L, -2, x + 1);
   }
-  sensors->hitByTorpedoRef = luaL_ref(L, LUA_REGISTRYINDEX);
-  sensorHandler->clearHitByTorpedos(teamIndex);
+}
 
-  lua_newtable(L);
-  int numHitWalls = sensorHandler->numHitWalls(teamIndex);
-  ShipHitWall** hitWallEvents = sensorHandler->getHitWalls(teamIndex);
-  for (int x = 0; x < numHitWalls; x++) {
+void fillHitWalls(lua_State *L, Sensors *sensors) {
+  ShipProperties **properties = sensors->properties;
+  ShipHitWall** hitWallEvents =
+      sensors->sensorHandler->getHitWalls(sensors->teamIndex);
+  for (int x = 0; x < sensors->numHitWalls; x++) {
     ShipHitWall* hitWall = hitWallEvents[x];
     lua_newtable(L);
     setField(L, "time", hitWall->time);
@@ -554,28 +781,26 @@ Sensors* pushSensors(
     setField(L, "bounceForce", hitWall->bounceForce);
     lua_rawseti(L, -2, x + 1);
   }
-  sensors->hitWallRef = luaL_ref(L, LUA_REGISTRYINDEX);
-  sensorHandler->clearHitWalls(teamIndex);
+}
 
-  lua_newtable(L);
-  int numShipDestroyeds = sensorHandler->numShipDestroyeds(teamIndex);
+void fillShipDestroyeds(lua_State *L, Sensors *sensors) {
+  ShipProperties **properties = sensors->properties;
   ShipDestroyed** shipDestroyedEvents =
-      sensorHandler->getShipDestroyeds(teamIndex);
-  for (int x = 0; x < numShipDestroyeds; x++) {
+      sensors->sensorHandler->getShipDestroyeds(sensors->teamIndex);
+  for (int x = 0; x < sensors->numShipDestroyeds; x++) {
     ShipDestroyed* shipDestroyed = shipDestroyedEvents[x];
     lua_newtable(L);
     setField(L, "time", shipDestroyed->time);
     setField(L, "shipName", properties[shipDestroyed->shipIndex]->name);
     lua_rawseti(L, -2, x + 1);
   }
-  sensors->shipDestroyedRef = luaL_ref(L, LUA_REGISTRYINDEX);
-  sensorHandler->clearShipDestroyeds(teamIndex);
+}
 
-  lua_newtable(L);
-  int numShipFiredLasers = sensorHandler->numShipFiredLasers(teamIndex);
+void fillShipFiredLasers(lua_State *L, Sensors *sensors) {
+  ShipProperties **properties = sensors->properties;
   ShipFiredLaser** shipFiredLaserEvents =
-      sensorHandler->getShipFiredLasers(teamIndex);
-  for (int x = 0; x < numShipFiredLasers; x++) {
+      sensors->sensorHandler->getShipFiredLasers(sensors->teamIndex);
+  for (int x = 0; x < sensors->numShipFiredLasers; x++) {
     ShipFiredLaser* shipFiredLaser = shipFiredLaserEvents[x];
     lua_newtable(L);
     setField(L, "time", shipFiredLaser->time);
@@ -584,14 +809,13 @@ Sensors* pushSensors(
     setField(L, "shipY", shipFiredLaser->shipY);
     lua_rawseti(L, -2, x + 1);
   }
-  sensors->shipFiredLaserRef = luaL_ref(L, LUA_REGISTRYINDEX);
-  sensorHandler->clearShipFiredLasers(teamIndex);
+}
 
-  lua_newtable(L);
-  int numShipFiredTorpedos = sensorHandler->numShipFiredTorpedos(teamIndex);
+void fillShipFiredTorpedos(lua_State *L, Sensors *sensors) {
+  ShipProperties **properties = sensors->properties;
   ShipFiredTorpedo** shipFiredTorpedoEvents =
-      sensorHandler->getShipFiredTorpedos(teamIndex);
-  for (int x = 0; x < numShipFiredTorpedos; x++) {
+      sensors->sensorHandler->getShipFiredTorpedos(sensors->teamIndex);
+  for (int x = 0; x < sensors->numShipFiredTorpedos; x++) {
     ShipFiredTorpedo* shipFiredTorpedo = shipFiredTorpedoEvents[x];
     lua_newtable(L);
     setField(L, "time", shipFiredTorpedo->time);
@@ -600,14 +824,13 @@ Sensors* pushSensors(
     setField(L, "shipY", shipFiredTorpedo->shipY);
     lua_rawseti(L, -2, x + 1);
   }
-  sensors->shipFiredTorpedoRef = luaL_ref(L, LUA_REGISTRYINDEX);
-  sensorHandler->clearShipFiredTorpedos(teamIndex);
+}
 
-  lua_newtable(L);
-  int numLaserHitShips = sensorHandler->numLaserHitShips(teamIndex);
+void fillLaserHitShips(lua_State *L, Sensors *sensors) {
+  ShipProperties **properties = sensors->properties;
   LaserHitShip** laserHitShipEvents =
-      sensorHandler->getLaserHitShips(teamIndex);
-  for (int x = 0; x < numLaserHitShips; x++) {
+      sensors->sensorHandler->getLaserHitShips(sensors->teamIndex);
+  for (int x = 0; x < sensors->numLaserHitShips; x++) {
     LaserHitShip* laserHitShip = laserHitShipEvents[x];
     lua_newtable(L);
     setField(L, "time", laserHitShip->time);
@@ -616,85 +839,60 @@ Sensors* pushSensors(
     setField(L, "targetY", laserHitShip->shipY);
     lua_rawseti(L, -2, x + 1);
   }
-  sensors->laserHitShipRef = luaL_ref(L, LUA_REGISTRYINDEX);
-  sensorHandler->clearLaserHitShips(teamIndex);
-
-  if (team->stageEventRef == 0) {
-    lua_newtable(L);
-    sensors->stageEventRef = luaL_ref(L, LUA_REGISTRYINDEX);
-  } else {
-    sensors->stageEventRef = team->stageEventRef;
-  }
-  team->stageEventRef = 0;
-
-  return sensors;
-}
-
-void cleanupSensorsTables(lua_State *L, Sensors *sensors) {
-  luaL_unref(L, LUA_REGISTRYINDEX, sensors->hitByShipRef);
-  luaL_unref(L, LUA_REGISTRYINDEX, sensors->hitByLaserRef);
-  luaL_unref(L, LUA_REGISTRYINDEX, sensors->hitByTorpedoRef);
-  luaL_unref(L, LUA_REGISTRYINDEX, sensors->hitWallRef);
-  luaL_unref(L, LUA_REGISTRYINDEX, sensors->shipDestroyedRef);
-  luaL_unref(L, LUA_REGISTRYINDEX, sensors->shipFiredLaserRef);
-  luaL_unref(L, LUA_REGISTRYINDEX, sensors->shipFiredTorpedoRef);
-  luaL_unref(L, LUA_REGISTRYINDEX, sensors->laserHitShipRef);
-  luaL_unref(L, LUA_REGISTRYINDEX, sensors->stageEventRef);
-  sensors->stageEventRef = 0;
 }
 
 int Sensors_hitByShipEvents(lua_State *L) {
   Sensors *sensors = checkSensors(L, 1);
-  lua_rawgeti(L, LUA_REGISTRYINDEX, sensors->hitByShipRef);
-  return 1;
+  return pushSensorsTable(
+      L, sensors, &(sensors->hitByShipRef), fillHitByShips);
 }
 
 int Sensors_hitByLaserEvents(lua_State *L) {
   Sensors *sensors = checkSensors(L, 1);
-  lua_rawgeti(L, LUA_REGISTRYINDEX, sensors->hitByLaserRef);
-  return 1;
+  return pushSensorsTable(
+      L, sensors, &(sensors->hitByLaserRef), fillHitByLasers);
 }
 
 int Sensors_hitByTorpedoEvents(lua_State *L) {
   Sensors *sensors = checkSensors(L, 1);
-  lua_rawgeti(L, LUA_REGISTRYINDEX, sensors->hitByTorpedoRef);
-  return 1;
+  return pushSensorsTable(
+      L, sensors, &(sensors->hitByTorpedoRef), fillHitByTorpedos);
 }
 
 int Sensors_hitWallEvents(lua_State *L) {
   Sensors *sensors = checkSensors(L, 1);
-  lua_rawgeti(L, LUA_REGISTRYINDEX, sensors->hitWallRef);
-  return 1;
+  return pushSensorsTable(L, sensors, &(sensors->hitWallRef), fillHitWalls);
 }
 
 int Sensors_shipDestroyedEvents(lua_State *L) {
   Sensors *sensors = checkSensors(L, 1);
-  lua_rawgeti(L, LUA_REGISTRYINDEX, sensors->shipDestroyedRef);
-  return 1;
+  return pushSensorsTable(
+      L, sensors, &(sensors->shipDestroyedRef), fillShipDestroyeds);
 }
 
 int Sensors_shipFiredLaserEvents(lua_State *L) {
   Sensors *sensors = checkSensors(L, 1);
-  lua_rawgeti(L, LUA_REGISTRYINDEX, sensors->shipFiredLaserRef);
-  return 1;
+  return pushSensorsTable(
+      L, sensors, &(sensors->shipFiredLaserRef), fillShipFiredLasers);
 }
 
 int Sensors_shipFiredTorpedoEvents(lua_State *L) {
   Sensors *sensors = checkSensors(L, 1);
-  lua_rawgeti(L, LUA_REGISTRYINDEX, sensors->shipFiredTorpedoRef);
-  return 1;
+  return pushSensorsTable(
+      L, sensors, &(sensors->shipFiredTorpedoRef), fillShipFiredTorpedos);
 }
 
 int Sensors_laserHitShipEvents(lua_State *L) {
   Sensors *sensors = checkSensors(L, 1);
-  lua_rawgeti(L, LUA_REGISTRYINDEX, sensors->laserHitShipRef);
-  return 1;
+  return pushSensorsTable(
+      L, sensors, &(sensors->laserHitShipRef), fillLaserHitShips);
 }
 
+// The stage builds this one as it sends events, we only need an empty table
+// if it didn't send any.
 int Sensors_stageEvents(lua_State *L) {
   Sensors *sensors = checkSensors(L, 1);
-  lua_rawgeti(L, LUA_REGISTRYINDEX, sensors->stageEventRef);
-  return 1;
+  return pushSensorsTable(L, sensors, &(sensors->stageEventRef), 0);
 }
 
 const luaL_Reg Sensors_methods[] = {
@@ -728,6 +926,9 @@ StageSensors* pushStageSensors(lua_State *L, SensorHandler *sensorHandler,
       (StageSensors *) lua_newuserdata(L, sizeof(StageSensors));
   luaL_getmetatable(L, STAGE_SENSORS);
   lua_setmetatable(L, -2);
+  // Kept from GC until cleanupStageSensorsTables, which still needs it.
+  stageSensors->stageSensorsRef = luaL_ref(L, LUA_REGISTRYINDEX);
+  lua_rawgeti(L, LUA_REGISTRYINDEX, stageSensors->stageSensorsRef);
 
   lua_newtable(L);
   int numShipHitShips = sensorHandler->numStageShipHitShips();
@@ -871,6 +1072,7 @@ void cleanupStageSensorsTables(
   luaL_unref(L, LUA_REGISTRYINDEX, stageSensors->shipDestroyedRef);
   luaL_unref(L, LUA_REGISTRYINDEX, stageSensors->shipFiredLaserRef);
   luaL_unref(L, LUA_REGISTRYINDEX, stageSensors->shipFiredTorpedoRef);
+  luaL_unref(L, LUA_REGISTRYINDEX, stageSensors->stageSensorsRef);
 }
 
 int StageSensors_shipHitShipEvents(lua_State *L) {
@@ -1079,6 +1281,36 @@ int StageBuilder_setTeamSize(lua_State *L) {
   return 1;
 }
 
+int StageBuilder_setMaxLasers(lua_State *L) {
+  StageBuilder *stageBuilder = checkStageBuilder(L, 1);
+  int maxLasers = luaL_checkint(L, 2);
+  BerryBotsEngine *engine = stageBuilder->engine;
+  if (engine->isStageConfigureComplete()) {
+    luaL_error(L, "Can't set max lasers outside of 'configure' function.");
+  } else {
+    engine->getStage()->setMaxLasers(maxLasers);
+    std::stringstream ss;
+    ss << "== Set max lasers: " << engine->getStage()->getMaxLasers();
+    engine->stagePrint(ss.str().c_str());
+  }
+  return 1;
+}
+
+int StageBuilder_setMaxTorpedos(lua_State *L) {
+  StageBuilder *stageBuilder = checkStageBuilder(L, 1);
+  int maxTorpedos = luaL_checkint(L, 2);
+  BerryBotsEngine *engine = stageBuilder->engine;
+  if (engine->isStageConfigureComplete()) {
+    luaL_error(L, "Can't set max torpedos outside of 'configure' function.");
+  } else {
+    engine->getStage()->setMaxTorpedos(maxTorpedos);
+    std::stringstream ss;
+    ss << "== Set max torpedos: " << engine->getStage()->getMaxTorpedos();
+    engine->stagePrint(ss.str().c_str());
+  }
+  return 1;
+}
+
 const luaL_Reg StageBuilder_methods[] = {
   {"setSize",        StageBuilder_setSize},
   {"setBattleMode",  StageBuilder_setBattleMode},
@@ -1087,6 +1319,8 @@ const luaL_Reg StageBuilder_methods[] = {
   {"addZone",        StageBuilder_addZone},
   {"addShip",        StageBuilder_addShip},
   {"setTeamSize",    StageBuilder_setTeamSize},
+  {"setMaxLasers",   StageBuilder_setMaxLasers},
+  {"setMaxTorpedos", StageBuilder_setMaxTorpedos},
   {0, 0}
 };
 
@@ -1229,7 +1463,7 @@ int World_teamSize(lua_State *L) {
 int World_inAnyZone(lua_State *L) {
   World *world = checkWorld(L, 1);
   Ship *ship = checkShip(L, 2);
-  lua_pushboolean(L, world->engine->getStage()->inAnyZone(ship));
+  lua_pushboolean(L, world->engine->inAnyZone(ship));
   return 1;
 }
 
@@ -1237,7 +1471,7 @@ int World_inZone(lua_State *L) {
   World *world = checkWorld(L, 1);
   Ship *ship = checkShip(L, 2);
   const char *zoneTag = luaL_optstring(L, 3, "");
-  lua_pushboolean(L, world->engine->getStage()->inZone(ship, zoneTag));
+  lua_pushboolean(L, world->engine->inZone(ship, zoneTag));
   return 1;
 }
 
@@ -1256,6 +1490,216 @@ int World_touchedZone(lua_State *L) {
   return 1;
 }
 
+int World_touchedZones(lua_State *L) {
+  World *world = checkWorld(L, 1);
+  Ship *ship = checkShip(L, 2);
+  int zoneIndexes[MAX_ZONES];
+  int numZones = world->engine->touchedZones(ship, zoneIndexes);
+  lua_rawgeti(L, LUA_REGISTRYINDEX, world->zonesRef);
+  lua_createtable(L, numZones, 0);
+  for (int x = 0; x < numZones; x++) {
+    lua_rawgeti(L, -2, zoneIndexes[x] + 1);
+    lua_rawseti(L, -2, x + 1);
+  }
+  lua_remove(L, -2);
+  return 1;
+}
+
+// Like luaL_checknumber, but NaN and infinity are errors too, since the
+// stage geometry queries have no answer for them.
+double checkFiniteNumber(lua_State *L, int index) {
+  double value = luaL_checknumber(L, index);
+  if (!isfinite(value)) {
+    luaL_argerror(L, index, "must be a finite number");
+  }
+  return value;
+}
+
+double optFiniteNumber(lua_State *L, int index, double defaultValue) {
+  if (lua_isnoneornil(L, index)) {
+    return defaultValue;
+  }
+  return checkFiniteNumber(L, index);
+}
+
+// Reads an array of queries, like {{x1, y1}, {x2, y2}}, into a userdata left
+// on the stack, numValues per query. Values past minValues can be nil (0).
+// Every value must be finite.
+double* checkQueries(lua_State *L, int index, int minValues, int numValues,
+                     int *numQueries) {
+  luaL_checktype(L, index, LUA_TTABLE);
+  int n = (int) lua_objlen(L, index);
+  double *queries =
+      (double *) lua_newuserdata(L, sizeof(double) * numValues * n);
+  for (int x = 0; x < n; x++) {
+    lua_rawgeti(L, index, x + 1);
+    if (!lua_istable(L, -1)) {
+      luaL_error(L, "Query %d is not a table.", x + 1);
+    }
+    for (int y = 0; y < numValues; y++) {
+      lua_rawgeti(L, -1, y + 1);
+      if (lua_isnumber(L, -1) && isfinite(lua_tonumber(L, -1))) {
+        queries[(x * numValues) + y] = lua_tonumber(L, -1);
+      } else if (y >= minValues && lua_isnil(L, -1)) {
+        queries[(x * numValues) + y] = 0;
+      } else {
+        luaL_error(L, "Query %d needs a finite number at index %d.", x + 1,
+                   y + 1);
+      }
+      lua_pop(L, 1);
+    }
+    lua_pop(L, 1);
+  }
+  *numQueries = n;
+  return queries;
+}
+
+// Pushes {distance, x, y} for a query result, or false if it's a miss (-1).
+void pushQueryResult(lua_State *L, double *result) {
+  if (result[0] < 0) {
+    lua_pushboolean(L, false);
+  } else {
+    lua_createtable(L, 3, 0);
+    for (int x = 0; x < 3; x++) {
+      lua_pushnumber(L, result[x]);
+      lua_rawseti(L, -2, x + 1);
+    }
+  }
+}
+
+int World_raycast(lua_State *L) {
+  World *world = checkWorld(L, 1);
+  double ray[4];
+  ray[0] = checkFiniteNumber(L, 2);
+  ray[1] = checkFiniteNumber(L, 3);
+  ray[2] = checkFiniteNumber(L, 4);
+  ray[3] = optFiniteNumber(L, 5, 0);
+  double hit[3];
+  world->engine->raycasts(ray, 1, hit);
+  if (hit[0] < 0) {
+    lua_pushnil(L);
+    return 1;
+  }
+  lua_pushnumber(L, hit[0]);
+  lua_pushnumber(L, hit[1]);
+  lua_pushnumber(L, hit[2]);
+  return 3;
+}
+
+int World_raycasts(lua_State *L) {
+  World *world = checkWorld(L, 1);
+  int numRays;
+  double *rays = checkQueries(L, 2, 3, 4, &numRays);
+  double *hits = (double *) lua_newuserdata(L, sizeof(double) * 3 * numRays);
+  world->engine->raycasts(rays, numRays, hits);
+  lua_createtable(L, numRays, 0);
+  for (int x = 0; x < numRays; x++) {
+    pushQueryResult(L, &(hits[x * 3]));
+    lua_rawseti(L, -2, x + 1);
+  }
+  return 1;
+}
+
+int World_lineOfSight(lua_State *L) {
+  World *world = checkWorld(L, 1);
+  double line[4];
+  line[0] = checkFiniteNumber(L, 2);
+  line[1] = checkFiniteNumber(L, 3);
+  line[2] = checkFiniteNumber(L, 4);
+  line[3] = checkFiniteNumber(L, 5);
+  bool result;
+  world->engine->linesOfSight(line, 1, &result);
+  lua_pushboolean(L, result);
+  return 1;
+}
+
+int World_linesOfSight(lua_State *L) {
+  World *world = checkWorld(L, 1);
+  int numLines;
+  double *lines = checkQueries(L, 2, 4, 4, &numLines);
+  bool *results = (bool *) lua_newuserdata(L, sizeof(bool) * numLines);
+  world->engine->linesOfSight(lines, numLines, results);
+  lua_createtable(L, numLines, 0);
+  for (int x = 0; x < numLines; x++) {
+    lua_pushboolean(L, results[x]);
+    lua_rawseti(L, -2, x + 1);
+  }
+  return 1;
+}
+
+int World_nearestWall(lua_State *L) {
+  World *world = checkWorld(L, 1);
+  double point[2];
+  point[0] = checkFiniteNumber(L, 2);
+  point[1] = checkFiniteNumber(L, 3);
+  double wall[3];
+  world->engine->nearestWalls(point, 1, wall);
+  if (wall[0] < 0) {
+    lua_pushnil(L);
+    return 1;
+  }
+  lua_pushnumber(L, wall[0]);
+  lua_pushnumber(L, wall[1]);
+  lua_pushnumber(L, wall[2]);
+  return 3;
+}
+
+int World_nearestWalls(lua_State *L) {
+  World *world = checkWorld(L, 1);
+  int numPoints;
+  double *points = checkQueries(L, 2, 2, 2, &numPoints);
+  double *walls = (double *) lua_newuserdata(L, sizeof(double) * 3 * numPoints);
+  world->engine->nearestWalls(points, numPoints, walls);
+  lua_createtable(L, numPoints, 0);
+  for (int x = 0; x < numPoints; x++) {
+    pushQueryResult(L, &(walls[x * 3]));
+    lua_rawseti(L, -2, x + 1);
+  }
+  return 1;
+}
+
+int World_findPath(lua_State *L) {
+  World *world = checkWorld(L, 1);
+  double x1 = checkFiniteNumber(L, 2);
+  double y1 = checkFiniteNumber(L, 3);
+  double x2 = checkFiniteNumber(L, 4);
+  double y2 = checkFiniteNumber(L, 5);
+  double pathWaypoints[PATH_WAYPOINTS * 2];
+  double *waypoints = pathWaypoints;
+  int numWaypoints = world->engine->findPath(
+      x1, y1, x2, y2, waypoints, PATH_WAYPOINTS);
+  if (numWaypoints == -1) {
+    lua_pushnil(L);
+    return 1;
+  }
+  if (numWaypoints > PATH_WAYPOINTS) {
+    waypoints =
+        (double *) lua_newuserdata(L, sizeof(double) * 2 * numWaypoints);
+    world->engine->findPath(x1, y1, x2, y2, waypoints, numWaypoints);
+  }
+  lua_createtable(L, numWaypoints, 0);
+  for (int x = 0; x < numWaypoints; x++) {
+    lua_createtable(L, 0, 2);
+    setField(L, "x", waypoints[x * 2]);
+    setField(L, "y", waypoints[(x * 2) + 1]);
+    lua_rawseti(L, -2, x + 1);
+  }
+  return 1;
+}
+
+int World_pathDistance(lua_State *L) {
+  World *world = checkWorld(L, 1);
+  double distance = world->engine->pathDistance(
+      checkFiniteNumber(L, 2), checkFiniteNumber(L, 3),
+      checkFiniteNumber(L, 4), checkFiniteNumber(L, 5));
+  if (distance < 0) {
+    lua_pushnil(L);
+  } else {
+    lua_pushnumber(L, distance);
+  }
+  return 1;
+}
+
 const luaL_Reg World_methods[] = {
   {"constants",       World_constants},
   {"walls",           World_walls},
@@ -1269,6 +1713,15 @@ const luaL_Reg World_methods[] = {
   {"inZone",          World_inZone},
   {"touchedAnyZone",  World_touchedAnyZone},
   {"touchedZone",     World_touchedZone},
+  {"touchedZones",    World_touchedZones},
+  {"raycast",         World_raycast},
+  {"raycasts",        World_raycasts},
+  {"lineOfSight",     World_lineOfSight},
+  {"linesOfSight",    World_linesOfSight},
+  {"nearestWall",     World_nearestWall},
+  {"nearestWalls",    World_nearestWalls},
+  {"findPath",        World_findPath},
+  {"pathDistance",    World_pathDistance},
   {0, 0}
 };
 
@@ -1505,6 +1958,7 @@ int Admin_reviveShip(lua_State *L) {
   if (ship != 0) {
     ship->alive = true;
     ship->energy = DEFAULT_ENERGY;
+    admin->engine->syncStageShips();
     admin->engine->getStage()->updateShipPosition(ship, ship->x, ship->y);
   }
   return 1;
@@ -1516,6 +1970,7 @@ int Admin_moveShip(lua_State *L) {
   if (ship != 0) {
     double x = luaL_checknumber(L, 3);
     double y = luaL_checknumber(L, 4);
+    admin->engine->syncStageShips();
     admin->engine->getStage()->updateShipPosition(ship, x, y);
   }
   return 1;
@@ -1860,8 +2315,11 @@ int registerStageGfx(lua_State *L) {
 
 int ShipGlobals_print(lua_State *L) {
   int top = lua_gettop(L);
-  const char *str = getPrintStr(L);
   BerryBotsEngine *engine = (BerryBotsEngine*) lua_getprinter(L);
+  if (engine != 0 && engine->isHeadless()) {
+    return 0;
+  }
+  const char *str = getPrintStr(L);
   if (engine != 0) {
     engine->shipPrint(L, str);
   }
@@ -1882,8 +2340,11 @@ int registerShipGlobals(lua_State *L) {
 
 int StageGlobals_print(lua_State *L) {
   int top = lua_gettop(L);
-  const char *str = getPrintStr(L);
   BerryBotsEngine *engine = (BerryBotsEngine*) lua_getprinter(L);
+  if (engine != 0 && engine->isHeadless()) {
+    return 0;
+  }
+  const char *str = getPrintStr(L);
   if (engine != 0) {
     engine->stagePrint(str);
   }
@@ -2112,6 +2573,16 @@ int GameRunner_setThreadCount(lua_State *L) {
   return 1;
 }
 
+int GameRunner_setForkMatches(lua_State *L) {
+  MatchRunner *runner = checkGameRunner(L, 1);
+  if (runner->gameRunner->started()) {
+    luaL_error(L, "Can't set fork matches after starting the first match.");
+  } else {
+    runner->gameRunner->setForkMatches(lua_toboolean(L, 2));
+  }
+  return 1;
+}
+
 int GameRunner_queueMatch(lua_State *L) {
   MatchRunner *runner = checkGameRunner(L, 1);
   if (lua_gettop(L) < 3) {
@@ -2121,7 +2592,13 @@ int GameRunner_queueMatch(lua_State *L) {
     int numShips;
     char **ships;
     getStringArgs(L, 3, ships, numShips);
-    runner->gameRunner->queueMatch(stageName, ships, numShips);
+    bool headless = false;
+    if (lua_istable(L, 4)) {
+      lua_getfield(L, 4, "headless");
+      headless = lua_toboolean(L, -1);
+      lua_pop(L, 1);
+    }
+    runner->gameRunner->queueMatch(stageName, ships, numShips, headless);
     for (int x = 0; x < numShips; x++) {
       delete ships[x];
     }
@@ -2245,6 +2722,7 @@ int GameRunner_saveReplay(lua_State *L) {
 
 const luaL_Reg GameRunner_methods[] = {
   {"setThreadCount",  GameRunner_setThreadCount},
+  {"setForkMatches",  GameRunner_setForkMatches},
   {"queueMatch",      GameRunner_queueMatch},
   {"empty",           GameRunner_empty},
   {"nextResult",      GameRunner_nextResult},
@@ -42,6 +42,7 @@
 #define SOLID_WHITE_COLOR          {255, 255, 255, 255}
 #define DEFAULT_OUTLINE_THICKNESS  2
 #define DEFAULT_LINE_THICKNESS     2
+#define PATH_WAYPOINTS             64
 
 extern "C" {
   #include "lua.h"
@@ -51,6 +52,7 @@ extern "C" {
 
 extern int registerShip(lua_State *L);
 extern int registerSensors(lua_State *L);
+extern int registerEnemyShip(lua_State *L);
 extern int registerStageSensors(lua_State *L);
 extern int registerStageBuilder(lua_State *L);
 extern int registerWall(lua_State *L);
@@ -68,12 +70,16 @@ extern int registerRunnerGlobals(lua_State *L);
 
 extern void killHook(lua_State *L, lua_Debug *ar);
 extern void abortHook(lua_State *L, lua_Debug *ar);
-extern void initStageState(lua_State **stageState, const char *stageCwd);
-extern void initShipState(lua_State **shipState, const char *shipCwd);
+extern void initStageState(lua_State **stageState, const char *stageCwd,
+                           unsigned int randomSeed);
+extern void initShipState(lua_State **shipState, const char *shipCwd,
+                          unsigned int randomSeed);
 extern void initRunnerState(lua_State **runnerState, const char *runnerCwd);
 extern Ship* pushShip(lua_State *L);
 extern void pushVisibleEnemyShips(
     lua_State *L, bool *teamVision, int teamIndex, Ship **ships, int numShips);
+extern void pushVisibleEnemyShipViews(lua_State *L, bool *teamVision,
+    int teamIndex, Ship **ships, int numShips, int gameTime);
 extern Sensors* pushSensors(
     Team *team, SensorHandler *sensorHandler, ShipProperties **properties);
 extern void cleanupSensorsTables(lua_State *L, Sensors *sensors);
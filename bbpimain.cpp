@@ -319,6 +319,15 @@ int main(int argc, char *argv[]) {
     }
   }
 
+  std::cout << std::endl << "Peak memory used (KB):" << std::endl;
+  for (int x = 0; x < engine->getNumTeams(); x++) {
+    Team *team = engine->getTeam(x);
+    if (!team->stageShip) {
+      std::cout << "  " << team->name << ": "
+                << (team->allocator->getPeakBytes() / 1024) << std::endl;
+    }
+  }
+
   if (realSeconds > 0) {
     std::cout << std::endl << "TPS: "
               << (((double) engine->getGameTime()) / realSeconds) << std::endl;
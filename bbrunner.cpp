@@ -29,8 +29,10 @@
 #include "replaybuilder.h"
 #include "bbrunner.h"
 
+// If forkMatches is set, headless matches are run in their own processes,
+// where the platform supports it. Other matches always run in threads.
 BerryBotsRunner::BerryBotsRunner(int threadCount, Zipper *zipper,
-                                 const char *replayTemplateDir) {
+    const char *replayTemplateDir, bool forkMatches) {
   stagesDir_ = new char[getStagesDir().length() + 1];
   strcpy(stagesDir_, getStagesDir().c_str());
   shipsDir_ = new char[getShipsDir().length() + 1];
@@ -50,6 +52,16 @@ BerryBotsRunner::BerryBotsRunner(int threadCount, Zipper *zipper,
   schedulerSettings_->numThreads = threadCount;
   schedulerSettings_->matchesRunning = 0;
   schedulerSettings_->zipper = zipper;
+  schedulerSettings_->programCache = new ProgramCache();
+  schedulerSettings_->forkServer = 0;
+  if (forkMatches) {
+    ForkServer *forkServer = new ForkServer(zipper);
+    if (forkServer->start()) {
+      schedulerSettings_->forkServer = forkServer;
+    } else {
+      delete forkServer;
+    }
+  }
   schedulerSettings_->done = false;
   schedulerSettings_->randomSeed = rand();
   pthread_create(&schedulerThread_, 0, BerryBotsRunner::scheduler,
@@ -70,10 +82,10 @@ BerryBotsRunner::~BerryBotsRunner() {
 }
 
 void BerryBotsRunner::queueMatch(const char *stageName, char **teamNames,
-                                 int numTeams) {
+                                 int numTeams, bool headless) {
   if (schedulerSettings_->numMatches < MAX_MATCHES) {
     MatchConfig *matchConfig = new MatchConfig(stageName, teamNames, numTeams,
-        stagesDir_, shipsDir_, cacheDir_, replayTemplateDir_);
+        stagesDir_, shipsDir_, cacheDir_, replayTemplateDir_, headless);
     schedulerSettings_->matches[schedulerSettings_->numMatches++] = matchConfig;
     // TODO: error handling for scheduling > max matches
   }
@@ -145,7 +157,7 @@ void BerryBotsRunner::deleteReplayBuilder(ReplayBuilder *replayBuilder) {
 
 void *BerryBotsRunner::scheduler(void *vargs) {
   SchedulerSettings *settings = (SchedulerSettings *) vargs;
-  srand(settings->randomSeed);
+  RandomGenerator *random = new RandomGenerator(settings->randomSeed);
   while (!settings->done) {
     platformstl::micro_sleep(SLEEP_INTERVAL);
     if (settings->matchesRunning < settings->numThreads) {
@@ -164,7 +176,7 @@ void *BerryBotsRunner::scheduler(void *vargs) {
         MatchSettings *matchSettings = new MatchSettings;
         matchSettings->schedulerSettings = settings;
         matchSettings->matchConfig = nextMatch;
-        matchSettings->randomSeed = rand();
+        matchSettings->randomSeed = random->next();
         pthread_create(&gameThread, 0, BerryBotsRunner::runMatch,
                        (void*) matchSettings);
         pthread_detach(gameThread);
@@ -190,19 +202,44 @@ void *BerryBotsRunner::scheduler(void *vargs) {
     delete settings->matches[x];
   }
 
+  delete random;
+  delete settings->programCache;
+  if (settings->forkServer != 0) {
+    delete settings->forkServer;
+  }
   delete settings;
   return 0;
 }
 
 void* BerryBotsRunner::runMatch(void *vargs) {
   MatchSettings *settings = (MatchSettings *) vargs;
-  srand(settings->randomSeed);
   MatchConfig *config = settings->matchConfig;
   SchedulerSettings *schedulerSettings = settings->schedulerSettings;
 
-  FileManager *fileManager = new FileManager(schedulerSettings->zipper);
+  if (schedulerSettings->forkServer != 0 && config->isHeadless()) {
+    schedulerSettings->forkServer->runMatch(
+        config, settings->randomSeed, &(schedulerSettings->done));
+  } else {
+    playMatch(config, settings->randomSeed, schedulerSettings->zipper,
+              schedulerSettings->programCache, &(schedulerSettings->done));
+  }
+  config->finished();
+
+  schedulerSettings->matchesRunning--;
+  delete settings;
+  return 0;
+}
+
+// Runs the match and fills in its results on config, unless quit is set
+// before it's over.
+void BerryBotsRunner::playMatch(MatchConfig *config, unsigned int randomSeed,
+    Zipper *zipper, ProgramCache *programCache, volatile bool *quit) {
+  FileManager *fileManager = new FileManager(zipper);
   BerryBotsEngine *engine =
       new BerryBotsEngine(0, fileManager, config->getReplayTemplateDir());
+  engine->setHeadless(config->isHeadless());
+  engine->setRandomSeed(randomSeed);
+  engine->setProgramCache(programCache);
   bool aborted = false;
   try {
     engine->initStage(config->getStagesDir(), config->getStageName(),
@@ -216,8 +253,8 @@ void* BerryBotsRunner::runMatch(void *vargs) {
   }
 
   try {
-    while (!aborted && !schedulerSettings->done && !engine->isGameOver()) {
-      engine->processTick();
+    while (!aborted && !(*quit) && !engine->isGameOver()) {
+      engine->runTicks(RUNNER_TICK_BATCH, STOP_ON_GAME_OVER);
     }
   } catch (EngineException *e) {
     config->setErrorMessage(e->what());
@@ -233,24 +270,22 @@ void* BerryBotsRunner::runMatch(void *vargs) {
     config->setTeamResults(engine->getTeamResults());
 
     // TODO: move this into a function in the engine
-    Team **rankedTeams = engine->getRankedTeams();
-    engine->getReplayBuilder()->setResults(rankedTeams, engine->getNumTeams());
-    delete rankedTeams;
+    if (!engine->isHeadless()) {
+      Team **rankedTeams = engine->getRankedTeams();
+      engine->getReplayBuilder()->setResults(rankedTeams,
+                                             engine->getNumTeams());
+      delete rankedTeams;
+    }
   }
   config->setHasScores(engine->hasScores());
   config->setReplayBuilder(engine->getReplayBuilder());
-  config->finished();
   delete engine;
   delete fileManager;
-
-  schedulerSettings->matchesRunning--;
-  delete settings;
-  return 0;
 }
 
 MatchConfig::MatchConfig(const char *stageName, char **teamNames,
     int numTeams, const char *stagesDir, const char *shipsDir,
-    const char *cacheDir, const char *replayTemplateDir) {
+    const char *cacheDir, const char *replayTemplateDir, bool headless) {
   stagesDir_ = new char[strlen(stagesDir) + 1];
   strcpy(stagesDir_, stagesDir);
   shipsDir_ = new char[strlen(shipsDir) + 1];
@@ -277,6 +312,7 @@ MatchConfig::MatchConfig(const char *stageName, char **teamNames,
   teamResults_ = 0;
   errorMessage_ = 0;
   replayBuilder_ = 0;
+  headless_ = headless;
 }
 
 MatchConfig::~MatchConfig() {
@@ -415,6 +451,10 @@ void MatchConfig::setErrorMessage(const char *errorMessage) {
   strcpy(errorMessage_, errorMessage);
 }
 
+bool MatchConfig::isHeadless() {
+  return headless_;
+}
+
 MatchResult::MatchResult(const char *stageName, char **teamNames, int numTeams,
     const char *winner, TeamResult **teamResults, bool hasScores,
     ReplayBuilder *replayBuilder, const char *errorMessage) {
@@ -21,13 +21,17 @@
 #ifndef BERRYBOTS_RUNNER
 #define BERRYBOTS_RUNNER
 
-#define MAX_MATCHES    100000
-#define SLEEP_INTERVAL  50000 // 0.05s
+#define MAX_MATCHES        100000
+#define SLEEP_INTERVAL      50000 // 0.05s
+#define RUNNER_TICK_BATCH     100 // ticks between checks for quitting
 
 #include <pthread.h>
 #include "bbutil.h"
 #include "zipper.h"
 #include "replaybuilder.h"
+#include "programcache.h"
+#include "forkserver.h"
+#include "randomgenerator.h"
 
 class RefresherListener {
   public:
@@ -51,11 +55,12 @@ class MatchConfig {
   bool hasScores_;
   ReplayBuilder *replayBuilder_;
   char *errorMessage_;
+  bool headless_;
 
   public:
     MatchConfig(const char *stageName, char **teamNames, int numTeams,
         const char *stagesDir, const char *shipsDir, const char *cacheDir,
-        const char *replayTemplateDir);
+        const char *replayTemplateDir, bool headless);
     ~MatchConfig();
     const char *getStagesDir();
     const char *getShipsDir();
@@ -81,6 +86,7 @@ class MatchConfig {
     void processedResult();
     const char *getErrorMessage();
     void setErrorMessage(const char *errorMessage);
+    bool isHeadless();
 };
 
 class MatchResult {
@@ -116,13 +122,15 @@ typedef struct {
   volatile int matchesRunning;
   volatile bool done;
   Zipper *zipper;
-  int randomSeed;
+  ProgramCache *programCache;
+  ForkServer *forkServer;
+  unsigned int randomSeed;
 } SchedulerSettings;
 
 typedef struct {
   SchedulerSettings *schedulerSettings;
   MatchConfig *matchConfig;
-  int randomSeed;
+  unsigned int randomSeed;
 } MatchSettings;
 
 class BerryBotsRunner {
@@ -136,9 +144,10 @@ class BerryBotsRunner {
 
   public:
     BerryBotsRunner(int threadCount, Zipper *zipper,
-                    const char *replayTemplateDir);
+                    const char *replayTemplateDir, bool forkMatches);
     ~BerryBotsRunner();
-    void queueMatch(const char *stageName, char **teamNames, int numTeams);
+    void queueMatch(const char *stageName, char **teamNames, int numTeams,
+                    bool headless);
     MatchResult* nextResult();
     bool allResultsProcessed();
     void quit();
@@ -146,6 +155,8 @@ class BerryBotsRunner {
     void deleteReplayBuilder(ReplayBuilder *replayBuilder);
     static void* scheduler(void *vargs);
     static void* runMatch(void *vargs);
+    static void playMatch(MatchConfig *config, unsigned int randomSeed,
+        Zipper *zipper, ProgramCache *programCache, volatile bool *quit);
 };
 
 #endif
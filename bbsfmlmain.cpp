@@ -43,8 +43,12 @@
 
 void printUsage() {
   std::cout << "Usage:" << std::endl;
-  std::cout << "  ./berrybots [-nodisplay] [-savereplay]"
-            << " <stage.lua> <bot1.lua> [<bot2.lua> ...]" << std::endl;
+  std::cout << "  ./berrybots [-nodisplay] [-savereplay] [-parallelrun]"
+            << " [-headless] [-seed <n>]" << std::endl;
+  std::cout << "      [-profile] [-profiletrace <trace.json>]"
+            << " [-maxmemory <megabytes>]" << std::endl;
+  std::cout << "      [-intervalcollisions]" << std::endl;
+  std::cout << "      <stage.lua> <bot1.lua> [<bot2.lua> ...]" << std::endl;
   std::cout << "  OR" << std::endl;
   std::cout << "  ./berrybots -packstage <stage.lua> <version>"
             << std::endl;
@@ -139,7 +143,17 @@ int main(int argc, char *argv[]) {
   
   bool nodisplay = flagExists(argc, argv, "nodisplay");
   bool saveReplay = flagExists(argc, argv, "savereplay");
-  int optArgsOffset = (nodisplay ? 1 : 0) + (saveReplay ? 1 : 0);
+  bool parallelRun = flagExists(argc, argv, "parallelrun");
+  bool headless = flagExists(argc, argv, "headless");
+  char **seedInfo = parseFlag(argc, argv, "seed", 1);
+  bool profile = flagExists(argc, argv, "profile");
+  char **traceInfo = parseFlag(argc, argv, "profiletrace", 1);
+  char **memoryInfo = parseFlag(argc, argv, "maxmemory", 1);
+  bool intervalCollisions = flagExists(argc, argv, "intervalcollisions");
+  int optArgsOffset = (nodisplay ? 1 : 0) + (saveReplay ? 1 : 0)
+      + (parallelRun ? 1 : 0) + (headless ? 1 : 0) + (seedInfo == 0 ? 0 : 2)
+      + (profile ? 1 : 0) + (traceInfo == 0 ? 0 : 2)
+      + (memoryInfo == 0 ? 0 : 2) + (intervalCollisions ? 1 : 0);
   if (argc < 3 + optArgsOffset) {
     printUsage();
   }
@@ -148,7 +162,35 @@ int main(int argc, char *argv[]) {
   CliPrintHandler *printHandler = new CliPrintHandler();
   BerryBotsEngine *engine =
       new BerryBotsEngine(printHandler, fileManager, resourcePath().c_str());
+  if (parallelRun) {
+    engine->setTeamRunThreads(DEFAULT_TEAM_RUN_THREADS);
+  }
+  if (headless && !saveReplay) {
+    engine->setHeadless(true);
+  }
+  if (seedInfo != 0) {
+    engine->setRandomSeed((unsigned int) strtoul(seedInfo[0], 0, 10));
+    delete seedInfo;
+  }
+  char *traceFilename = 0;
+  if (traceInfo != 0) {
+    traceFilename = traceInfo[0];
+    delete traceInfo;
+  }
+  if (profile || traceFilename != 0) {
+    engine->setProfiling(true);
+  }
+  if (memoryInfo != 0) {
+    engine->setMemoryLimit(((size_t) atoi(memoryInfo[0])) * 1024 * 1024);
+    delete memoryInfo;
+  }
   Stage *stage = engine->getStage();
+  // Finds the walls and ships each ship could hit again in every collision
+  // interval, like before swept checks. With the same -seed, a match should
+  // play out exactly the same either way.
+  if (intervalCollisions) {
+    stage->setSweptCollisionChecks(false);
+  }
 
   char *stageAbsName = fileManager->getAbsFilePath(argv[1 + optArgsOffset]);
   char *stageName =
@@ -355,11 +397,37 @@ int main(int argc, char *argv[]) {
     }
   }
 
+  std::cout << std::endl << "Peak memory used (KB):" << std::endl;
+  for (int x = 0; x < engine->getNumTeams(); x++) {
+    Team *team = engine->getTeam(x);
+    if (!team->stageShip) {
+      std::cout << "  " << team->name << ": "
+                << (team->allocator->getPeakBytes() / 1024) << std::endl;
+    }
+  }
+
   if (realSeconds > 0) {
     std::cout << std::endl << "TPS: "
               << (((double) engine->getGameTime()) / realSeconds) << std::endl;
   }
 
+  TickProfiler *profiler = engine->getProfiler();
+  if (profile) {
+    std::cout << std::endl;
+    profiler->writeSummary(
+        std::cout, engine->getTeams(), engine->getNumTeams());
+  }
+  if (traceFilename != 0) {
+    if (profiler->writeChromeTrace(
+            traceFilename, engine->getTeams(), engine->getNumTeams())) {
+      std::cout << std::endl << "Saved profiler trace to: " << traceFilename
+                << std::endl;
+    } else {
+      std::cout << std::endl << "Failed to save profiler trace to: "
+                << traceFilename << std::endl;
+    }
+  }
+
   if (saveReplay) {
     ReplayBuilder *replayBuilder = engine->getReplayBuilder();
 
@@ -29,6 +29,7 @@ extern "C" {
 }
 
 #define SHIP           "Ship"
+#define ENEMY_SHIP     "EnemyShip"
 #define SENSORS        "Sensors"
 #define STAGE_BUILDER  "StageBuilder"
 #define WALL           "Wall"
@@ -45,6 +46,8 @@ extern "C" {
 class BerryBotsEngine;
 class GameRunner;
 class ReplayBuilder;
+class LuaAllocator;
+class SensorHandler;
 
 // Graphic definition structs
 
@@ -161,6 +164,7 @@ typedef struct {
   bool hasGameOver;
   int stageEventRef;
   lua_State *state;
+  LuaAllocator *allocator;
   char name[MAX_NAME_LENGTH + 1];
   char filename[MAX_NAME_LENGTH + 1];
   platformstl::performance_counter counter;
@@ -172,6 +176,8 @@ typedef struct {
   bool errored;
   bool ownedByLua;
   bool gfxEnabled;
+  bool enemyShipViews;
+  bool ffiMethods;
   UserGfxRectangle* gfxRectangles[MAX_USER_RECTANGLES];
   int numRectangles;
   bool tooManyRectangles;
@@ -184,6 +190,7 @@ typedef struct {
   UserGfxText* gfxTexts[MAX_USER_TEXTS];
   int numTexts;
   bool tooManyTexts;
+  int gfxExpiry;
   TeamResult result;
 } Team;
 
@@ -233,7 +240,26 @@ typedef struct {
   ShipProperties *properties;
 } Ship;
 
+// A view of an enemy ship in the engine's snapshot of the ships at the start
+// of the tick, for teams that use enemy ship views.
 typedef struct {
+  Ship *ship;
+  int gameTime;
+} EnemyShip;
+
+typedef struct {
+  SensorHandler *sensorHandler;
+  ShipProperties **properties;
+  int teamIndex;
+  int sensorsRef;
+  int numHitByShips;
+  int numHitByLasers;
+  int numHitByTorpedos;
+  int numHitWalls;
+  int numShipDestroyeds;
+  int numShipFiredLasers;
+  int numShipFiredTorpedos;
+  int numLaserHitShips;
   int hitByShipRef;
   int hitByLaserRef;
   int hitByTorpedoRef;
@@ -304,6 +330,7 @@ typedef struct {
 } StageGfx;
 
 typedef struct {
+  int stageSensorsRef;
   int shipHitShipRef;
   int laserHitShipRef;
   int torpedoHitShipRef;
@@ -125,9 +125,7 @@ int main(int argc, char *argv[]) {
   printHandler->updateTeams(engine->getTeams());
   
   try {
-    while (!engine->isGameOver() && engine->getGameTime() < 100000) {
-      engine->processTick();
-    }
+    engine->runTicks(100000, STOP_ON_GAME_OVER);
   } catch (EngineException *e) {
     std::cout << "BerryBots encountered an error:" << std::endl;
     std::cout << "  " << e->what() << std::endl;
@@ -25,26 +25,27 @@
 
 Circle2D::Circle2D() {
   h_ = k_ = r_ = 0;
-  inverse_ = 0;
 }
 
 Circle2D::Circle2D(double x, double y, double r) {
   h_ = x;
   k_ = y;
   r_ = r;
-  inverse_ = 0;
 }
 
 bool Circle2D::intersects(Line2D *line) {
-  return intersects(line, false, false, (Point2D**) 0, (Point2D**) 0);
+  return intersects(line, false, false, 0, 0, 0);
 }
 
-bool Circle2D::intersects(Line2D *line, Point2D **p1, Point2D **p2) {
-  return intersects(line, false, true, p1, p2);
+// Up to two intersection points are written to p1 and p2, and numPoints is
+// incremented for each one. The caller should initialize numPoints to 0.
+bool Circle2D::intersects(
+    Line2D *line, Point2D *p1, Point2D *p2, int *numPoints) {
+  return intersects(line, false, true, p1, p2, numPoints);
 }
 
 bool Circle2D::intersects(Line2D *line, bool inverted, bool assignPoints,
-    Point2D **p1, Point2D **p2) {
+    Point2D *p1, Point2D *p2, int *numPoints) {
   if (h_ - line->xMax() > r_ || line->xMin() - h_ > r_ || k_ - line->yMax() > r_
       || line->yMin() - k_ > r_) {
     return false;
@@ -54,15 +55,16 @@ bool Circle2D::intersects(Line2D *line, bool inverted, bool assignPoints,
   double lineb = line->b();
 
   if (linem == DBL_MAX) {
-    Line2D *invLine = line->getInverse();
-    Circle2D *invCircle = this->getInverse();
-    return invCircle->intersects(invLine, !inverted, assignPoints, p1, p2);
+    Line2D invLine = line->getInverse();
+    Circle2D invCircle(k_, h_, r_);
+    return invCircle.intersects(
+        &invLine, !inverted, assignPoints, p1, p2, numPoints);
   } else {
     bool intersects = false;
 
     if (contains(line->x1(), line->y1())) {
       if (assignPoints) {
-        saveToNextPoint(p1, p2, line->x1(), line->y1(), inverted);
+        saveToNextPoint(p1, p2, numPoints, line->x1(), line->y1(), inverted);
         intersects = true;
       } else {
         return true;
@@ -70,9 +72,9 @@ bool Circle2D::intersects(Line2D *line, bool inverted, bool assignPoints,
     }
     if (contains(line->x2(), line->y2())) {
       if (assignPoints) {
-        saveToNextPoint(p1, p2, line->x2(), line->y2(), inverted);
+        saveToNextPoint(p1, p2, numPoints, line->x2(), line->y2(), inverted);
         intersects = true;
-        if (*p2 != 0) {
+        if (*numPoints == 2) {
           return true;
         }
       } else {
@@ -96,9 +98,9 @@ bool Circle2D::intersects(Line2D *line, bool inverted, bool assignPoints,
 
     if (x1 >= line->xMin() && x1 <= line->xMax()) {
       if (assignPoints) {
-        saveToNextPoint(p1, p2, x1, y1, inverted);
+        saveToNextPoint(p1, p2, numPoints, x1, y1, inverted);
         intersects = true;
-        if (*p2 != 0) {
+        if (*numPoints == 2) {
           return true;
         }
       } else {
@@ -111,7 +113,7 @@ bool Circle2D::intersects(Line2D *line, bool inverted, bool assignPoints,
       double y2 = (linem * x2) + lineb;
       if (x2 >= line->xMin() && x2 <= line->xMax()) {
         if (assignPoints) {
-          saveToNextPoint(p1, p2, x2, y2, inverted);
+          saveToNextPoint(p1, p2, numPoints, x2, y2, inverted);
           intersects = true;
         } else {
           return true;
@@ -147,36 +149,19 @@ double Circle2D::r() {
   return r_;
 }
 
-Circle2D* Circle2D::getInverse() {
-  if (inverse_ == 0) {
-    inverse_ = new Circle2D(k_, h_, r_);
-  }
-  return inverse_;
-}
-
 void Circle2D::setPosition(double x, double y) {
   h_ = x;
   k_ = y;
-  if (inverse_ != 0) {
-    delete inverse_;
-    inverse_ = 0;
-  }
 }
 
-void Circle2D::saveToNextPoint(
-    Point2D **p1, Point2D **p2, double x, double y, bool inverted) {
-  Point2D *newPoint = (inverted ? new Point2D(y, x) : new Point2D(x, y));
-  if (*p1 == 0) {
+void Circle2D::saveToNextPoint(Point2D *p1, Point2D *p2, int *numPoints,
+                               double x, double y, bool inverted) {
+  Point2D newPoint = (inverted ? Point2D(y, x) : Point2D(x, y));
+  if (*numPoints == 0) {
     *p1 = newPoint;
-  } else if (*p2 == 0) {
+    (*numPoints)++;
+  } else if (*numPoints == 1) {
     *p2 = newPoint;
-  } else {
-    delete newPoint;
-  }
-}
-
-Circle2D::~Circle2D() {
-  if (inverse_ != 0) {
-    delete inverse_;
+    (*numPoints)++;
   }
 }
@@ -26,25 +26,22 @@
 
 class Circle2D {
   double h_, k_, r_;
-  Circle2D* inverse_;
   public:
     Circle2D();
     Circle2D(double x, double y, double r);
-    ~Circle2D();
     bool intersects(Line2D *line);
-    bool intersects(Line2D *line, Point2D **p1, Point2D **p2);
+    bool intersects(Line2D *line, Point2D *p1, Point2D *p2, int *numPoints);
     bool overlaps(Circle2D *circle);
     bool contains(double x, double y);
     double h();
     double k();
     double r();
-    Circle2D* getInverse();
     void setPosition(double x, double y);
   private:
     bool intersects(Line2D *line, bool inverted, bool assignPoints,
-        Point2D **p1, Point2D **p2);
-    void saveToNextPoint(
-        Point2D **p1, Point2D **p2, double x, double y, bool inverted);
+        Point2D *p1, Point2D *p2, int *numPoints);
+    void saveToNextPoint(Point2D *p1, Point2D *p2, int *numPoints, double x,
+                         double y, bool inverted);
 };
 
 #endif
@@ -0,0 +1,203 @@
+/*
+  Copyright (C) 2015 - Voidious
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+*/
+
+
+#include <algorithm>
+#include <pthread.h>
+#include <platformstl/performance/performance_counter.hpp>
+#include <platformstl/synch/sleep_functions.h>
+#include "bblua.h"
+#include "cpuwatchdog.h"
+
+static pthread_once_t watchdogOnce = PTHREAD_ONCE_INIT;
+static pthread_mutex_t watchdogMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t watchdogWakeup = PTHREAD_COND_INITIALIZER;
+static WatchedCall *watchedCalls = 0;
+static int *freeCalls = 0;
+static int maxWatchedCalls = 0;
+static int numFreeCalls = 0;
+static int numWatchedCalls = 0;
+static bool watchdogRunning = false;
+static platformstl::performance_counter::epoch_type watchdogEpoch;
+
+// Returns an id to pass to unwatch when the call is done, or -1 if the
+// watchdog thread couldn't be started, in which case the call mustn't be run.
+int CpuWatchdog::watch(lua_State *L) {
+  pthread_once(&watchdogOnce, CpuWatchdog::init);
+  pthread_mutex_lock(&watchdogMutex);
+  if (!watchdogRunning && !start()) {
+    pthread_mutex_unlock(&watchdogMutex);
+    return -1;
+  }
+  if (numFreeCalls == 0) {
+    growWatchedCalls();
+  }
+  int watchId = freeCalls[--numFreeCalls];
+  WatchedCall *call = &(watchedCalls[watchId]);
+#ifdef CPU_WATCHDOG_THREAD_CLOCKS
+  pthread_getcpuclockid(pthread_self(), &(call->clock));
+#endif
+  call->L = L;
+  call->inUse = true;
+  call->startTime = getCallTime(call);
+  call->checkTime = getWallTime() + PCALL_TIME_LIMIT;
+  if (numWatchedCalls++ == 0) {
+    pthread_cond_signal(&watchdogWakeup);
+  }
+  pthread_mutex_unlock(&watchdogMutex);
+  return watchId;
+}
+
+void CpuWatchdog::unwatch(int watchId) {
+  if (watchId == -1) {
+    return;
+  }
+  pthread_mutex_lock(&watchdogMutex);
+  WatchedCall *call = &(watchedCalls[watchId]);
+  call->L = 0;
+  call->inUse = false;
+  freeCalls[numFreeCalls++] = watchId;
+  numWatchedCalls--;
+  pthread_mutex_unlock(&watchdogMutex);
+}
+
+void CpuWatchdog::init() {
+  watchdogEpoch = platformstl::performance_counter::get_epoch();
+  growWatchedCalls();
+#ifndef __WIN32__
+  pthread_atfork(CpuWatchdog::prepareFork, CpuWatchdog::parentAfterFork,
+                 CpuWatchdog::childAfterFork);
+#endif
+}
+
+// Called with the watchdog mutex held, or before any calls are watched.
+// Existing watch ids stay valid, since they're indexes into the table.
+void CpuWatchdog::growWatchedCalls() {
+  int newMaxCalls = std::max(INITIAL_WATCHED_CALLS, maxWatchedCalls * 2);
+  WatchedCall *newCalls = new WatchedCall[newMaxCalls];
+  int *newFreeCalls = new int[newMaxCalls];
+  for (int x = 0; x < maxWatchedCalls; x++) {
+    newCalls[x] = watchedCalls[x];
+  }
+  for (int x = 0; x < numFreeCalls; x++) {
+    newFreeCalls[x] = freeCalls[x];
+  }
+  for (int x = newMaxCalls - 1; x >= maxWatchedCalls; x--) {
+    newCalls[x].L = 0;
+    newCalls[x].inUse = false;
+    newFreeCalls[numFreeCalls++] = x;
+  }
+  if (watchedCalls != 0) {
+    delete watchedCalls;
+    delete freeCalls;
+  }
+  watchedCalls = newCalls;
+  freeCalls = newFreeCalls;
+  maxWatchedCalls = newMaxCalls;
+}
+
+// Called with the watchdog mutex held. Returns false if the watchdog thread
+// couldn't be created, so we can try again on the next call.
+bool CpuWatchdog::start() {
+  pthread_t watchdogThread;
+  if (pthread_create(&watchdogThread, 0, CpuWatchdog::run, 0) != 0) {
+    return false;
+  }
+  pthread_detach(watchdogThread);
+  watchdogRunning = true;
+  return true;
+}
+
+void CpuWatchdog::prepareFork() {
+  pthread_mutex_lock(&watchdogMutex);
+}
+
+void CpuWatchdog::parentAfterFork() {
+  pthread_mutex_unlock(&watchdogMutex);
+}
+
+// Only the thread that forked exists in the child, and it wasn't in a Lua call,
+// so none of the watched calls or the watchdog thread carry over.
+void CpuWatchdog::childAfterFork() {
+  pthread_mutex_init(&watchdogMutex, 0);
+  pthread_cond_init(&watchdogWakeup, 0);
+  for (int x = 0; x < maxWatchedCalls; x++) {
+    watchedCalls[x].L = 0;
+    watchedCalls[x].inUse = false;
+    freeCalls[x] = maxWatchedCalls - 1 - x;
+  }
+  numFreeCalls = maxWatchedCalls;
+  numWatchedCalls = 0;
+  watchdogRunning = false;
+}
+
+// A call that's used less than its limit by its check time gets checked
+// again when it could next run out, so a call that's waiting on the CPU is
+// never interrupted early.
+void* CpuWatchdog::run(void *) {
+  pthread_mutex_lock(&watchdogMutex);
+  while (true) {
+    while (numWatchedCalls == 0) {
+      pthread_cond_wait(&watchdogWakeup, &watchdogMutex);
+    }
+
+    unsigned long long now = getWallTime();
+    unsigned long long nextCheckTime = now + PCALL_TIME_LIMIT;
+    for (int x = 0; x < maxWatchedCalls; x++) {
+      WatchedCall *call = &(watchedCalls[x]);
+      if (call->L == 0) {
+        continue;
+      }
+      if (call->checkTime <= now) {
+        unsigned long long callTime = getCallTime(call) - call->startTime;
+        if (callTime >= PCALL_TIME_LIMIT) {
+          lua_sethook(call->L, killHook, LUA_MASKCOUNT, 1);
+          call->L = 0;
+          continue;
+        }
+        call->checkTime = now + (PCALL_TIME_LIMIT - callTime);
+      }
+      nextCheckTime = std::min(nextCheckTime, call->checkTime);
+    }
+
+    pthread_mutex_unlock(&watchdogMutex);
+    platformstl::micro_sleep((unsigned int) std::max(
+        (unsigned long long) MIN_WATCHDOG_SLEEP, nextCheckTime - now));
+    pthread_mutex_lock(&watchdogMutex);
+  }
+  return 0;
+}
+
+unsigned long long CpuWatchdog::getWallTime() {
+  return platformstl::performance_counter::get_microseconds(
+      watchdogEpoch, platformstl::performance_counter::get_epoch());
+}
+
+// The time used so far by the thread making the call, in microseconds.
+unsigned long long CpuWatchdog::getCallTime(WatchedCall *call) {
+#ifdef CPU_WATCHDOG_THREAD_CLOCKS
+  struct timespec cpuTime;
+  if (clock_gettime(call->clock, &cpuTime) == 0) {
+    return (((unsigned long long) cpuTime.tv_sec) * 1000000)
+        + (cpuTime.tv_nsec / 1000);
+  }
+#endif
+  return getWallTime();
+}
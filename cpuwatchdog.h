@@ -0,0 +1,76 @@
+/*
+  Copyright (C) 2015 - Voidious
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+*/
+
+
+#ifndef CPU_WATCHDOG_H
+#define CPU_WATCHDOG_H
+
+#include <pthread.h>
+
+extern "C" {
+  #include "lua.h"
+}
+
+#if defined(__linux__)
+#include <time.h>
+#define CPU_WATCHDOG_THREAD_CLOCKS
+#endif
+
+#define INITIAL_WATCHED_CALLS 64
+#define MIN_WATCHDOG_SLEEP    1000 // 1ms
+
+typedef struct {
+  lua_State *L;
+  bool inUse;
+  unsigned long long startTime;
+  unsigned long long checkTime;
+#ifdef CPU_WATCHDOG_THREAD_CLOCKS
+  clockid_t clock;
+#endif
+} WatchedCall;
+
+// Enforces the PCALL_TIME_LIMIT on Lua calls for every engine in the process,
+// from a single thread that's started the first time it's needed. Where the
+// platform lets us read the CPU time of another thread, the limit is on the
+// CPU time used by the calling thread. Otherwise, it's on wall clock time.
+//
+// The watchdog thread sleeps until the earliest time any call could run out
+// of time. Since every call has the same limit, a call being watched never
+// needs checking before the ones already being watched.
+//
+// A process forked from this one starts with no calls being watched, and
+// starts its own watchdog thread the first time it needs one.
+class CpuWatchdog {
+  public:
+    static int watch(lua_State *L);
+    static void unwatch(int watchId);
+  private:
+    static void init();
+    static void growWatchedCalls();
+    static bool start();
+    static void prepareFork();
+    static void parentAfterFork();
+    static void childAfterFork();
+    static void* run(void *vargs);
+    static unsigned long long getWallTime();
+    static unsigned long long getCallTime(WatchedCall *call);
+};
+
+#endif
@@ -0,0 +1,333 @@
+/*
+  Copyright (C) 2015 - Voidious
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+*/
+
+
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include "bbconst.h"
+#include "bbutil.h"
+#include "bbengine.h"
+#include "ffiapi.h"
+
+extern "C" {
+  #include "lualib.h"
+  #include "lauxlib.h"
+}
+
+typedef struct {
+  const char *type;
+  const char *name;
+  size_t offset;
+  size_t size;
+} FfiField;
+
+#define FFI_FIELD(s, t, f) {t, #f, offsetof(s, f), sizeof(((s *) 0)->f)}
+
+// Only the fields the Lua side touches. The rest of each struct is declared
+// as padding, so the C definitions can change without breaking this.
+FfiField shipFfiFields[] = {
+  FFI_FIELD(Ship, "double", thrusterAngle),
+  FFI_FIELD(Ship, "double", thrusterForce),
+  FFI_FIELD(Ship, "double", x),
+  FFI_FIELD(Ship, "double", y),
+  FFI_FIELD(Ship, "double", heading),
+  FFI_FIELD(Ship, "double", speed),
+  FFI_FIELD(Ship, "double", energy),
+  FFI_FIELD(Ship, "short", laserGunHeat),
+  FFI_FIELD(Ship, "short", torpedoGunHeat),
+  FFI_FIELD(Ship, "bool", hitWall),
+  FFI_FIELD(Ship, "bool", hitShip),
+  FFI_FIELD(Ship, "bool", alive),
+  FFI_FIELD(Ship, "bool", thrusterEnabled)
+};
+
+FfiField worldFfiFields[] = {
+  FFI_FIELD(World, "int", width),
+  FFI_FIELD(World, "int", height),
+  FFI_FIELD(World, "short", numShips),
+  FFI_FIELD(World, "short", teamSize),
+  FFI_FIELD(World, "int", time)
+};
+
+// The Lua half. Gets the cdefs, type checks, fire functions and method tables
+// as arguments. Each method tail calls the C function it replaces for anything
+// it doesn't handle, so bad arguments raise the same errors as before.
+const char *ffiApiSource =
+  "local cdefs, isShip, isWorld, fireLaserPtr, fireTorpedoPtr, maxForce,\n"
+  "    Ship, World = ...\n"
+  "local ok, ffi = pcall(require, 'ffi')\n"
+  "if not ok then return end\n"
+  "ffi.cdef(cdefs)\n"
+  "local cast, type = ffi.cast, type\n"
+  "local ShipPtr = ffi.typeof('BerryBotsShip *')\n"
+  "local WorldPtr = ffi.typeof('BerryBotsWorld *')\n"
+  "local cFireLaser =\n"
+  "    cast('int (*)(BerryBotsShip *, double)', fireLaserPtr)\n"
+  "local cFireTorpedo =\n"
+  "    cast('int (*)(BerryBotsShip *, double, double)', fireTorpedoPtr)\n"
+  "local ships, worlds = {}, {}\n"
+  "local function ship(s)\n"
+  "  if isShip(s) then\n"
+  "    local p = cast(ShipPtr, s)\n"
+  "    ships[s] = p\n"
+  "    return p\n"
+  "  end\n"
+  "end\n"
+  "local function world(w)\n"
+  "  if isWorld(w) then\n"
+  "    local p = cast(WorldPtr, w)\n"
+  "    worlds[w] = p\n"
+  "    return p\n"
+  "  end\n"
+  "end\n"
+  "local fireThruster, fireLaser, fireTorpedo =\n"
+  "    Ship.fireThruster, Ship.fireLaser, Ship.fireTorpedo\n"
+  "function Ship.fireThruster(s, angle, force)\n"
+  "  local p = ships[s] or ship(s)\n"
+  "  if p and type(angle) == 'number' and type(force) == 'number' then\n"
+  "    if p.alive and p.thrusterEnabled then\n"
+  "      if not (0 < force) then force = 0 end\n"
+  "      if not (force < maxForce) then force = maxForce end\n"
+  "      p.thrusterAngle = angle\n"
+  "      p.thrusterForce = force\n"
+  "      return true\n"
+  "    end\n"
+  "    return false\n"
+  "  end\n"
+  "  return fireThruster(s, angle, force)\n"
+  "end\n"
+  "function Ship.fireLaser(s, heading)\n"
+  "  local p = ships[s] or ship(s)\n"
+  "  if p and type(heading) == 'number' then\n"
+  "    return cFireLaser(p, heading) ~= 0\n"
+  "  end\n"
+  "  return fireLaser(s, heading)\n"
+  "end\n"
+  "function Ship.fireTorpedo(s, heading, distance)\n"
+  "  local p = ships[s] or ship(s)\n"
+  "  if p and type(heading) == 'number' and type(distance) == 'number' then\n"
+  "    return cFireTorpedo(p, heading, distance) ~= 0\n"
+  "  end\n"
+  "  return fireTorpedo(s, heading, distance)\n"
+  "end\n"
+  "local x, y, heading, speed, energy = Ship.x, Ship.y, Ship.heading,\n"
+  "    Ship.speed, Ship.energy\n"
+  "function Ship.x(s)\n"
+  "  local p = ships[s] or ship(s)\n"
+  "  if p then return p.x end\n"
+  "  return x(s)\n"
+  "end\n"
+  "function Ship.y(s)\n"
+  "  local p = ships[s] or ship(s)\n"
+  "  if p then return p.y end\n"
+  "  return y(s)\n"
+  "end\n"
+  "function Ship.heading(s)\n"
+  "  local p = ships[s] or ship(s)\n"
+  "  if p then return p.heading end\n"
+  "  return heading(s)\n"
+  "end\n"
+  "function Ship.speed(s)\n"
+  "  local p = ships[s] or ship(s)\n"
+  "  if p then return p.speed end\n"
+  "  return speed(s)\n"
+  "end\n"
+  "function Ship.energy(s)\n"
+  "  local p = ships[s] or ship(s)\n"
+  "  if p then return p.energy end\n"
+  "  return energy(s)\n"
+  "end\n"
+  "local laserGunHeat, torpedoGunHeat, hitWall, hitShip, alive =\n"
+  "    Ship.laserGunHeat, Ship.torpedoGunHeat, Ship.hitWall, Ship.hitShip,\n"
+  "    Ship.alive\n"
+  "function Ship.laserGunHeat(s)\n"
+  "  local p = ships[s] or ship(s)\n"
+  "  if p then return p.laserGunHeat end\n"
+  "  return laserGunHeat(s)\n"
+  "end\n"
+  "function Ship.torpedoGunHeat(s)\n"
+  "  local p = ships[s] or ship(s)\n"
+  "  if p then return p.torpedoGunHeat end\n"
+  "  return torpedoGunHeat(s)\n"
+  "end\n"
+  "function Ship.hitWall(s)\n"
+  "  local p = ships[s] or ship(s)\n"
+  "  if p then return p.hitWall end\n"
+  "  return hitWall(s)\n"
+  "end\n"
+  "function Ship.hitShip(s)\n"
+  "  local p = ships[s] or ship(s)\n"
+  "  if p then return p.hitShip end\n"
+  "  return hitShip(s)\n"
+  "end\n"
+  "function Ship.alive(s)\n"
+  "  local p = ships[s] or ship(s)\n"
+  "  if p then return p.alive end\n"
+  "  return alive(s)\n"
+  "end\n"
+  "local width, height, time, numShips, teamSize = World.width,\n"
+  "    World.height, World.time, World.numShips, World.teamSize\n"
+  "function World.width(w)\n"
+  "  local p = worlds[w] or world(w)\n"
+  "  if p then return p.width end\n"
+  "  return width(w)\n"
+  "end\n"
+  "function World.height(w)\n"
+  "  local p = worlds[w] or world(w)\n"
+  "  if p then return p.height end\n"
+  "  return height(w)\n"
+  "end\n"
+  "function World.time(w)\n"
+  "  local p = worlds[w] or world(w)\n"
+  "  if p then return p.time end\n"
+  "  return time(w)\n"
+  "end\n"
+  "function World.numShips(w)\n"
+  "  local p = worlds[w] or world(w)\n"
+  "  if p then return p.numShips end\n"
+  "  return numShips(w)\n"
+  "end\n"
+  "function World.teamSize(w)\n"
+  "  local p = worlds[w] or world(w)\n"
+  "  if p then return p.teamSize end\n"
+  "  return teamSize(w)\n"
+  "end\n";
+
+bool compareFfiFields(const FfiField &field1, const FfiField &field2) {
+  return field1.offset < field2.offset;
+}
+
+void appendFfiStruct(std::string &cdefs, const char *name, FfiField *fields,
+                     int numFields, size_t structSize) {
+  std::sort(fields, fields + numFields, compareFfiFields);
+  char line[128];
+  size_t offset = 0;
+  cdefs.append("typedef struct {\n");
+  for (int x = 0; x < numFields; x++) {
+    if (fields[x].offset > offset) {
+      sprintf(line, "  uint8_t pad%d[%d];\n", x,
+              (int) (fields[x].offset - offset));
+      cdefs.append(line);
+    }
+    sprintf(line, "  %s %s;\n", fields[x].type, fields[x].name);
+    cdefs.append(line);
+    offset = fields[x].offset + fields[x].size;
+  }
+  if (structSize > offset) {
+    sprintf(line, "  uint8_t pad%d[%d];\n", numFields,
+            (int) (structSize - offset));
+    cdefs.append(line);
+  }
+  cdefs.append("} ");
+  cdefs.append(name);
+  cdefs.append(";\n");
+}
+
+// Like luaL_checkudata, but returns whether it matches instead of raising an
+// error. The metatable name is the closure's upvalue.
+int FfiApi_isType(lua_State *L) {
+  bool matches = false;
+  if (lua_type(L, 1) == LUA_TUSERDATA && lua_getmetatable(L, 1)) {
+    luaL_getmetatable(L, lua_tostring(L, lua_upvalueindex(1)));
+    matches = lua_rawequal(L, -1, -2);
+    lua_pop(L, 2);
+  }
+  lua_pushboolean(L, matches);
+  return 1;
+}
+
+// Same as Ship_fireLaser and Ship_fireTorpedo, minus the Lua stack. Called
+// from Lua through FFI, so they can't call back into Lua.
+int FfiApi_fireLaser(Ship *ship, double heading) {
+  if (ship->alive && ship->laserEnabled
+      && ship->properties->engine->fireLaser(ship, heading)) {
+    ship->laserGunHeat = LASER_HEAT;
+    return 1;
+  }
+  return 0;
+}
+
+int FfiApi_fireTorpedo(Ship *ship, double heading, double distance) {
+  if (ship->alive && ship->torpedoEnabled
+      && ship->properties->engine->fireTorpedo(
+          ship, heading, std::max(0.0, distance))) {
+    ship->torpedoGunHeat = TORPEDO_HEAT;
+    return 1;
+  }
+  return 0;
+}
+
+// luaL_openlibs leaves out the jit library, which is also what turns on the
+// trace compiler. Open it for that, then hide it again.
+void startJitCompiler(lua_State *L) {
+  lua_pushcfunction(L, luaopen_jit);
+  lua_pushstring(L, LUA_JITLIBNAME);
+  lua_call(L, 1, 0);
+  lua_pushnil(L);
+  lua_setglobal(L, LUA_JITLIBNAME);
+  lua_getfield(L, LUA_REGISTRYINDEX, "_LOADED");
+  lua_pushnil(L);
+  lua_setfield(L, -2, LUA_JITLIBNAME);
+  lua_pushnil(L);
+  lua_setfield(L, -2, "jit.util");
+  lua_pushnil(L);
+  lua_setfield(L, -2, "jit.opt");
+  lua_pop(L, 1);
+}
+
+// The program may have reused the globals by now, so get the methods from the
+// metatables.
+void pushMethods(lua_State *L, const char *className) {
+  luaL_getmetatable(L, className);
+  lua_pushliteral(L, "__index");
+  lua_rawget(L, -2);
+  lua_remove(L, -2);
+}
+
+void registerFfiMethods(lua_State *L) {
+  startJitCompiler(L);
+
+  std::string cdefs;
+  appendFfiStruct(cdefs, "BerryBotsShip", shipFfiFields,
+      sizeof(shipFfiFields) / sizeof(FfiField), sizeof(Ship));
+  appendFfiStruct(cdefs, "BerryBotsWorld", worldFfiFields,
+      sizeof(worldFfiFields) / sizeof(FfiField), sizeof(World));
+
+  if (luaL_loadbuffer(L, ffiApiSource, strlen(ffiApiSource), "=ffiapi")) {
+    lua_pop(L, 1);
+    return;
+  }
+  lua_pushstring(L, cdefs.c_str());
+  lua_pushstring(L, SHIP);
+  lua_pushcclosure(L, FfiApi_isType, 1);
+  lua_pushstring(L, WORLD);
+  lua_pushcclosure(L, FfiApi_isType, 1);
+  lua_pushlightuserdata(L, (void *) FfiApi_fireLaser);
+  lua_pushlightuserdata(L, (void *) FfiApi_fireTorpedo);
+  lua_pushnumber(L, MAX_THRUSTER_FORCE);
+  pushMethods(L, SHIP);
+  pushMethods(L, WORLD);
+  if (lua_pcall(L, 8, 0, 0)) {
+    lua_pop(L, 1);
+  }
+}
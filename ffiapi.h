@@ -0,0 +1,41 @@
+/*
+  Copyright (C) 2015 - Voidious
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+*/
+
+
+#ifndef FFI_API_H
+#define FFI_API_H
+
+extern "C" {
+  #include "lua.h"
+}
+
+// Swaps the hot Ship and World methods in a ship's Lua state for versions
+// that read and write the engine's structs through LuaJIT's FFI, and turns on
+// the trace compiler, so loops that call them can be compiled instead of
+// stopping at a C function. The methods keep their names, arguments and
+// results, and fall back to the regular C functions for anything they don't
+// recognize, so bad arguments raise the same errors. If LuaJIT was built
+// without FFI, this only turns on the trace compiler.
+//
+// Only for ship states: the stage's copies of the ships are synced lazily by
+// the regular methods.
+extern void registerFfiMethods(lua_State *L);
+
+#endif
@@ -602,7 +602,7 @@ void FileManager::packageStage(const char *stagesBaseDir, const char *stageName,
   checkLuaFilename(stageName);
   char *stageAbsBaseDir = getAbsFilePath(stagesBaseDir);
   lua_State *stageState;
-  initStageState(&stageState, stageAbsBaseDir);
+  initStageState(&stageState, stageAbsBaseDir, rand());
   
   BerryBotsEngine engine(0, this, 0);
   Stage *stage = engine.getStage();
@@ -732,7 +732,7 @@ void FileManager::packageShip(const char *shipBaseDir, const char *shipName,
   checkLuaFilename(shipName);
   char *shipAbsBaseDir = getAbsFilePath(shipBaseDir);
   lua_State *shipState;
-  initShipState(&shipState, shipAbsBaseDir);
+  initShipState(&shipState, shipAbsBaseDir, rand());
   BerryBotsEngine engine(0, this, 0);
   crawlFiles(shipState, shipName, &engine);
 
@@ -0,0 +1,577 @@
+/*
+  Copyright (C) 2015 - Voidious
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+*/
+
+
+#include <string.h>
+#include <stdlib.h>
+#include <string>
+#include <algorithm>
+#include "zipper.h"
+#include "filemanager.h"
+#include "programcache.h"
+#include "bbrunner.h"
+#include "forkserver.h"
+
+#ifdef __WIN32__
+
+ForkServer::ForkServer(Zipper *zipper) {
+  zipper_ = zipper;
+  socket_ = -1;
+  serverPid_ = 0;
+  pthread_mutex_init(&requestMutex_, 0);
+}
+
+ForkServer::~ForkServer() {
+  pthread_mutex_destroy(&requestMutex_);
+}
+
+bool ForkServer::start() {
+  return false;
+}
+
+void ForkServer::runMatch(MatchConfig *config, unsigned int randomSeed,
+    volatile bool *quit) {
+  config->setErrorMessage("Can't run matches in their own processes.");
+}
+
+#else
+
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+extern "C" {
+  #include "lua.h"
+  #include "lauxlib.h"
+}
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+static void appendInt(std::string *s, int value) {
+  s->append((const char *) &value, sizeof(int));
+}
+
+static void appendDouble(std::string *s, double value) {
+  s->append((const char *) &value, sizeof(double));
+}
+
+static void appendString(std::string *s, const char *value) {
+  if (value == 0) {
+    appendInt(s, -1);
+  } else {
+    appendInt(s, strlen(value));
+    s->append(value);
+  }
+}
+
+static bool readInt(std::string *s, size_t *offset, int *value) {
+  if (*offset + sizeof(int) > s->length()) {
+    return false;
+  }
+  memcpy(value, s->data() + *offset, sizeof(int));
+  *offset += sizeof(int);
+  return true;
+}
+
+static bool readDouble(std::string *s, size_t *offset, double *value) {
+  if (*offset + sizeof(double) > s->length()) {
+    return false;
+  }
+  memcpy(value, s->data() + *offset, sizeof(double));
+  *offset += sizeof(double);
+  return true;
+}
+
+// Reads a string written by appendString. The caller owns the new string,
+// which is 0 if a null string was written.
+static bool readString(std::string *s, size_t *offset, char **value) {
+  int length;
+  if (!readInt(s, offset, &length) || length < -1
+      || *offset + std::max(0, length) > s->length()) {
+    return false;
+  }
+  if (length == -1) {
+    *value = 0;
+  } else {
+    *value = new char[length + 1];
+    memcpy(*value, s->data() + *offset, length);
+    (*value)[length] = '\0';
+    *offset += length;
+  }
+  return true;
+}
+
+static bool readFully(int fd, char *buffer, size_t length) {
+  while (length > 0) {
+    ssize_t bytesRead = read(fd, buffer, length);
+    if (bytesRead == 0 || (bytesRead < 0 && errno != EINTR)) {
+      return false;
+    } else if (bytesRead > 0) {
+      buffer += bytesRead;
+      length -= bytesRead;
+    }
+  }
+  return true;
+}
+
+static bool writeFully(int fd, const char *data, size_t length) {
+  while (length > 0) {
+    ssize_t bytesWritten = write(fd, data, length);
+    if (bytesWritten < 0 && errno != EINTR) {
+      return false;
+    } else if (bytesWritten > 0) {
+      data += bytesWritten;
+      length -= bytesWritten;
+    }
+  }
+  return true;
+}
+
+ForkServer::ForkServer(Zipper *zipper) {
+  zipper_ = zipper;
+  socket_ = -1;
+  serverPid_ = 0;
+  pthread_mutex_init(&requestMutex_, 0);
+}
+
+// Closing our end of the socket tells the fork server to exit. Match processes
+// that are still running finish on their own.
+ForkServer::~ForkServer() {
+  if (socket_ != -1) {
+    close(socket_);
+    waitpid(serverPid_, 0, 0);
+  }
+  pthread_mutex_destroy(&requestMutex_);
+}
+
+bool ForkServer::start() {
+  int sockets[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) != 0) {
+    return false;
+  }
+#ifdef SO_NOSIGPIPE
+  int noSigPipe = 1;
+  setsockopt(sockets[0], SOL_SOCKET, SO_NOSIGPIPE, &noSigPipe, sizeof(int));
+#endif
+
+  pid_t pid = fork();
+  if (pid == -1) {
+    close(sockets[0]);
+    close(sockets[1]);
+    return false;
+  } else if (pid == 0) {
+    close(sockets[0]);
+    serve(sockets[1]);
+    _exit(0);
+  }
+  close(sockets[1]);
+  socket_ = sockets[0];
+  serverPid_ = pid;
+  return true;
+}
+
+// Sends the match to the fork server and waits for the match process to
+// finish, filling in the results on config. If quit is set while the match is
+// running, the match process is killed and config is left without results.
+void ForkServer::runMatch(MatchConfig *config, unsigned int randomSeed,
+    volatile bool *quit) {
+  std::string request;
+  appendString(&request, config->getStagesDir());
+  appendString(&request, config->getShipsDir());
+  appendString(&request, config->getCacheDir());
+  appendString(&request, config->getStageName());
+  appendInt(&request, config->getNumTeams());
+  char **teamNames = config->getTeamNames();
+  for (int x = 0; x < config->getNumTeams(); x++) {
+    appendString(&request, teamNames[x]);
+  }
+  appendInt(&request, randomSeed);
+
+  int resultFds[2];
+  if (pipe(resultFds) != 0) {
+    config->setErrorMessage("Failed to start match process.");
+    return;
+  }
+  bool sent = sendRequest(&request, resultFds[1]);
+  close(resultFds[1]);
+  if (!sent) {
+    close(resultFds[0]);
+    config->setErrorMessage("Failed to start match process.");
+    return;
+  }
+
+  std::string results;
+  char buffer[4096];
+  bool killed = false;
+  while (true) {
+    struct pollfd resultPoll;
+    resultPoll.fd = resultFds[0];
+    resultPoll.events = POLLIN;
+    resultPoll.revents = 0;
+    if (poll(&resultPoll, 1, FORK_SERVER_POLL_INTERVAL) > 0) {
+      ssize_t bytesRead = read(resultFds[0], buffer, sizeof(buffer));
+      if (bytesRead == 0 || (bytesRead < 0 && errno != EINTR)) {
+        break;
+      } else if (bytesRead > 0) {
+        results.append(buffer, bytesRead);
+      }
+    }
+
+    // The match process writes its pid before anything else.
+    if (*quit && !killed && results.length() >= sizeof(int)) {
+      int matchPid;
+      memcpy(&matchPid, results.data(), sizeof(int));
+      kill(matchPid, SIGKILL);
+      killed = true;
+    }
+  }
+  close(resultFds[0]);
+
+  if (!killed && !readResults(config, &results)) {
+    config->setErrorMessage("Match process exited before the match finished.");
+  }
+}
+
+// Requests are sent as their length and then the request, with resultFd
+// attached to the first message. The fork server stops serving if it gets a
+// request longer than MAX_FORK_REQUEST_LENGTH, so we never send one.
+bool ForkServer::sendRequest(std::string *request, int resultFd) {
+  if (request->length() > MAX_FORK_REQUEST_LENGTH) {
+    return false;
+  }
+  std::string message;
+  appendInt(&message, request->length());
+  message.append(*request);
+
+  struct iovec iov;
+  iov.iov_base = (void *) message.data();
+  iov.iov_len = message.length();
+  char control[CMSG_SPACE(sizeof(int))];
+  memset(control, 0, sizeof(control));
+  struct msghdr header;
+  memset(&header, 0, sizeof(header));
+  header.msg_iov = &iov;
+  header.msg_iovlen = 1;
+  header.msg_control = control;
+  header.msg_controllen = sizeof(control);
+  struct cmsghdr *controlHeader = CMSG_FIRSTHDR(&header);
+  controlHeader->cmsg_level = SOL_SOCKET;
+  controlHeader->cmsg_type = SCM_RIGHTS;
+  controlHeader->cmsg_len = CMSG_LEN(sizeof(int));
+  memcpy(CMSG_DATA(controlHeader), &resultFd, sizeof(int));
+
+  pthread_mutex_lock(&requestMutex_);
+  ssize_t bytesSent;
+  do {
+    bytesSent = sendmsg(socket_, &header, MSG_NOSIGNAL);
+  } while (bytesSent < 0 && errno == EINTR);
+  size_t totalSent = std::max((ssize_t) 0, bytesSent);
+  while (bytesSent >= 0 && totalSent < message.length()) {
+    bytesSent = send(socket_, message.data() + totalSent,
+                     message.length() - totalSent, MSG_NOSIGNAL);
+    if (bytesSent > 0) {
+      totalSent += bytesSent;
+    } else if (bytesSent < 0 && errno == EINTR) {
+      bytesSent = 0;
+    }
+  }
+  pthread_mutex_unlock(&requestMutex_);
+  return (bytesSent >= 0);
+}
+
+bool ForkServer::receiveRequest(int socket, std::string *request,
+                                int *resultFd) {
+  char lengthBuffer[sizeof(int)];
+  struct iovec iov;
+  iov.iov_base = lengthBuffer;
+  iov.iov_len = sizeof(int);
+  char control[CMSG_SPACE(sizeof(int))];
+  struct msghdr header;
+  memset(&header, 0, sizeof(header));
+  header.msg_iov = &iov;
+  header.msg_iovlen = 1;
+  header.msg_control = control;
+  header.msg_controllen = sizeof(control);
+  ssize_t bytesRead;
+  do {
+    bytesRead = recvmsg(socket, &header, 0);
+  } while (bytesRead < 0 && errno == EINTR);
+  if (bytesRead <= 0) {
+    return false;
+  }
+
+  struct cmsghdr *controlHeader = CMSG_FIRSTHDR(&header);
+  if (controlHeader == 0 || controlHeader->cmsg_type != SCM_RIGHTS) {
+    return false;
+  }
+  memcpy(resultFd, CMSG_DATA(controlHeader), sizeof(int));
+  if (!readFully(socket, lengthBuffer + bytesRead, sizeof(int) - bytesRead)) {
+    close(*resultFd);
+    return false;
+  }
+  int length;
+  memcpy(&length, lengthBuffer, sizeof(int));
+  if (length < 0 || length > MAX_FORK_REQUEST_LENGTH) {
+    // We can't find the start of the next request, so stop serving.
+    close(*resultFd);
+    return false;
+  }
+  char *requestBuffer = new char[std::max(1, length)];
+  bool received = readFully(socket, requestBuffer, length);
+  request->assign(requestBuffer, length);
+  delete[] requestBuffer;
+  if (!received) {
+    close(*resultFd);
+  }
+  return received;
+}
+
+// The fork server's main loop. Runs until the runner closes its end of the
+// socket.
+void ForkServer::serve(int socket) {
+  signal(SIGCHLD, SIG_IGN);
+  FileManager *fileManager = new FileManager(zipper_);
+  ProgramCache *programCache = new ProgramCache();
+  std::string request;
+  int resultFd;
+  while (receiveRequest(socket, &request, &resultFd)) {
+    size_t offset = 0;
+    char *stagesDir = 0, *shipsDir = 0, *cacheDir = 0, *stageName = 0;
+    char **teamNames = 0;
+    int numTeams, numTeamNames = 0, randomSeed;
+    // Each team name takes at least an int, which bounds numTeams before we
+    // allocate anything for it.
+    bool read = readString(&request, &offset, &stagesDir) && stagesDir != 0
+        && readString(&request, &offset, &shipsDir) && shipsDir != 0
+        && readString(&request, &offset, &cacheDir) && cacheDir != 0
+        && readString(&request, &offset, &stageName) && stageName != 0
+        && readInt(&request, &offset, &numTeams) && numTeams >= 1
+        && (size_t) numTeams <= (request.length() - offset) / sizeof(int);
+    if (read) {
+      teamNames = new char*[numTeams];
+      while (read && numTeamNames < numTeams) {
+        char *teamName = 0;
+        read = readString(&request, &offset, &teamName) && teamName != 0;
+        if (read) {
+          teamNames[numTeamNames++] = teamName;
+        }
+      }
+      read = read && readInt(&request, &offset, &randomSeed);
+    }
+
+    MatchConfig *config = 0;
+    if (read) {
+      config = new MatchConfig(stageName, teamNames, numTeams, stagesDir,
+                               shipsDir, cacheDir, 0, true);
+    }
+    delete stagesDir;
+    delete shipsDir;
+    delete cacheDir;
+    delete stageName;
+    for (int x = 0; x < numTeamNames; x++) {
+      delete teamNames[x];
+    }
+    delete[] teamNames;
+    if (!read) {
+      close(resultFd);
+      continue;
+    }
+
+    preloadPrograms(fileManager, programCache, config);
+    if (fork() == 0) {
+      close(socket);
+      signal(SIGCHLD, SIG_DFL);
+      runMatchProcess(config, randomSeed, programCache, resultFd);
+      _exit(0);
+    }
+    close(resultFd);
+    delete config;
+  }
+}
+
+// Compiles the stage and ships into the fork server's ProgramCache, so every
+// match process gets them already compiled. Any errors are left for the match
+// process to report. Stage ships aren't known until the stage is loaded, so
+// they're compiled by each match process.
+void ForkServer::preloadPrograms(FileManager *fileManager,
+    ProgramCache *programCache, MatchConfig *config) {
+  preloadProgram(fileManager, programCache, config->getStagesDir(),
+                 config->getStageName(), config->getCacheDir(), true);
+  char **teamNames = config->getTeamNames();
+  for (int x = 0; x < config->getNumTeams(); x++) {
+    preloadProgram(fileManager, programCache, config->getShipsDir(),
+                   teamNames[x], config->getCacheDir(), false);
+  }
+}
+
+void ForkServer::preloadProgram(FileManager *fileManager,
+    ProgramCache *programCache, const char *baseDir, const char *name,
+    const char *cacheDir, bool stage) {
+  char *dir = 0;
+  char *filename = 0;
+  try {
+    if (stage) {
+      fileManager->loadStageFileData(baseDir, name, &dir, &filename, cacheDir);
+    } else {
+      fileManager->loadShipFileData(baseDir, name, &dir, &filename, cacheDir);
+    }
+  } catch (FileNotFoundException *fnfe) {
+    delete fnfe;
+  } catch (ZipperException *ze) {
+    delete ze;
+  } catch (PackagedSymlinkException *pse) {
+    delete pse;
+  }
+
+  if (dir != 0 && filename != 0) {
+    char *filePath = fileManager->getFilePath(dir, filename);
+    lua_State *L = luaL_newstate();
+    lua_setcwd(L, dir);
+    programCache->loadFile(L, filePath, filename);
+    lua_close(L);
+    delete filePath;
+  }
+  if (dir != 0) {
+    delete dir;
+  }
+  if (filename != 0) {
+    delete filename;
+  }
+}
+
+void ForkServer::runMatchProcess(MatchConfig *config,
+    unsigned int randomSeed, ProgramCache *programCache, int resultFd) {
+  std::string results;
+  appendInt(&results, getpid());
+  writeFully(resultFd, results.data(), results.length());
+  results.clear();
+
+  bool quit = false;
+  BerryBotsRunner::playMatch(
+      config, randomSeed, zipper_, programCache, &quit);
+
+  appendString(&results, config->getErrorMessage());
+  appendString(&results, config->getWinnerFilename());
+  appendInt(&results, config->hasScores() ? 1 : 0);
+  TeamResult **teamResults = config->getTeamResults();
+  if (teamResults == 0) {
+    appendInt(&results, 0);
+  } else {
+    appendInt(&results, config->getNumTeams());
+    for (int x = 0; x < config->getNumTeams(); x++) {
+      TeamResult *result = teamResults[x];
+      appendInt(&results, result->rank);
+      appendDouble(&results, result->score);
+      appendInt(&results, result->showResult ? 1 : 0);
+      appendInt(&results, result->numStats);
+      for (int y = 0; y < result->numStats; y++) {
+        appendString(&results, result->stats[y]->key);
+        appendDouble(&results, result->stats[y]->value);
+      }
+    }
+  }
+  writeFully(resultFd, results.data(), results.length());
+  close(resultFd);
+}
+
+// Reads the results written by runMatchProcess into config. Returns false if
+// the match process didn't write all of them.
+bool ForkServer::readResults(MatchConfig *config, std::string *results) {
+  size_t offset = sizeof(int); // pid
+  char *errorMessage, *winnerFilename;
+  int hasScores, numResults;
+  if (!readString(results, &offset, &errorMessage)) {
+    return false;
+  }
+  if (!readString(results, &offset, &winnerFilename)) {
+    if (errorMessage != 0) {
+      delete errorMessage;
+    }
+    return false;
+  }
+  bool read = readInt(results, &offset, &hasScores)
+      && readInt(results, &offset, &numResults)
+      && (numResults == 0 || numResults == config->getNumTeams());
+  TeamResult **teamResults = 0;
+  if (read && numResults > 0) {
+    teamResults = new TeamResult*[numResults];
+    for (int x = 0; x < numResults; x++) {
+      TeamResult *result = teamResults[x] = new TeamResult;
+      result->numStats = 0;
+      int showResult, numStats;
+      read = read && readInt(results, &offset, &(result->rank))
+          && readDouble(results, &offset, &(result->score))
+          && readInt(results, &offset, &showResult)
+          && readInt(results, &offset, &numStats)
+          && numStats >= 0 && numStats <= MAX_SCORE_STATS;
+      result->showResult = (showResult != 0);
+      for (int y = 0; read && y < numStats; y++) {
+        ScoreStat *stat = new ScoreStat;
+        stat->key = 0;
+        read = readString(results, &offset, &(stat->key))
+            && stat->key != 0 && readDouble(results, &offset, &(stat->value));
+        if (read) {
+          result->stats[result->numStats++] = stat;
+        } else {
+          if (stat->key != 0) {
+            delete stat->key;
+          }
+          delete stat;
+        }
+      }
+    }
+  }
+
+  if (read) {
+    if (errorMessage != 0) {
+      config->setErrorMessage(errorMessage);
+    }
+    if (winnerFilename != 0) {
+      config->setWinnerFilename(winnerFilename);
+    }
+    config->setHasScores(hasScores != 0);
+    if (teamResults != 0) {
+      config->setTeamResults(teamResults);
+    }
+  } else if (teamResults != 0) {
+    for (int x = 0; x < numResults; x++) {
+      for (int y = 0; y < teamResults[x]->numStats; y++) {
+        delete teamResults[x]->stats[y]->key;
+        delete teamResults[x]->stats[y];
+      }
+      delete teamResults[x];
+    }
+    delete[] teamResults;
+  }
+  if (errorMessage != 0) {
+    delete errorMessage;
+  }
+  if (winnerFilename != 0) {
+    delete winnerFilename;
+  }
+  return read;
+}
+
+#endif
@@ -0,0 +1,74 @@
+/*
+  Copyright (C) 2015 - Voidious
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+*/
+
+
+#ifndef FORK_SERVER_H
+#define FORK_SERVER_H
+
+#include <string>
+#include <pthread.h>
+#include <sys/types.h>
+#include "zipper.h"
+#include "filemanager.h"
+#include "programcache.h"
+
+#define FORK_SERVER_POLL_INTERVAL  50 // ms between checks for quitting
+#define MAX_FORK_REQUEST_LENGTH    1048576 // bytes
+
+class MatchConfig;
+
+// Runs headless matches in their own processes. The fork server is a process
+// forked from the runner when it starts. For each match, it compiles the stage
+// and ships into its ProgramCache, then forks a process for the match from
+// itself, so the match starts with its programs already compiled and shares
+// the server's memory copy-on-write. A match that crashes only takes down its
+// own process. The fork server is single threaded, so it's always safe for it
+// to fork.
+//
+// A match thread sends the match to the fork server along with the write end
+// of a pipe, and the match process writes its results to that pipe. Not
+// supported on Windows, where start() always fails.
+class ForkServer {
+  Zipper *zipper_;
+  int socket_;
+  pid_t serverPid_;
+  pthread_mutex_t requestMutex_;
+
+  public:
+    ForkServer(Zipper *zipper);
+    ~ForkServer();
+    bool start();
+    void runMatch(MatchConfig *config, unsigned int randomSeed,
+                  volatile bool *quit);
+  private:
+    void serve(int socket);
+    bool sendRequest(std::string *request, int resultFd);
+    bool receiveRequest(int socket, std::string *request, int *resultFd);
+    void preloadPrograms(FileManager *fileManager, ProgramCache *programCache,
+                         MatchConfig *config);
+    void preloadProgram(FileManager *fileManager, ProgramCache *programCache,
+                        const char *baseDir, const char *name,
+                        const char *cacheDir, bool stage);
+    void runMatchProcess(MatchConfig *config, unsigned int randomSeed,
+        ProgramCache *programCache, int resultFd);
+    bool readResults(MatchConfig *config, std::string *results);
+};
+
+#endif
@@ -0,0 +1,116 @@
+/*
+  Copyright (C) 2015 - Voidious
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+*/
+
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include "bbconst.h"
+#include "freespacemap.h"
+
+FreeSpaceMap::FreeSpaceMap(
+    int width, int height, Wall **walls, int numWalls) {
+  width_ = width;
+  height_ = height;
+  cellSize_ = SHIP_RADIUS;
+  do {
+    numColumns_ = std::max(1, (int) ceil(width_ / cellSize_));
+    numRows_ = std::max(1, (int) ceil(height_ / cellSize_));
+    if ((double) numColumns_ * numRows_ > MAX_FREE_SPACE_CELLS) {
+      cellSize_ *= 2;
+    }
+  } while ((double) numColumns_ * numRows_ > MAX_FREE_SPACE_CELLS);
+  numCells_ = numColumns_ * numRows_;
+  cells_ = new unsigned char[numCells_];
+  memset(cells_, SPACE_FREE, numCells_);
+  for (int x = 0; x < numWalls; x++) {
+    markWall(walls[x]);
+  }
+
+  numFreeCells_ = 0;
+  for (int x = 0; x < numCells_; x++) {
+    if (cells_[x] == SPACE_FREE) {
+      numFreeCells_++;
+    }
+  }
+  freeCells_ = new int[std::max(1, numFreeCells_)];
+  numFreeCells_ = 0;
+  for (int x = 0; x < numCells_; x++) {
+    if (cells_[x] == SPACE_FREE) {
+      freeCells_[numFreeCells_++] = x;
+    }
+  }
+}
+
+// Cells within a ship radius of the wall are no longer free, and cells well
+// inside it are blocked.
+void FreeSpaceMap::markWall(Wall *wall) {
+  double left = wall->getLeft();
+  double bottom = wall->getBottom();
+  double right = left + wall->getWidth();
+  double top = bottom + wall->getHeight();
+  double reach = SHIP_RADIUS + FREE_SPACE_MARGIN;
+  int column1 = std::max(0, (int) floor((left - reach) / cellSize_));
+  int column2 =
+      std::min(numColumns_ - 1, (int) floor((right + reach) / cellSize_));
+  int row1 = std::max(0, (int) floor((bottom - reach) / cellSize_));
+  int row2 = std::min(numRows_ - 1, (int) floor((top + reach) / cellSize_));
+  for (int row = row1; row <= row2; row++) {
+    double cellBottom = row * cellSize_;
+    double cellTop = cellBottom + cellSize_;
+    for (int column = column1; column <= column2; column++) {
+      double cellLeft = column * cellSize_;
+      double cellRight = cellLeft + cellSize_;
+      int cell = (row * numColumns_) + column;
+      if (cellLeft - FREE_SPACE_MARGIN > left
+          && cellRight + FREE_SPACE_MARGIN < right
+          && cellBottom - FREE_SPACE_MARGIN > bottom
+          && cellTop + FREE_SPACE_MARGIN < top) {
+        cells_[cell] = SPACE_BLOCKED;
+      } else if (cells_[cell] == SPACE_FREE) {
+        cells_[cell] = SPACE_PARTIAL;
+      }
+    }
+  }
+}
+
+int FreeSpaceMap::getSpace(double x, double y) {
+  if (x < 0 || x > width_ || y < 0 || y > height_) {
+    return SPACE_PARTIAL;
+  }
+  int column = std::min((int) (x / cellSize_), numColumns_ - 1);
+  int row = std::min((int) (y / cellSize_), numRows_ - 1);
+  return cells_[(row * numColumns_) + column];
+}
+
+int FreeSpaceMap::getFreeCellCount() {
+  return numFreeCells_;
+}
+
+void FreeSpaceMap::getFreeCellCenter(
+    int freeCellIndex, double *x, double *y) {
+  int cell = freeCells_[freeCellIndex];
+  *x = ((cell % numColumns_) + 0.5) * cellSize_;
+  *y = ((cell / numColumns_) + 0.5) * cellSize_;
+}
+
+FreeSpaceMap::~FreeSpaceMap() {
+  delete cells_;
+  delete freeCells_;
+}
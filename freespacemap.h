@@ -0,0 +1,56 @@
+/*
+  Copyright (C) 2015 - Voidious
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+*/
+
+#ifndef FREE_SPACE_MAP_H
+#define FREE_SPACE_MAP_H
+
+#include "wall.h"
+
+#define MAX_FREE_SPACE_CELLS  4194304
+#define FREE_SPACE_MARGIN     1.0
+
+#define SPACE_FREE            0
+#define SPACE_BLOCKED         1
+#define SPACE_PARTIAL         2
+
+// Where on a stage a ship could be placed, at about ship radius resolution.
+// Each cell is free (a ship centered anywhere in it misses every wall),
+// blocked (a ship centered anywhere in it is inside a wall), or partial. Only
+// ship positions in partial cells, or off the stage, need testing against
+// the walls themselves. Also keeps a list of the free cells, so we can pick
+// a spot for a ship without trying random positions until one works.
+class FreeSpaceMap {
+  double width_, height_, cellSize_;
+  int numColumns_, numRows_, numCells_;
+  unsigned char *cells_;
+  int *freeCells_;
+  int numFreeCells_;
+
+  public:
+    FreeSpaceMap(int width, int height, Wall **walls, int numWalls);
+    ~FreeSpaceMap();
+    int getSpace(double x, double y);
+    int getFreeCellCount();
+    void getFreeCellCenter(int freeCellIndex, double *x, double *y);
+  private:
+    void markWall(Wall *wall);
+};
+
+#endif
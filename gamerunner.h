@@ -53,8 +53,9 @@ class GameRunner {
     virtual int getIntegerValue(const char *name) = 0;
     virtual bool getBooleanValue(const char *name) = 0;
     virtual void setThreadCount(int threadCount) = 0;
+    virtual void setForkMatches(bool forkMatches) = 0;
     virtual void queueMatch(const char *stageName, char **teamNames,
-                            int numTeams) = 0;
+                            int numTeams, bool headless) = 0;
     virtual bool started() = 0;
     virtual bool empty() = 0;
     virtual MatchResult* nextResult() = 0;
@@ -47,6 +47,7 @@ GuiGameRunner::GuiGameRunner(PrintHandler *printHandler, char **stageNames,
   numTeams_ = numTeams;
   zipper_ = zipper;
   threadCount_ = 1;
+  forkMatches_ = false;
   started_ = false;
   quitting_ = false;
   runnerState_ = 0;
@@ -265,14 +266,21 @@ void GuiGameRunner::setThreadCount(int threadCount) {
   }
 }
 
+void GuiGameRunner::setForkMatches(bool forkMatches) {
+  if (!started_) {
+    forkMatches_ = forkMatches;
+  }
+}
+
 void GuiGameRunner::queueMatch(const char *stageName, char **teamNames,
-                               int numTeams) {
+                               int numTeams, bool headless) {
   if (!started_) {
-    bbRunner_ = new BerryBotsRunner(threadCount_, zipper_, replayTemplateDir_);
+    bbRunner_ = new BerryBotsRunner(
+        threadCount_, zipper_, replayTemplateDir_, forkMatches_);
     bbRunner_->setListener(new GuiRefresherListener());
     started_ = true;
   }
-  bbRunner_->queueMatch(stageName, teamNames, numTeams);
+  bbRunner_->queueMatch(stageName, teamNames, numTeams, headless);
 }
 
 bool GuiGameRunner::started() {
@@ -40,6 +40,7 @@ class GuiGameRunner : public GameRunner {
   int numTeams_;
   PrintHandler *printHandler_;
   int threadCount_;
+  bool forkMatches_;
   bool started_;
   bool quitting_;
   lua_State *runnerState_;
@@ -70,8 +71,9 @@ class GuiGameRunner : public GameRunner {
     virtual int getIntegerValue(const char *name);
     virtual bool getBooleanValue(const char *name);
     virtual void setThreadCount(int threadCount);
+    virtual void setForkMatches(bool forkMatches);
     virtual void queueMatch(const char *stageName, char **teamNames,
-                            int numTeams);
+                            int numTeams, bool headless);
     virtual bool started();
     virtual bool empty();
     virtual MatchResult* nextResult();
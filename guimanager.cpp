@@ -18,6 +18,7 @@
   3. This notice may not be removed or altered from any source distribution.
 */
 
+#include <math.h>
 #include <algorithm>
 #include <exception>
 #include <sstream>
@@ -230,7 +231,7 @@ bool GuiManager::isValidStageFile(const char *srcFilename,
       return false;
     }
     lua_State *stageState;
-    initStageState(&stageState, stagesDir);
+    initStageState(&stageState, stagesDir, rand());
 
     if (luaL_loadfile(stageState, stageFilename)
         || engine->callUserLuaCode(stageState, 0, "", PCALL_VALIDATE)) {
@@ -321,7 +322,7 @@ bool GuiManager::isValidShipFile(const char *srcFilename,
       return false;
     }
     lua_State *shipState;
-    initShipState(&shipState, shipDir);
+    initShipState(&shipState, shipDir, rand());
 
     if (luaL_loadfile(shipState, shipFilename)
         || engine->callUserLuaCode(shipState, 0, "", PCALL_VALIDATE)) {
@@ -634,9 +635,11 @@ void GuiManager::runCurrentMatch() {
   sf::RenderWindow *window = window_;
   try {
     while (window->isOpen() && !interrupted_ && !restarting_ && !quitting_) {
-      while (!paused_ && !restarting_ && !engine_->isGameOver()
-          && engine_->getGameTime() < nextDrawTime_) {
-        engine_->processTick();
+      if (!paused_ && !restarting_ && !engine_->isGameOver()) {
+        int numTicks = ceil(nextDrawTime_ - engine_->getGameTime());
+        if (numTicks > 0) {
+          engine_->runTicks(numTicks, STOP_ON_GAME_OVER);
+        }
       }
       
       while (!interrupted_ && !restarting_ && !quitting_
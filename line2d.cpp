@@ -24,6 +24,16 @@
 #include "bbutil.h"
 #include "line2d.h"
 
+Line2D::Line2D() {
+  m_ = DBL_MAX;
+  b_ = DBL_MIN;
+  xMin_ = xMax_ = yMin_ = yMax_ = 0;
+  x1_ = y1_ = x2_ = y2_ = 0;
+  inverseM_ = inverseB_ = 0;
+  theta_ = DBL_MIN;
+  hasInverse_ = false;
+}
+
 Line2D::Line2D(double x1, double y1, double x2, double y2) {
   if (x1 == x2) {
     m_ = DBL_MAX;
@@ -43,7 +53,23 @@ Line2D::Line2D(double x1, double y1, double x2, double y2) {
   x2_ = x2;
   y2_ = y2;
   theta_ = DBL_MIN;
-  inverse_ = 0;
+  hasInverse_ = false;
+}
+
+Line2D::Line2D(
+    double x1, double y1, double x2, double y2, double m, double b) {
+  m_ = m;
+  b_ = b;
+  xMin_ = std::min(x1, x2);
+  xMax_ = std::max(x1, x2);
+  yMin_ = std::min(y1, y2);
+  yMax_ = std::max(y1, y2);
+  x1_ = x1;
+  y1_ = y1;
+  x2_ = x2;
+  y2_ = y2;
+  theta_ = DBL_MIN;
+  hasInverse_ = false;
 }
 
 double Line2D::m() {
@@ -102,16 +128,18 @@ void Line2D::shift(double dx, double dy) {
   y2_ += dy;
   yMin_ += dy;
   yMax_ += dy;
-  if (inverse_ != 0) {
-    inverse_->shift(dy, dx);
-  }
 }
 
-Line2D* Line2D::getInverse() {
-  if (inverse_ == 0) {
-    inverse_ = new Line2D(this->y1(), this->x1(), this->y2(), this->x2());
+// Returns this line with x and y swapped. The slope and intercept are
+// calculated on first use and kept as the line shifts, like the endpoints.
+Line2D Line2D::getInverse() {
+  if (!hasInverse_) {
+    Line2D inverse(y1_, x1_, y2_, x2_);
+    inverseM_ = inverse.m_;
+    inverseB_ = inverse.b_;
+    hasInverse_ = true;
   }
-  return inverse_;
+  return Line2D(y1_, x1_, y2_, x2_, inverseM_, inverseB_);
 }
 
 bool Line2D::intersects(Line2D *line) {
@@ -123,16 +151,12 @@ bool Line2D::intersects(Line2D *line) {
       return (xMin_ >= line->xMin() && xMax_ <= line->xMax()
               && yMin_ <= line->yMin() && yMax_ >= line->yMax());
     } else {
-      return getInverse()->intersects(line->getInverse());
+      Line2D inverse = getInverse();
+      Line2D lineInverse = line->getInverse();
+      return inverse.intersects(&lineInverse);
     }
   }
   
   double x = (line->b() - b_) / (m_ - linem);
   return (x >= xMin_ && x <= xMax_ && x >= line->xMin() && x <= line->xMax());
 }
-
-Line2D::~Line2D() {
-  if (inverse_ != 0) {
-    delete inverse_;
-  }
-}
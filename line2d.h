@@ -25,10 +25,11 @@
 
 class Line2D {
   double m_, b_, xMin_, xMax_, yMin_, yMax_, x1_, y1_, x2_, y2_, theta_;
-  Line2D *inverse_;
+  double inverseM_, inverseB_;
+  bool hasInverse_;
   public:
+    Line2D();
     Line2D(double x1, double y1, double x2, double y2);
-    ~Line2D();
     double m();
     double b();
     double x1();
@@ -41,8 +42,10 @@ class Line2D {
     double yMax();
     double theta();
     void shift(double dx, double dy);
-    Line2D *getInverse();
+    Line2D getInverse();
     bool intersects(Line2D *line);
+  private:
+    Line2D(double x1, double y1, double x2, double y2, double m, double b);
 };
 
 #endif
@@ -0,0 +1,262 @@
+/*
+  Copyright (C) 2015 - Voidious
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+*/
+
+#include <float.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define LINE_BATCH_WIDTH 4
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define LINE_BATCH_WIDTH 2
+#else
+#define LINE_BATCH_WIDTH 1
+#endif
+
+#include "linebatch.h"
+
+LineBatch::LineBatch(int maxLines) {
+  maxLines_ = maxLines;
+  numLines_ = 0;
+  m_ = new double[maxLines];
+  b_ = new double[maxLines];
+  inverseM_ = new double[maxLines];
+  inverseB_ = new double[maxLines];
+  xMin_ = new double[maxLines];
+  xMax_ = new double[maxLines];
+  yMin_ = new double[maxLines];
+  yMax_ = new double[maxLines];
+}
+
+int LineBatch::addLine(Line2D *line) {
+  if (numLines_ >= maxLines_) {
+    return 0;
+  }
+  Line2D inverse = line->getInverse();
+  m_[numLines_] = line->m();
+  b_[numLines_] = line->b();
+  inverseM_[numLines_] = inverse.m();
+  inverseB_[numLines_] = inverse.b();
+  xMin_[numLines_] = line->xMin();
+  xMax_[numLines_] = line->xMax();
+  yMin_[numLines_] = line->yMin();
+  yMax_[numLines_] = line->yMax();
+  numLines_++;
+  return 1;
+}
+
+int LineBatch::getLineCount() {
+  return numLines_;
+}
+
+bool LineBatch::intersectsAny(Line2D *line) {
+  return intersectsAny(line, 0, numLines_);
+}
+
+bool LineBatch::intersectsAny(Line2D *line, int firstLine, int numLines) {
+  LineBatchQuery query;
+  setQuery(line, &query);
+  int x = firstLine;
+  int end = firstLine + numLines;
+#if LINE_BATCH_WIDTH > 1
+  int indexes[LINE_BATCH_WIDTH];
+  for (; x + LINE_BATCH_WIDTH <= end; x += LINE_BATCH_WIDTH) {
+    for (int y = 0; y < LINE_BATCH_WIDTH; y++) {
+      indexes[y] = x + y;
+    }
+    if (intersectsBlock(indexes, &query)) {
+      return true;
+    }
+  }
+#endif
+  for (; x < end; x++) {
+    if (intersects(x, &query)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool LineBatch::intersectsAny(Line2D *line, int *lines, int numLines) {
+  LineBatchQuery query;
+  setQuery(line, &query);
+  int x = 0;
+#if LINE_BATCH_WIDTH > 1
+  for (; x + LINE_BATCH_WIDTH <= numLines; x += LINE_BATCH_WIDTH) {
+    if (intersectsBlock(&(lines[x]), &query)) {
+      return true;
+    }
+  }
+#endif
+  for (; x < numLines; x++) {
+    if (intersects(lines[x], &query)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void LineBatch::setQuery(Line2D *line, LineBatchQuery *query) {
+  Line2D inverse = line->getInverse();
+  query->m = line->m();
+  query->b = line->b();
+  query->inverseM = inverse.m();
+  query->inverseB = inverse.b();
+  query->xMin = line->xMin();
+  query->xMax = line->xMax();
+  query->yMin = line->yMin();
+  query->yMax = line->yMax();
+}
+
+// Same steps as lines_[index]->intersects(line) in Line2D.
+bool LineBatch::intersects(int index, LineBatchQuery *query) {
+  double m = m_[index];
+  if (m == query->m) {
+    return false;
+  } else if (m == DBL_MAX || query->m == DBL_MAX) {
+    if (m == DBL_MAX && query->m == 0) {
+      return (xMin_[index] >= query->xMin && xMax_[index] <= query->xMax
+              && yMin_[index] <= query->yMin && yMax_[index] >= query->yMax);
+    }
+
+    // Swap x and y and try again.
+    double inverseM = inverseM_[index];
+    if (inverseM == query->inverseM) {
+      return false;
+    } else if (inverseM == DBL_MAX || query->inverseM == DBL_MAX) {
+      if (inverseM == DBL_MAX && query->inverseM == 0) {
+        return (yMin_[index] >= query->yMin && yMax_[index] <= query->yMax
+                && xMin_[index] <= query->xMin && xMax_[index] >= query->xMax);
+      }
+      // Only possible for a line of zero length, which Line2D never settles.
+      return false;
+    }
+    double y = (query->inverseB - inverseB_[index])
+        / (inverseM - query->inverseM);
+    return (y >= yMin_[index] && y <= yMax_[index] && y >= query->yMin
+            && y <= query->yMax);
+  }
+
+  double x = (query->b - b_[index]) / (m - query->m);
+  return (x >= xMin_[index] && x <= xMax_[index] && x >= query->xMin
+          && x <= query->xMax);
+}
+
+// Tests LINE_BATCH_WIDTH lines at once. Every case of intersects() is worked
+// out for every line, then the right one is picked for each. Divisions that
+// aren't needed may come out as inf or NaN, but they're never picked.
+#if LINE_BATCH_WIDTH == 4
+#define LB_VEC          __m256d
+#define LB_SET1(x)      _mm256_set1_pd(x)
+#define LB_LOAD(a, i)   _mm256_set_pd(a[i[3]], a[i[2]], a[i[1]], a[i[0]])
+#define LB_EQ(a, b)     _mm256_cmp_pd(a, b, _CMP_EQ_OQ)
+#define LB_GE(a, b)     _mm256_cmp_pd(a, b, _CMP_GE_OQ)
+#define LB_LE(a, b)     _mm256_cmp_pd(a, b, _CMP_LE_OQ)
+#define LB_AND(a, b)    _mm256_and_pd(a, b)
+#define LB_ANDNOT(a, b) _mm256_andnot_pd(a, b)
+#define LB_OR(a, b)     _mm256_or_pd(a, b)
+#define LB_SUB(a, b)    _mm256_sub_pd(a, b)
+#define LB_DIV(a, b)    _mm256_div_pd(a, b)
+#define LB_ANY(a)       (_mm256_movemask_pd(a) != 0)
+#elif LINE_BATCH_WIDTH == 2
+#define LB_VEC          __m128d
+#define LB_SET1(x)      _mm_set1_pd(x)
+#define LB_LOAD(a, i)   _mm_set_pd(a[i[1]], a[i[0]])
+#define LB_EQ(a, b)     _mm_cmpeq_pd(a, b)
+#define LB_GE(a, b)     _mm_cmpge_pd(a, b)
+#define LB_LE(a, b)     _mm_cmple_pd(a, b)
+#define LB_AND(a, b)    _mm_and_pd(a, b)
+#define LB_ANDNOT(a, b) _mm_andnot_pd(a, b)
+#define LB_OR(a, b)     _mm_or_pd(a, b)
+#define LB_SUB(a, b)    _mm_sub_pd(a, b)
+#define LB_DIV(a, b)    _mm_div_pd(a, b)
+#define LB_ANY(a)       (_mm_movemask_pd(a) != 0)
+#endif
+
+#if LINE_BATCH_WIDTH > 1
+// Picks a where mask is set, otherwise b.
+#define LB_SELECT(mask, a, b) LB_OR(LB_AND(mask, a), LB_ANDNOT(mask, b))
+
+bool LineBatch::intersectsBlock(int *indexes, LineBatchQuery *query) {
+  LB_VEC maxSlope = LB_SET1(DBL_MAX);
+  LB_VEC zero = LB_SET1(0);
+  LB_VEC xMin = LB_LOAD(xMin_, indexes);
+  LB_VEC xMax = LB_LOAD(xMax_, indexes);
+  LB_VEC yMin = LB_LOAD(yMin_, indexes);
+  LB_VEC yMax = LB_LOAD(yMax_, indexes);
+  LB_VEC queryXMin = LB_SET1(query->xMin);
+  LB_VEC queryXMax = LB_SET1(query->xMax);
+  LB_VEC queryYMin = LB_SET1(query->yMin);
+  LB_VEC queryYMax = LB_SET1(query->yMax);
+
+  LB_VEC m = LB_LOAD(m_, indexes);
+  LB_VEC queryM = LB_SET1(query->m);
+  LB_VEC x = LB_DIV(LB_SUB(LB_SET1(query->b), LB_LOAD(b_, indexes)),
+                    LB_SUB(m, queryM));
+  LB_VEC hit = LB_AND(LB_AND(LB_GE(x, xMin), LB_LE(x, xMax)),
+                      LB_AND(LB_GE(x, queryXMin), LB_LE(x, queryXMax)));
+
+  LB_VEC vertical = LB_EQ(m, maxSlope);
+  LB_VEC eitherVertical = LB_OR(vertical, LB_EQ(queryM, maxSlope));
+  LB_VEC boxHit = LB_AND(
+      LB_AND(LB_GE(xMin, queryXMin), LB_LE(xMax, queryXMax)),
+      LB_AND(LB_LE(yMin, queryYMin), LB_GE(yMax, queryYMax)));
+  LB_VEC boxCase = LB_AND(vertical, LB_EQ(queryM, zero));
+
+  LB_VEC inverseM = LB_LOAD(inverseM_, indexes);
+  LB_VEC queryInverseM = LB_SET1(query->inverseM);
+  LB_VEC y = LB_DIV(
+      LB_SUB(LB_SET1(query->inverseB), LB_LOAD(inverseB_, indexes)),
+      LB_SUB(inverseM, queryInverseM));
+  LB_VEC inverseHit = LB_AND(LB_AND(LB_GE(y, yMin), LB_LE(y, yMax)),
+                             LB_AND(LB_GE(y, queryYMin), LB_LE(y, queryYMax)));
+  LB_VEC inverseVertical = LB_EQ(inverseM, maxSlope);
+  LB_VEC eitherInverseVertical =
+      LB_OR(inverseVertical, LB_EQ(queryInverseM, maxSlope));
+  LB_VEC inverseBoxHit = LB_AND(
+      LB_AND(LB_GE(yMin, queryYMin), LB_LE(yMax, queryYMax)),
+      LB_AND(LB_LE(xMin, queryXMin), LB_GE(xMax, queryXMax)));
+  LB_VEC inverseBoxCase =
+      LB_AND(inverseVertical, LB_EQ(queryInverseM, zero));
+
+  inverseHit = LB_SELECT(eitherInverseVertical,
+      LB_AND(inverseBoxCase, inverseBoxHit), inverseHit);
+  inverseHit = LB_ANDNOT(LB_EQ(inverseM, queryInverseM), inverseHit);
+  hit = LB_SELECT(eitherVertical,
+      LB_SELECT(boxCase, boxHit, inverseHit), hit);
+  hit = LB_ANDNOT(LB_EQ(m, queryM), hit);
+  return LB_ANY(hit);
+}
+#else
+bool LineBatch::intersectsBlock(int *indexes, LineBatchQuery *query) {
+  return intersects(indexes[0], query);
+}
+#endif
+
+LineBatch::~LineBatch() {
+  delete m_;
+  delete b_;
+  delete inverseM_;
+  delete inverseB_;
+  delete xMin_;
+  delete xMax_;
+  delete yMin_;
+  delete yMax_;
+}
@@ -0,0 +1,63 @@
+/*
+  Copyright (C) 2015 - Voidious
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+*/
+
+#ifndef LINE_BATCH_H
+#define LINE_BATCH_H
+
+#include "line2d.h"
+
+typedef struct {
+  double m;
+  double b;
+  double inverseM;
+  double inverseB;
+  double xMin;
+  double xMax;
+  double yMin;
+  double yMax;
+} LineBatchQuery;
+
+// A set of static lines (like wall or zone edges) stored as parallel arrays,
+// so one line can be tested against many of them at once. Uses AVX2 or SSE2
+// when the compiler targets them, otherwise a plain loop.
+//
+// intersectsAny gives exactly the same answer as calling
+// Line2D::intersects(line) on each of the lines, including its slope/intercept
+// rounding and its handling of vertical lines.
+class LineBatch {
+  int maxLines_, numLines_;
+  double *m_, *b_, *inverseM_, *inverseB_;
+  double *xMin_, *xMax_, *yMin_, *yMax_;
+
+  public:
+    LineBatch(int maxLines);
+    ~LineBatch();
+    int addLine(Line2D *line);
+    int getLineCount();
+    bool intersectsAny(Line2D *line);
+    bool intersectsAny(Line2D *line, int firstLine, int numLines);
+    bool intersectsAny(Line2D *line, int *lines, int numLines);
+  private:
+    void setQuery(Line2D *line, LineBatchQuery *query);
+    bool intersects(int index, LineBatchQuery *query);
+    bool intersectsBlock(int *indexes, LineBatchQuery *query);
+};
+
+#endif
@@ -0,0 +1,90 @@
+/*
+  Copyright (C) 2015 - Voidious
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+*/
+
+
+#include "luaallocator.h"
+
+LuaAllocator::LuaAllocator(size_t maxBytes) {
+  baseAlloc_ = 0;
+  baseData_ = 0;
+  bytesUsed_ = peakBytes_ = 0;
+  maxBytes_ = maxBytes;
+  limited_ = exceeded_ = false;
+}
+
+void LuaAllocator::attach(lua_State *L) {
+  baseAlloc_ = lua_getallocf(L, &baseData_);
+  bytesUsed_ = peakBytes_ = (((size_t) lua_gc(L, LUA_GCCOUNT, 0)) * 1024)
+      + lua_gc(L, LUA_GCCOUNTB, 0);
+  lua_setallocf(L, allocate, this);
+}
+
+// LuaJIT only frees its arena on close if the state has its own allocator.
+void LuaAllocator::detach(lua_State *L) {
+  lua_setallocf(L, baseAlloc_, baseData_);
+}
+
+// Returns whether the limit was being enforced, so nested calls can restore it.
+bool LuaAllocator::setLimited(bool limited) {
+  bool wasLimited = limited_;
+  limited_ = limited;
+  return wasLimited;
+}
+
+bool LuaAllocator::isExceeded() {
+  return exceeded_;
+}
+
+size_t LuaAllocator::getBytesUsed() {
+  return bytesUsed_;
+}
+
+size_t LuaAllocator::getPeakBytes() {
+  return peakBytes_;
+}
+
+LuaAllocator* LuaAllocator::getAllocator(lua_State *L) {
+  void *ud;
+  if (lua_getallocf(L, &ud) == allocate) {
+    return (LuaAllocator *) ud;
+  }
+  return 0;
+}
+
+// Refusing an allocation raises a "not enough memory" error in the state.
+void* LuaAllocator::allocate(void *ud, void *ptr, size_t osize,
+                             size_t nsize) {
+  LuaAllocator *allocator = (LuaAllocator *) ud;
+  if (nsize > osize && allocator->limited_ && allocator->maxBytes_ > 0
+      && allocator->bytesUsed_ + (nsize - osize) > allocator->maxBytes_) {
+    allocator->exceeded_ = true;
+    return 0;
+  }
+
+  void *p = allocator->baseAlloc_(allocator->baseData_, ptr, osize, nsize);
+  if (p != 0 || nsize == 0) {
+    allocator->bytesUsed_ += nsize;
+    allocator->bytesUsed_ -= osize;
+    if (allocator->bytesUsed_ > allocator->peakBytes_) {
+      allocator->peakBytes_ = allocator->bytesUsed_;
+    }
+  }
+  return p;
+}
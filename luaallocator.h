@@ -0,0 +1,60 @@
+/*
+  Copyright (C) 2015 - Voidious
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+*/
+
+
+#ifndef LUA_ALLOCATOR_H
+#define LUA_ALLOCATOR_H
+
+#include <stddef.h>
+
+extern "C" {
+  #include "lua.h"
+}
+
+// Counts the memory used by one Lua state and caps it. Wraps the state's own
+// allocator, which for LuaJIT on 64-bit is already a private dlmalloc arena
+// with size-class bins, so states don't fragment each other's memory.
+//
+// The limit is only enforced while the engine is running user code, so the
+// engine itself never fails to allocate. Counts garbage that hasn't been
+// collected yet. Has to be detached before the state is closed.
+class LuaAllocator {
+  lua_Alloc baseAlloc_;
+  void *baseData_;
+  size_t bytesUsed_;
+  size_t peakBytes_;
+  size_t maxBytes_;
+  bool limited_;
+  bool exceeded_;
+
+  public:
+    LuaAllocator(size_t maxBytes);
+    void attach(lua_State *L);
+    void detach(lua_State *L);
+    bool setLimited(bool limited);
+    bool isExceeded();
+    size_t getBytesUsed();
+    size_t getPeakBytes();
+    static LuaAllocator* getAllocator(lua_State *L);
+  private:
+    static void* allocate(void *ud, void *ptr, size_t osize, size_t nsize);
+};
+
+#endif
@@ -82,6 +82,9 @@ LUALIB_API int (luaL_loadfilex) (lua_State *L, const char *filename,
 				 const char *mode);
 LUALIB_API int (luaL_loadbufferx) (lua_State *L, const char *buff, size_t sz,
 				   const char *name, const char *mode);
+// @Voidious: For the BerryBots program cache.
+LUALIB_API int (luaL_loadbytecode) (lua_State *L, const char *buff, size_t sz,
+				    const char *name);
 LUALIB_API void luaL_traceback (lua_State *L, lua_State *L1, const char *msg,
 				int level);
 
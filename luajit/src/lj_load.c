@@ -46,8 +46,29 @@ static TValue *cpparser(lua_State *L, lua_CFunction dummy, void *ud)
   return NULL;
 }
 
-LUA_API int lua_loadx(lua_State *L, lua_Reader reader, void *data,
-		      const char *chunkname, const char *mode)
+// @Voidious: Only loads bytecode, for programs BerryBots compiled and cached
+//            itself. Never reachable from a user program.
+static TValue *cpbcparser(lua_State *L, lua_CFunction dummy, void *ud)
+{
+  LexState *ls = (LexState *)ud;
+  GCproto *pt;
+  GCfunc *fn;
+  UNUSED(dummy);
+  cframe_errfunc(L->cframe) = -1;  /* Inherit error function. */
+  if (!lj_lex_setup(L, ls)) {
+    setstrV(L, L->top++, lj_err_str(L, LJ_ERR_XMODE));
+    lj_err_throw(L, LUA_ERRSYNTAX);
+  }
+  pt = lj_bcread(ls);
+  fn = lj_func_newL_empty(L, pt, tabref(L->env));
+  /* Don't combine above/below into one statement. */
+  setfuncV(L, L->top++, fn);
+  return NULL;
+}
+
+static int load_chunk(lua_State *L, lua_Reader reader, void *data,
+		      const char *chunkname, const char *mode,
+		      lua_CPFunction parser)
 {
   LexState ls;
   int status;
@@ -56,12 +77,18 @@ LUA_API int lua_loadx(lua_State *L, lua_Reader reader, void *data,
   ls.chunkarg = chunkname ? chunkname : "?";
   ls.mode = mode;
   lj_str_initbuf(&ls.sb);
-  status = lj_vm_cpcall(L, NULL, &ls, cpparser);
+  status = lj_vm_cpcall(L, NULL, &ls, parser);
   lj_lex_cleanup(L, &ls);
   lj_gc_check(L);
   return status;
 }
 
+LUA_API int lua_loadx(lua_State *L, lua_Reader reader, void *data,
+		      const char *chunkname, const char *mode)
+{
+  return load_chunk(L, reader, data, chunkname, mode, cpparser);
+}
+
 LUA_API int lua_load(lua_State *L, lua_Reader reader, void *data,
 		     const char *chunkname)
 {
@@ -314,6 +341,16 @@ LUALIB_API int luaL_loadbuffer(lua_State *L, const char *buf, size_t size,
   return luaL_loadbufferx(L, buf, size, name, NULL);
 }
 
+// @Voidious: Loads bytecode written by lua_dump, from a trusted source.
+LUALIB_API int luaL_loadbytecode(lua_State *L, const char *buf, size_t size,
+				 const char *name)
+{
+  StringReaderCtx ctx;
+  ctx.str = buf;
+  ctx.size = size;
+  return load_chunk(L, reader_string, &ctx, name, NULL, cpbcparser);
+}
+
 LUALIB_API int luaL_loadstring(lua_State *L, const char *s)
 {
   return luaL_loadbuffer(L, s, strlen(s), s);
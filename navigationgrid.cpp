@@ -0,0 +1,482 @@
+/*
+  Copyright (C) 2015 - Voidious
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+*/
+
+#include <math.h>
+#include <float.h>
+#include <algorithm>
+#include "bbconst.h"
+#include "navigationgrid.h"
+
+NavigationGrid::NavigationGrid(
+    int width, int height, Wall **walls, int numWalls) {
+  width_ = width;
+  height_ = height;
+  cellSize_ = SHIP_RADIUS;
+  do {
+    numColumns_ = std::max(1, (int) ceil(width_ / cellSize_));
+    numRows_ = std::max(1, (int) ceil(height_ / cellSize_));
+    if ((double) numColumns_ * numRows_ > MAX_NAV_CELLS) {
+      cellSize_ *= 2;
+    }
+  } while ((double) numColumns_ * numRows_ > MAX_NAV_CELLS);
+  numCells_ = numColumns_ * numRows_;
+  cells_ = new unsigned char[numCells_];
+  for (int x = 0; x < numCells_; x++) {
+    double centerX, centerY;
+    getCellCenter(x, &centerX, &centerY);
+    cells_[x] =
+        (centerX > width_ || centerY > height_) ? NAV_BLOCKED : NAV_OPEN;
+  }
+  numWalls_ = numWalls;
+  wallLeft_ = new double[std::max(1, numWalls)];
+  wallBottom_ = new double[std::max(1, numWalls)];
+  wallRight_ = new double[std::max(1, numWalls)];
+  wallTop_ = new double[std::max(1, numWalls)];
+  for (int x = 0; x < numWalls; x++) {
+    wallLeft_[x] = walls[x]->getLeft();
+    wallBottom_[x] = walls[x]->getBottom();
+    wallRight_[x] = wallLeft_[x] + walls[x]->getWidth();
+    wallTop_[x] = wallBottom_[x] + walls[x]->getHeight();
+    markWall(x);
+  }
+
+  maxFields_ = std::max(1,
+      std::min(MAX_NAV_FIELDS, MAX_NAV_FIELD_CELLS / numCells_));
+  fields_ = new float*[maxFields_];
+  fieldGoals_ = new int[maxFields_];
+  numFields_ = nextField_ = 0;
+  heap_ = new int[numCells_];
+  heapIndexes_ = new int[numCells_];
+  heapSize_ = 0;
+  pathStarts_ = new int[NAV_PATH_CACHE_SIZE];
+  pathGoals_ = new int[NAV_PATH_CACHE_SIZE];
+  paths_ = new int*[NAV_PATH_CACHE_SIZE];
+  pathLengths_ = new int[NAV_PATH_CACHE_SIZE];
+  for (int x = 0; x < NAV_PATH_CACHE_SIZE; x++) {
+    pathStarts_[x] = pathGoals_[x] = -1;
+    paths_[x] = 0;
+    pathLengths_[x] = 0;
+  }
+  cellPath_ = new int[numCells_];
+}
+
+// Cells with their center within a ship radius of the wall are blocked.
+void NavigationGrid::markWall(int wallIndex) {
+  double reach = SHIP_RADIUS + NAV_MARGIN;
+  int column1 = std::max(0,
+      (int) floor((wallLeft_[wallIndex] - reach) / cellSize_));
+  int column2 = std::min(numColumns_ - 1,
+      (int) floor((wallRight_[wallIndex] + reach) / cellSize_));
+  int row1 = std::max(0,
+      (int) floor((wallBottom_[wallIndex] - reach) / cellSize_));
+  int row2 = std::min(numRows_ - 1,
+      (int) floor((wallTop_[wallIndex] + reach) / cellSize_));
+  for (int row = row1; row <= row2; row++) {
+    for (int column = column1; column <= column2; column++) {
+      int cell = (row * numColumns_) + column;
+      double centerX, centerY;
+      getCellCenter(cell, &centerX, &centerY);
+      if (getWallDistance(wallIndex, centerX, centerY) < reach) {
+        cells_[cell] = NAV_BLOCKED;
+      }
+    }
+  }
+}
+
+// Returns the number of waypoints from (x1, y1) to (x2, y2), or -1 if there's
+// no path. Only fills in the waypoints, as (x, y) pairs, if they fit.
+int NavigationGrid::findPath(double x1, double y1, double x2, double y2,
+                             double *waypoints, int maxWaypoints) {
+  int startCell = findOpenCell(x1, y1);
+  int goalCell = findOpenCell(x2, y2);
+  if (startCell == -1 || goalCell == -1) {
+    return -1;
+  }
+  int *path;
+  int pathLength = getPath(startCell, goalCell, &path);
+  if (pathLength == 0) {
+    return -1;
+  }
+
+  int numWaypoints = std::max(1, pathLength - 1);
+  if (numWaypoints <= maxWaypoints) {
+    for (int x = 0; x < numWaypoints; x++) {
+      getCellCenter(path[std::min(x + 1, pathLength - 1)],
+                    &(waypoints[x * 2]), &(waypoints[(x * 2) + 1]));
+    }
+    if (getCell(x2, y2) == goalCell) {
+      waypoints[(numWaypoints * 2) - 2] = x2;
+      waypoints[(numWaypoints * 2) - 1] = y2;
+    }
+  }
+  return numWaypoints;
+}
+
+// Returns about how far a ship would travel from (x1, y1) to (x2, y2), or -1
+// if there's no path.
+double NavigationGrid::getPathDistance(
+    double x1, double y1, double x2, double y2) {
+  int startCell = findOpenCell(x1, y1);
+  int goalCell = findOpenCell(x2, y2);
+  if (startCell == -1 || goalCell == -1) {
+    return -1;
+  }
+  if (startCell == goalCell) {
+    return sqrt(((x2 - x1) * (x2 - x1)) + ((y2 - y1) * (y2 - y1)));
+  }
+  float *field = getField(goalCell);
+  if (field[startCell] == FLT_MAX) {
+    return -1;
+  }
+  double startX, startY, goalX, goalY;
+  getCellCenter(startCell, &startX, &startY);
+  getCellCenter(goalCell, &goalX, &goalY);
+  return (field[startCell] * cellSize_)
+      + sqrt(((startX - x1) * (startX - x1)) + ((startY - y1) * (startY - y1)))
+      + sqrt(((x2 - goalX) * (x2 - goalX)) + ((y2 - goalY) * (y2 - goalY)));
+}
+
+int NavigationGrid::getCell(double x, double y) {
+  int column = std::max(0,
+      std::min((int) floor(x / cellSize_), numColumns_ - 1));
+  int row = std::max(0, std::min((int) floor(y / cellSize_), numRows_ - 1));
+  return (row * numColumns_) + column;
+}
+
+// A ship up against a wall may be centered in a blocked cell, so we look for
+// the closest open cell nearby.
+int NavigationGrid::findOpenCell(double x, double y) {
+  int cell = getCell(x, y);
+  if (cells_[cell] != NAV_BLOCKED) {
+    return cell;
+  }
+  int column = cell % numColumns_;
+  int row = cell / numColumns_;
+  int openCell = -1;
+  double openDistanceSq = DBL_MAX;
+  for (int y2 = std::max(0, row - NAV_SNAP_CELLS);
+       y2 <= std::min(numRows_ - 1, row + NAV_SNAP_CELLS); y2++) {
+    for (int x2 = std::max(0, column - NAV_SNAP_CELLS);
+         x2 <= std::min(numColumns_ - 1, column + NAV_SNAP_CELLS); x2++) {
+      int cell2 = (y2 * numColumns_) + x2;
+      if (cells_[cell2] != NAV_BLOCKED) {
+        double centerX, centerY;
+        getCellCenter(cell2, &centerX, &centerY);
+        double distanceSq = ((centerX - x) * (centerX - x))
+            + ((centerY - y) * (centerY - y));
+        if (distanceSq < openDistanceSq) {
+          openCell = cell2;
+          openDistanceSq = distanceSq;
+        }
+      }
+    }
+  }
+  return openCell;
+}
+
+void NavigationGrid::getCellCenter(int cell, double *x, double *y) {
+  *x = ((cell % numColumns_) + 0.5) * cellSize_;
+  *y = ((cell / numColumns_) + 0.5) * cellSize_;
+}
+
+float* NavigationGrid::getField(int goalCell) {
+  for (int x = 0; x < numFields_; x++) {
+    if (fieldGoals_[x] == goalCell) {
+      return fields_[x];
+    }
+  }
+  int fieldIndex;
+  if (numFields_ < maxFields_) {
+    fieldIndex = numFields_++;
+    fields_[fieldIndex] = new float[numCells_];
+  } else {
+    fieldIndex = nextField_;
+    nextField_ = (nextField_ + 1) % maxFields_;
+  }
+  fieldGoals_[fieldIndex] = goalCell;
+  buildField(goalCell, fields_[fieldIndex]);
+  return fields_[fieldIndex];
+}
+
+// Dijkstra's algorithm out from the goal cell, in units of cells.
+void NavigationGrid::buildField(int goalCell, float *field) {
+  for (int x = 0; x < numCells_; x++) {
+    field[x] = FLT_MAX;
+    heapIndexes_[x] = -1;
+  }
+  field[goalCell] = 0;
+  heapSize_ = 0;
+  pushHeap(goalCell, field);
+  while (heapSize_ > 0) {
+    int cell = popHeap(field);
+    for (int dy = -1; dy <= 1; dy++) {
+      for (int dx = -1; dx <= 1; dx++) {
+        if (canMove(cell, dx, dy)) {
+          int cell2 = cell + (dy * numColumns_) + dx;
+          float distance = field[cell]
+              + ((dx != 0 && dy != 0) ? (float) M_SQRT2 : 1.0f);
+          if (distance < field[cell2]) {
+            field[cell2] = distance;
+            if (heapIndexes_[cell2] == -1) {
+              pushHeap(cell2, field);
+            } else {
+              siftUp(heapIndexes_[cell2], field);
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+bool NavigationGrid::canMove(int cell, int dx, int dy) {
+  if (dx == 0 && dy == 0) {
+    return false;
+  }
+  int column = (cell % numColumns_) + dx;
+  int row = (cell / numColumns_) + dy;
+  if (column < 0 || column >= numColumns_ || row < 0 || row >= numRows_
+      || cells_[(row * numColumns_) + column] == NAV_BLOCKED) {
+    return false;
+  }
+  return (dx == 0 || dy == 0)
+      || (cells_[cell + dx] != NAV_BLOCKED
+          && cells_[cell + (dy * numColumns_)] != NAV_BLOCKED);
+}
+
+void NavigationGrid::pushHeap(int cell, float *field) {
+  heap_[heapSize_] = cell;
+  heapIndexes_[cell] = heapSize_;
+  siftUp(heapSize_++, field);
+}
+
+int NavigationGrid::popHeap(float *field) {
+  int cell = heap_[0];
+  heapIndexes_[cell] = -1;
+  if (--heapSize_ > 0) {
+    heap_[0] = heap_[heapSize_];
+    heapIndexes_[heap_[0]] = 0;
+    siftDown(0, field);
+  }
+  return cell;
+}
+
+void NavigationGrid::siftUp(int heapIndex, float *field) {
+  int cell = heap_[heapIndex];
+  while (heapIndex > 0) {
+    int parentIndex = (heapIndex - 1) / 2;
+    int parent = heap_[parentIndex];
+    if (field[parent] <= field[cell]) {
+      break;
+    }
+    heap_[heapIndex] = parent;
+    heapIndexes_[parent] = heapIndex;
+    heapIndex = parentIndex;
+  }
+  heap_[heapIndex] = cell;
+  heapIndexes_[cell] = heapIndex;
+}
+
+void NavigationGrid::siftDown(int heapIndex, float *field) {
+  int cell = heap_[heapIndex];
+  while (true) {
+    int childIndex = (heapIndex * 2) + 1;
+    if (childIndex >= heapSize_) {
+      break;
+    }
+    if (childIndex + 1 < heapSize_
+        && field[heap_[childIndex + 1]] < field[heap_[childIndex]]) {
+      childIndex++;
+    }
+    int child = heap_[childIndex];
+    if (field[cell] <= field[child]) {
+      break;
+    }
+    heap_[heapIndex] = child;
+    heapIndexes_[child] = heapIndex;
+    heapIndex = childIndex;
+  }
+  heap_[heapIndex] = cell;
+  heapIndexes_[cell] = heapIndex;
+}
+
+// Finds the cells a path goes through, from the start cell to the goal cell,
+// with any cells a straight line can skip left out. Returns the number of
+// cells, or 0 if there's no path.
+int NavigationGrid::getPath(int startCell, int goalCell, int **path) {
+  unsigned int key =
+      (((unsigned int) startCell) * 2654435761u) ^ ((unsigned int) goalCell);
+  int cacheIndex = key % NAV_PATH_CACHE_SIZE;
+  if (pathStarts_[cacheIndex] == startCell
+      && pathGoals_[cacheIndex] == goalCell) {
+    *path = paths_[cacheIndex];
+    return pathLengths_[cacheIndex];
+  }
+
+  // Follow the distance field downhill from the start cell to the goal.
+  float *field = getField(goalCell);
+  int numPathCells = 0;
+  if (field[startCell] != FLT_MAX) {
+    int cell = startCell;
+    cellPath_[numPathCells++] = cell;
+    while (cell != goalCell && numPathCells < numCells_) {
+      int nextCell = -1;
+      float nextDistance = FLT_MAX;
+      for (int dy = -1; dy <= 1; dy++) {
+        for (int dx = -1; dx <= 1; dx++) {
+          if (canMove(cell, dx, dy)) {
+            int cell2 = cell + (dy * numColumns_) + dx;
+            float distance = field[cell2]
+                + ((dx != 0 && dy != 0) ? (float) M_SQRT2 : 1.0f);
+            if (distance < nextDistance) {
+              nextCell = cell2;
+              nextDistance = distance;
+            }
+          }
+        }
+      }
+      cell = nextCell;
+      cellPath_[numPathCells++] = cell;
+    }
+  }
+
+  if (paths_[cacheIndex] != 0) {
+    delete paths_[cacheIndex];
+    paths_[cacheIndex] = 0;
+  }
+  int pathLength = 0;
+  if (numPathCells > 0) {
+    int *smoothPath = new int[numPathCells];
+    smoothPath[pathLength++] = startCell;
+    int anchor = 0;
+    for (int x = 2; x < numPathCells; x++) {
+      if (!clearLine(cellPath_[anchor], cellPath_[x])) {
+        anchor = x - 1;
+        smoothPath[pathLength++] = cellPath_[anchor];
+      }
+    }
+    if (numPathCells > 1) {
+      smoothPath[pathLength++] = cellPath_[numPathCells - 1];
+    }
+    paths_[cacheIndex] = smoothPath;
+  }
+  pathStarts_[cacheIndex] = startCell;
+  pathGoals_[cacheIndex] = goalCell;
+  pathLengths_[cacheIndex] = pathLength;
+  *path = paths_[cacheIndex];
+  return pathLength;
+}
+
+// Checks that a ship moving in a straight line between two cell centers
+// would stay as far from the walls as it does at any open cell center.
+bool NavigationGrid::clearLine(int cell1, int cell2) {
+  double x1, y1, x2, y2;
+  getCellCenter(cell1, &x1, &y1);
+  getCellCenter(cell2, &x2, &y2);
+  double reach = SHIP_RADIUS + NAV_MARGIN;
+  double left = std::min(x1, x2) - reach;
+  double right = std::max(x1, x2) + reach;
+  double bottom = std::min(y1, y2) - reach;
+  double top = std::max(y1, y2) + reach;
+  double dx = x2 - x1;
+  double dy = y2 - y1;
+  double lengthSq = (dx * dx) + (dy * dy);
+  for (int x = 0; x < numWalls_; x++) {
+    if (wallRight_[x] < left || wallLeft_[x] > right
+        || wallTop_[x] < bottom || wallBottom_[x] > top) {
+      continue;
+    }
+
+    // Clip the line to the wall to see if it passes through it.
+    double t1 = 0;
+    double t2 = 1;
+    double p[4] = {-dx, dx, -dy, dy};
+    double q[4] = {x1 - wallLeft_[x], wallRight_[x] - x1,
+                   y1 - wallBottom_[x], wallTop_[x] - y1};
+    for (int y = 0; y < 4 && t1 <= t2; y++) {
+      if (p[y] == 0) {
+        if (q[y] < 0) {
+          t2 = -1;
+        }
+      } else if (p[y] < 0) {
+        t1 = std::max(t1, q[y] / p[y]);
+      } else {
+        t2 = std::min(t2, q[y] / p[y]);
+      }
+    }
+    if (t1 <= t2) {
+      return false;
+    }
+
+    // Otherwise, the closest points are at an end of the line or a corner of
+    // the wall.
+    if (getWallDistance(x, x1, y1) < reach
+        || getWallDistance(x, x2, y2) < reach) {
+      return false;
+    }
+    double cornerX[4] = {wallLeft_[x], wallRight_[x], wallRight_[x],
+                         wallLeft_[x]};
+    double cornerY[4] = {wallBottom_[x], wallBottom_[x], wallTop_[x],
+                         wallTop_[x]};
+    for (int y = 0; y < 4; y++) {
+      double t = (lengthSq == 0) ? 0 : std::max(0.0, std::min(1.0,
+          (((cornerX[y] - x1) * dx) + ((cornerY[y] - y1) * dy)) / lengthSq));
+      double closestX = x1 + (t * dx) - cornerX[y];
+      double closestY = y1 + (t * dy) - cornerY[y];
+      if ((closestX * closestX) + (closestY * closestY) < reach * reach) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+double NavigationGrid::getWallDistance(int wallIndex, double x, double y) {
+  double dx = std::max(0.0,
+      std::max(wallLeft_[wallIndex] - x, x - wallRight_[wallIndex]));
+  double dy = std::max(0.0,
+      std::max(wallBottom_[wallIndex] - y, y - wallTop_[wallIndex]));
+  return sqrt((dx * dx) + (dy * dy));
+}
+
+NavigationGrid::~NavigationGrid() {
+  delete cells_;
+  for (int x = 0; x < numFields_; x++) {
+    delete fields_[x];
+  }
+  delete fields_;
+  delete fieldGoals_;
+  delete heap_;
+  delete heapIndexes_;
+  delete pathStarts_;
+  delete pathGoals_;
+  for (int x = 0; x < NAV_PATH_CACHE_SIZE; x++) {
+    if (paths_[x] != 0) {
+      delete paths_[x];
+    }
+  }
+  delete paths_;
+  delete pathLengths_;
+  delete cellPath_;
+  delete wallLeft_;
+  delete wallBottom_;
+  delete wallRight_;
+  delete wallTop_;
+}
@@ -0,0 +1,87 @@
+/*
+  Copyright (C) 2015 - Voidious
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+*/
+
+#ifndef NAVIGATION_GRID_H
+#define NAVIGATION_GRID_H
+
+#include "wall.h"
+
+#define MAX_NAV_CELLS         262144
+#define MAX_NAV_FIELD_CELLS   2097152
+#define MAX_NAV_FIELDS        64
+#define NAV_PATH_CACHE_SIZE   256
+#define NAV_SNAP_CELLS        2
+#define NAV_MARGIN            1.0
+
+#define NAV_BLOCKED           0
+#define NAV_OPEN              1
+
+// A grid of where a ship can go on a stage, for finding paths between two
+// points. A cell is open if a ship centered on the cell center wouldn't touch
+// any walls. Paths move between open cells, including diagonally if both
+// cells beside the move are open too, and then skip any cells they can reach
+// in a straight line that keeps a ship clear of the walls.
+//
+// The distance to a goal cell from every other cell is worked out the first
+// time a path to it is needed, and a few of these distance fields are kept.
+// Paths are cached by start and goal cell. The walls never change, so the
+// cached results are the same as working them out again.
+class NavigationGrid {
+  double width_, height_, cellSize_;
+  int numColumns_, numRows_, numCells_;
+  unsigned char *cells_;
+  float **fields_;
+  int *fieldGoals_;
+  int numFields_, maxFields_, nextField_;
+  int *heap_;
+  int *heapIndexes_;
+  int heapSize_;
+  int *pathStarts_;
+  int *pathGoals_;
+  int **paths_;
+  int *pathLengths_;
+  int *cellPath_;
+  double *wallLeft_, *wallBottom_, *wallRight_, *wallTop_;
+  int numWalls_;
+
+  public:
+    NavigationGrid(int width, int height, Wall **walls, int numWalls);
+    ~NavigationGrid();
+    int findPath(double x1, double y1, double x2, double y2,
+                 double *waypoints, int maxWaypoints);
+    double getPathDistance(double x1, double y1, double x2, double y2);
+  private:
+    void markWall(int wallIndex);
+    int getCell(double x, double y);
+    int findOpenCell(double x, double y);
+    void getCellCenter(int cell, double *x, double *y);
+    float* getField(int goalCell);
+    void buildField(int goalCell, float *field);
+    bool canMove(int cell, int dx, int dy);
+    void pushHeap(int cell, float *field);
+    int popHeap(float *field);
+    void siftUp(int heapIndex, float *field);
+    void siftDown(int heapIndex, float *field);
+    int getPath(int startCell, int goalCell, int **path);
+    bool clearLine(int cell1, int cell2);
+    double getWallDistance(int wallIndex, double x, double y);
+};
+
+#endif
@@ -0,0 +1,143 @@
+/*
+  Copyright (C) 2015 - Voidious
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+*/
+
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <algorithm>
+#include <pthread.h>
+#include "programcache.h"
+
+extern "C" {
+  #include "lauxlib.h"
+}
+
+ProgramCache::ProgramCache() {
+  numPrograms_ = 0;
+  pthread_mutex_init(&mutex_, 0);
+}
+
+ProgramCache::~ProgramCache() {
+  for (int x = 0; x < numPrograms_; x++) {
+    deleteProgram(&(programs_[x]));
+  }
+  pthread_mutex_destroy(&mutex_);
+}
+
+static int writeBytecode(lua_State *, const void *p, size_t size, void *ud) {
+  ((std::string *) ud)->append((const char *) p, size);
+  return 0;
+}
+
+// Same as luaL_loadfile(L, filename), where filePath is the full path to the
+// file. Leaves the compiled chunk or an error message on the stack. The file
+// is only read once, and we compile the source we read, so cached bytecode
+// always matches the source it's cached with.
+int ProgramCache::loadFile(lua_State *L, const char *filePath,
+                           const char *filename) {
+  size_t sourceLength;
+  char *source = readFile(filePath, &sourceLength);
+  if (source == 0) {
+    return luaL_loadfile(L, filename);
+  }
+
+  pthread_mutex_lock(&mutex_);
+  CachedProgram *program = findProgram(filePath);
+  if (program != 0 && program->sourceLength == sourceLength
+      && memcmp(program->source, source, sourceLength) == 0) {
+    // The chunk name is saved with the bytecode.
+    int r = luaL_loadbytecode(
+        L, program->bytecode, program->bytecodeLength, filename);
+    pthread_mutex_unlock(&mutex_);
+    delete source;
+    return r;
+  }
+  pthread_mutex_unlock(&mutex_);
+
+  // LuaJIT skips a leading # line in a buffer the same way as in a file.
+  std::string chunkName("@");
+  chunkName.append(filename);
+  int r = luaL_loadbuffer(L, source, sourceLength, chunkName.c_str());
+  if (r != 0) {
+    delete source;
+    return r;
+  }
+  std::string bytecode;
+  lua_dump(L, writeBytecode, &bytecode);
+
+  pthread_mutex_lock(&mutex_);
+  program = findProgram(filePath);
+  if (program != 0) {
+    deleteProgram(program);
+  } else if (numPrograms_ < MAX_CACHED_PROGRAMS) {
+    program = &(programs_[numPrograms_++]);
+  }
+  if (program == 0) {
+    delete source;
+  } else {
+    program->filePath = new char[strlen(filePath) + 1];
+    strcpy(program->filePath, filePath);
+    program->source = source;
+    program->sourceLength = sourceLength;
+    program->bytecode = new char[bytecode.length()];
+    memcpy(program->bytecode, bytecode.data(), bytecode.length());
+    program->bytecodeLength = bytecode.length();
+  }
+  pthread_mutex_unlock(&mutex_);
+  return 0;
+}
+
+char* ProgramCache::readFile(const char *filePath, size_t *length) {
+  FILE *file = fopen(filePath, "rb");
+  if (file == NULL) {
+    return 0;
+  }
+  std::string contents;
+  char buffer[4096];
+  size_t bytesRead;
+  while ((bytesRead = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+    contents.append(buffer, bytesRead);
+  }
+  bool failed = (ferror(file) != 0);
+  fclose(file);
+  if (failed) {
+    return 0;
+  }
+  *length = contents.length();
+  char *source = new char[std::max((size_t) 1, contents.length())];
+  memcpy(source, contents.data(), contents.length());
+  return source;
+}
+
+CachedProgram* ProgramCache::findProgram(const char *filePath) {
+  for (int x = 0; x < numPrograms_; x++) {
+    if (strcmp(programs_[x].filePath, filePath) == 0) {
+      return &(programs_[x]);
+    }
+  }
+  return 0;
+}
+
+void ProgramCache::deleteProgram(CachedProgram *program) {
+  delete program->filePath;
+  delete program->source;
+  delete program->bytecode;
+}
@@ -0,0 +1,60 @@
+/*
+  Copyright (C) 2015 - Voidious
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+*/
+
+
+#ifndef PROGRAM_CACHE_H
+#define PROGRAM_CACHE_H
+
+#include <pthread.h>
+
+extern "C" {
+  #include "lua.h"
+}
+
+#define MAX_CACHED_PROGRAMS  1024
+
+typedef struct {
+  char *filePath;
+  char *source;
+  size_t sourceLength;
+  char *bytecode;
+  size_t bytecodeLength;
+} CachedProgram;
+
+// Keeps the compiled bytecode of stage and ship programs, so running the same
+// programs over and over, like in a tournament, only parses them once. Each
+// load still reads the file and compares it to the source we compiled, so an
+// edited file is always recompiled. Shared by all the threads of a runner.
+class ProgramCache {
+  CachedProgram programs_[MAX_CACHED_PROGRAMS];
+  int numPrograms_;
+  pthread_mutex_t mutex_;
+
+  public:
+    ProgramCache();
+    ~ProgramCache();
+    int loadFile(lua_State *L, const char *filePath, const char *filename);
+  private:
+    char* readFile(const char *filePath, size_t *length);
+    CachedProgram* findProgram(const char *filePath);
+    void deleteProgram(CachedProgram *program);
+};
+
+#endif
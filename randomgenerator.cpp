@@ -0,0 +1,50 @@
+/*
+  Copyright (C) 2015 - Voidious
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+*/
+
+
+#include "randomgenerator.h"
+
+#define PCG_MULTIPLIER  6364136223846793005ULL
+#define PCG_INCREMENT   1442695040888963407ULL
+
+RandomGenerator::RandomGenerator(unsigned int seed) {
+  setSeed(seed);
+}
+
+void RandomGenerator::setSeed(unsigned int seed) {
+  state_ = 0;
+  next();
+  state_ += seed;
+  next();
+}
+
+unsigned int RandomGenerator::next() {
+  unsigned long long oldState = state_;
+  state_ = (oldState * PCG_MULTIPLIER) + PCG_INCREMENT;
+  unsigned int xorShifted =
+      (unsigned int) (((oldState >> 18) ^ oldState) >> 27);
+  unsigned int rotation = (unsigned int) (oldState >> 59);
+  return (xorShifted >> rotation) | (xorShifted << ((32 - rotation) & 31));
+}
+
+// A random number from 0 to bound - 1, like rand() % bound.
+int RandomGenerator::nextInt(int bound) {
+  return (int) (next() % bound);
+}
@@ -34,7 +34,7 @@ function run(runner, form, files, network)
 
     runner:setThreadCount(threadCount)
     for i = 1, numSeasons do
-      runner:queueMatch(stage, {challenger})
+      runner:queueMatch(stage, {challenger}, {headless = not saveReplays})
     end
 
     while (not runner:empty()) do
@@ -41,7 +41,8 @@ function run(runner, form, files, network)
 
     for i = 1, seasons do
       for j, shipName in ipairs(referenceShips) do
-        runner:queueMatch(stage, {challenger, shipName})
+        runner:queueMatch(stage, {challenger, shipName},
+                          {headless = not saveReplays})
       end
     end
 
@@ -58,7 +58,8 @@ function nextGeneration(members, runner, files)
     local filename = "mazer" .. i .. ".lua"
     memberDataMap["runners/" .. filename] = {bits = members[i]}
     files:writeBot(filename, mazerCode(members[i], files))
-    runner:queueMatch("runners/maze2e.lua", {"runners/" .. filename})
+    runner:queueMatch("runners/maze2e.lua", {"runners/" .. filename},
+                      {headless = true})
   end
 
   while (not runner:empty()) do
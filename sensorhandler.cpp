@@ -309,11 +309,16 @@ int SensorHandler::numHitByShips(int teamIndex) {
   return numHitByShips_[teamIndex];
 }
 
-void SensorHandler::clearHitByShips(int teamIndex) {
-  for (int x = 0; x < numHitByShips_[teamIndex]; x++) {
-    delete hitByShips_[teamIndex][x];
+void SensorHandler::clearHitByShips(int teamIndex, int numEvents) {
+  HitByShip** events = hitByShips_[teamIndex];
+  for (int x = 0; x < numEvents; x++) {
+    delete events[x];
   }
-  numHitByShips_[teamIndex] = 0;
+  int numLeft = numHitByShips_[teamIndex] - numEvents;
+  for (int x = 0; x < numLeft; x++) {
+    events[x] = events[x + numEvents];
+  }
+  numHitByShips_[teamIndex] = numLeft;
 }
 
 HitByLaser** SensorHandler::getHitByLasers(int teamIndex) {
@@ -324,11 +329,16 @@ int SensorHandler::numHitByLasers(int teamIndex) {
   return numHitByLasers_[teamIndex];
 }
 
-void SensorHandler::clearHitByLasers(int teamIndex) {
-  for (int x = 0; x < numHitByLasers_[teamIndex]; x++) {
-    delete hitByLasers_[teamIndex][x];
+void SensorHandler::clearHitByLasers(int teamIndex, int numEvents) {
+  HitByLaser** events = hitByLasers_[teamIndex];
+  for (int x = 0; x < numEvents; x++) {
+    delete events[x];
+  }
+  int numLeft = numHitByLasers_[teamIndex] - numEvents;
+  for (int x = 0; x < numLeft; x++) {
+    events[x] = events[x + numEvents];
   }
-  numHitByLasers_[teamIndex] = 0;
+  numHitByLasers_[teamIndex] = numLeft;
 }
 
 HitByTorpedo** SensorHandler::getHitByTorpedos(int teamIndex) {
@@ -339,11 +349,16 @@ int SensorHandler::numHitByTorpedos(int teamIndex) {
   return numHitByTorpedos_[teamIndex];
 }
 
-void SensorHandler::clearHitByTorpedos(int teamIndex) {
-  for (int x = 0; x < numHitByTorpedos_[teamIndex]; x++) {
-    delete hitByTorpedos_[teamIndex][x];
+void SensorHandler::clearHitByTorpedos(int teamIndex, int numEvents) {
+  HitByTorpedo** events = hitByTorpedos_[teamIndex];
+  for (int x = 0; x < numEvents; x++) {
+    delete events[x];
   }
-  numHitByTorpedos_[teamIndex] = 0;
+  int numLeft = numHitByTorpedos_[teamIndex] - numEvents;
+  for (int x = 0; x < numLeft; x++) {
+    events[x] = events[x + numEvents];
+  }
+  numHitByTorpedos_[teamIndex] = numLeft;
 }
 
 ShipHitWall** SensorHandler::getHitWalls(int teamIndex) {
@@ -354,11 +369,16 @@ int SensorHandler::numHitWalls(int teamIndex) {
   return numHitWalls_[teamIndex];
 }
 
-void SensorHandler::clearHitWalls(int teamIndex) {
-  for (int x = 0; x < numHitWalls_[teamIndex]; x++) {
-    delete hitWalls_[teamIndex][x];
+void SensorHandler::clearHitWalls(int teamIndex, int numEvents) {
+  ShipHitWall** events = hitWalls_[teamIndex];
+  for (int x = 0; x < numEvents; x++) {
+    delete events[x];
+  }
+  int numLeft = numHitWalls_[teamIndex] - numEvents;
+  for (int x = 0; x < numLeft; x++) {
+    events[x] = events[x + numEvents];
   }
-  numHitWalls_[teamIndex] = 0;
+  numHitWalls_[teamIndex] = numLeft;
 }
 
 ShipDestroyed** SensorHandler::getShipDestroyeds(int teamIndex) {
@@ -369,11 +389,16 @@ int SensorHandler::numShipDestroyeds(int teamIndex) {
   return numShipDestroyeds_[teamIndex];
 }
 
-void SensorHandler::clearShipDestroyeds(int teamIndex) {
-  for (int x = 0; x < numShipDestroyeds_[teamIndex]; x++) {
-    delete shipDestroyeds_[teamIndex][x];
+void SensorHandler::clearShipDestroyeds(int teamIndex, int numEvents) {
+  ShipDestroyed** events = shipDestroyeds_[teamIndex];
+  for (int x = 0; x < numEvents; x++) {
+    delete events[x];
   }
-  numShipDestroyeds_[teamIndex] = 0;
+  int numLeft = numShipDestroyeds_[teamIndex] - numEvents;
+  for (int x = 0; x < numLeft; x++) {
+    events[x] = events[x + numEvents];
+  }
+  numShipDestroyeds_[teamIndex] = numLeft;
 }
 
 ShipFiredLaser** SensorHandler::getShipFiredLasers(int teamIndex) {
@@ -384,11 +409,16 @@ int SensorHandler::numShipFiredLasers(int teamIndex) {
   return numShipFiredLasers_[teamIndex];
 }
 
-void SensorHandler::clearShipFiredLasers(int teamIndex) {
-  for (int x = 0; x < numShipFiredLasers_[teamIndex]; x++) {
-    delete shipFiredLasers_[teamIndex][x];
+void SensorHandler::clearShipFiredLasers(int teamIndex, int numEvents) {
+  ShipFiredLaser** events = shipFiredLasers_[teamIndex];
+  for (int x = 0; x < numEvents; x++) {
+    delete events[x];
+  }
+  int numLeft = numShipFiredLasers_[teamIndex] - numEvents;
+  for (int x = 0; x < numLeft; x++) {
+    events[x] = events[x + numEvents];
   }
-  numShipFiredLasers_[teamIndex] = 0;
+  numShipFiredLasers_[teamIndex] = numLeft;
 }
 
 ShipFiredTorpedo** SensorHandler::getShipFiredTorpedos(int teamIndex) {
@@ -399,11 +429,16 @@ int SensorHandler::numShipFiredTorpedos(int teamIndex) {
   return numShipFiredTorpedos_[teamIndex];
 }
 
-void SensorHandler::clearShipFiredTorpedos(int teamIndex) {
-  for (int x = 0; x < numShipFiredTorpedos_[teamIndex]; x++) {
-    delete shipFiredTorpedos_[teamIndex][x];
+void SensorHandler::clearShipFiredTorpedos(int teamIndex, int numEvents) {
+  ShipFiredTorpedo** events = shipFiredTorpedos_[teamIndex];
+  for (int x = 0; x < numEvents; x++) {
+    delete events[x];
   }
-  numShipFiredTorpedos_[teamIndex] = 0;
+  int numLeft = numShipFiredTorpedos_[teamIndex] - numEvents;
+  for (int x = 0; x < numLeft; x++) {
+    events[x] = events[x + numEvents];
+  }
+  numShipFiredTorpedos_[teamIndex] = numLeft;
 }
 
 LaserHitShip** SensorHandler::getLaserHitShips(int teamIndex) {
@@ -414,11 +449,16 @@ int SensorHandler::numLaserHitShips(int teamIndex) {
   return numLaserHitShips_[teamIndex];
 }
 
-void SensorHandler::clearLaserHitShips(int teamIndex) {
-  for (int x = 0; x < numLaserHitShips_[teamIndex]; x++) {
-    delete laserHitShips_[teamIndex][x];
+void SensorHandler::clearLaserHitShips(int teamIndex, int numEvents) {
+  LaserHitShip** events = laserHitShips_[teamIndex];
+  for (int x = 0; x < numEvents; x++) {
+    delete events[x];
+  }
+  int numLeft = numLaserHitShips_[teamIndex] - numEvents;
+  for (int x = 0; x < numLeft; x++) {
+    events[x] = events[x + numEvents];
   }
-  numLaserHitShips_[teamIndex] = 0;
+  numLaserHitShips_[teamIndex] = numLeft;
 }
 
 ShipHitShip** SensorHandler::getStageShipHitShips() {
@@ -215,31 +215,32 @@ class SensorHandler : public EventHandler {
     virtual void tooManyUserGfxCircles(Team *team) {};
     virtual void tooManyUserGfxTexts(Team *team) {};
 
-    // Events for the ships.
+    // Events for the ships. Clearing deletes the first numEvents events, so
+    // any that came in after they were read are kept for next time.
     HitByShip** getHitByShips(int teamIndex);
     int numHitByShips(int teamIndex);
-    void clearHitByShips(int teamIndex);
+    void clearHitByShips(int teamIndex, int numEvents);
     HitByLaser** getHitByLasers(int teamIndex);
     int numHitByLasers(int teamIndex);
-    void clearHitByLasers(int teamIndex);
+    void clearHitByLasers(int teamIndex, int numEvents);
     HitByTorpedo** getHitByTorpedos(int teamIndex);
     int numHitByTorpedos(int teamIndex);
-    void clearHitByTorpedos(int teamIndex);
+    void clearHitByTorpedos(int teamIndex, int numEvents);
     ShipHitWall** getHitWalls(int teamIndex);
     int numHitWalls(int teamIndex);
-    void clearHitWalls(int teamIndex);
+    void clearHitWalls(int teamIndex, int numEvents);
     ShipDestroyed** getShipDestroyeds(int teamIndex);
     int numShipDestroyeds(int teamIndex);
-    void clearShipDestroyeds(int teamIndex);
+    void clearShipDestroyeds(int teamIndex, int numEvents);
     ShipFiredLaser** getShipFiredLasers(int teamIndex);
     int numShipFiredLasers(int teamIndex);
-    void clearShipFiredLasers(int teamIndex);
+    void clearShipFiredLasers(int teamIndex, int numEvents);
     ShipFiredTorpedo** getShipFiredTorpedos(int teamIndex);
     int numShipFiredTorpedos(int teamIndex);
-    void clearShipFiredTorpedos(int teamIndex);
+    void clearShipFiredTorpedos(int teamIndex, int numEvents);
     LaserHitShip** getLaserHitShips(int teamIndex);
     int numLaserHitShips(int teamIndex);
-    void clearLaserHitShips(int teamIndex);
+    void clearLaserHitShips(int teamIndex, int numEvents);
 
     // Events for the stage.
     ShipHitShip** getStageShipHitShips();
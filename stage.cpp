@@ -20,6 +20,7 @@
 
 #include <math.h>
 #include <float.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <string.h>
 #include <algorithm>
@@ -33,6 +34,26 @@
 #include "line2d.h"
 #include "filemanager.h"
 
+inline bool getBit(unsigned int *bits, int index) {
+  return (bits[index >> 5] & (1u << (index & 31))) != 0;
+}
+
+inline void setBit(unsigned int *bits, int index) {
+  bits[index >> 5] |= (1u << (index & 31));
+}
+
+inline void clearBit(unsigned int *bits, int index) {
+  bits[index >> 5] &= ~(1u << (index & 31));
+}
+
+inline unsigned int hashZoneTag(const char *tag) {
+  unsigned int hash = 2166136261u;
+  for (const char *c = tag; *c != '\0'; c++) {
+    hash = (hash ^ (unsigned char) *c) * 16777619u;
+  }
+  return hash;
+}
+
 Stage::Stage(int width, int height) {
   name_ = 0;
   setSize(width, height);
@@ -47,11 +68,33 @@ Stage::Stage(int width, int height) {
   for (int x = 0; x < 4; x++) {
     baseWallLines_[x] = 0;
   }
+  wallIndex_ = wallLineIndex_ = innerWallLineIndex_ = 0;
+  laserIndex_ = 0;
+  wallLineBatch_ = innerWallLineBatch_ = 0;
+  zoneLineBatch_ = new LineBatch(MAX_ZONES * 4);
+  zoneIndex_ = 0;
+  numZoneTags_ = 0;
+  for (int x = 0; x < ZONE_TAG_BUCKETS; x++) {
+    zoneTagBuckets_[x] = -1;
+  }
   teams_ = 0;
   numTeams_ = 0;
   ships_ = 0;
   numShips_ = 0;
+  maxLasers_ = MAX_LASERS;
+  maxTorpedos_ = MAX_TORPEDOS;
+  laserPool_ = 0;
+  laserLinePool_ = 0;
+  laserPoolSize_ = numFreeLasers_ = 0;
+  freeLasers_ = 0;
+  lasers_ = 0;
+  laserLines_ = 0;
+  indexedLasers_ = 0;
   numLasers_ = 0;
+  torpedoPool_ = 0;
+  torpedoPoolSize_ = numFreeTorpedos_ = 0;
+  freeTorpedos_ = 0;
+  torpedos_ = 0;
   numTorpedos_ = 0;
   numEventHandlers_ = 0;
   fileManager_ = new FileManager();
@@ -60,8 +103,27 @@ Stage::Stage(int width, int height) {
   numGfxLines_ = 0;
   numGfxCircles_ = 0;
   numGfxTexts_ = 0;
+  gfxExpiry_ = INT_MAX;
   userGfxDisabled_ = false;
   nextLaserId_ = nextTorpedoId_ = 0;
+  sweepPairs_ = 0;
+  maxSweepPairs_ = 0;
+  wallCandidates_ = 0;
+  numWallCandidates_ = maxWallCandidates_ = 0;
+  sweptCollisionChecks_ = true;
+  numScratchShips_ = 0;
+  shipData_ = 0;
+  shipCollisionKeys_ = 0;
+  shipCollisionData_ = 0;
+  numShipCollisions_ = maxShipCollisions_ = 0;
+  visibilityGrid_ = 0;
+  freeSpaceMap_ = 0;
+  navigationGrid_ = 0;
+  random_ = new RandomGenerator(rand());
+  profiler_ = 0;
+  numVisionShips_ = 0;
+  visionTime_ = 0;
+  visionX_ = 0;
 }
 
 void Stage::setName(char *name) {
@@ -103,9 +165,74 @@ int Stage::buildBaseWalls() {
       wallLines_[numWallLines_++] = new Line2D(width_, height_, 0, height_);
   baseWallLines_[3] =
       wallLines_[numWallLines_++] = new Line2D(0, height_, 0, 0);
+  buildGeometryIndexes();
   return i;
 }
 
+// Called once the stage is fully configured. Walls can't be added after this.
+void Stage::buildGeometryIndexes() {
+  wallIndex_ = new StageGeometryIndex(numWalls_);
+  for (int x = 0; x < numWalls_; x++) {
+    wallIndex_->addRectangle(walls_[x]);
+  }
+  wallIndex_->build();
+
+  wallLineIndex_ = new StageGeometryIndex(numWallLines_);
+  for (int x = 0; x < numWallLines_; x++) {
+    wallLineIndex_->addLine(wallLines_[x]);
+  }
+  wallLineIndex_->build();
+
+  innerWallLineIndex_ = new StageGeometryIndex(numInnerWallLines_);
+  for (int x = 0; x < numInnerWallLines_; x++) {
+    innerWallLineIndex_->addLine(innerWallLines_[x]);
+  }
+  innerWallLineIndex_->build();
+
+  wallLineBatch_ = new LineBatch(numWallLines_);
+  for (int x = 0; x < numWallLines_; x++) {
+    wallLineBatch_->addLine(wallLines_[x]);
+  }
+  innerWallLineBatch_ = new LineBatch(numInnerWallLines_);
+  for (int x = 0; x < numInnerWallLines_; x++) {
+    innerWallLineBatch_->addLine(innerWallLines_[x]);
+  }
+
+  if (numInnerWallLines_ > 0) {
+    visibilityGrid_ = new VisibilityGrid(width_, height_, innerWallLineIndex_,
+        innerWallLines_, innerWallLineBatch_);
+  }
+  freeSpaceMap_ = new FreeSpaceMap(width_, height_, walls_, numWalls_);
+  navigationGrid_ = new NavigationGrid(width_, height_, walls_, numWalls_);
+  buildZoneIndex();
+}
+
+void Stage::buildZoneIndex() {
+  zoneIndex_ = new StageGeometryIndex(numZones_);
+  for (int x = 0; x < numZones_; x++) {
+    zoneIndex_->addRectangle(zones_[x]);
+  }
+  zoneIndex_->build();
+
+  // Counting sort of the zones by tag id.
+  for (int x = 0; x <= numZoneTags_; x++) {
+    tagZoneStarts_[x] = 0;
+  }
+  for (int x = 0; x < numZones_; x++) {
+    tagZoneStarts_[zoneTagIds_[x] + 1]++;
+  }
+  for (int x = 1; x <= numZoneTags_; x++) {
+    tagZoneStarts_[x] += tagZoneStarts_[x - 1];
+  }
+  for (int x = 0; x < numZones_; x++) {
+    tagZones_[tagZoneStarts_[zoneTagIds_[x]]++] = x;
+  }
+  for (int x = numZoneTags_; x > 0; x--) {
+    tagZoneStarts_[x] = tagZoneStarts_[x - 1];
+  }
+  tagZoneStarts_[0] = 0;
+}
+
 int Stage::addWall(
     int left, int bottom, int width, int height, bool addWallLines) {
   if (numWalls_ >= MAX_WALLS) {
@@ -137,15 +264,52 @@ int Stage::addZone(
   if (numZones_ >= MAX_ZONES) {
     return 0;
   } else {
+    Zone *zone;
     if (strlen(tag) > 0) {
-      zones_[numZones_++] = new Zone(left, bottom, width, height, tag);
+      zone = new Zone(left, bottom, width, height, tag);
     } else {
-      zones_[numZones_++] = new Zone(left, bottom, width, height);
+      zone = new Zone(left, bottom, width, height);
+    }
+    zoneTagIds_[numZones_] = addZoneTag(zone->hasTag() ? zone->getTag() : "");
+    zones_[numZones_++] = zone;
+    Line2D** zoneLines = zone->getLines();
+    for (int x = 0; x < 4; x++) {
+      zoneLineBatch_->addLine(zoneLines[x]);
     }
     return 1;
   }
 }
 
+// Returns the hash bucket holding this tag, or the empty bucket where it
+// would go.
+int Stage::findZoneTagBucket(const char *tag) {
+  int bucket = hashZoneTag(tag) & (ZONE_TAG_BUCKETS - 1);
+  while (zoneTagBuckets_[bucket] != -1
+         && strcmp(zoneTags_[zoneTagBuckets_[bucket]], tag) != 0) {
+    bucket = (bucket + 1) & (ZONE_TAG_BUCKETS - 1);
+  }
+  return bucket;
+}
+
+int Stage::addZoneTag(const char *tag) {
+  int bucket = findZoneTagBucket(tag);
+  if (zoneTagBuckets_[bucket] == -1) {
+    zoneTags_[numZoneTags_] = tag;
+    zoneTagBuckets_[bucket] = numZoneTags_++;
+  }
+  return zoneTagBuckets_[bucket];
+}
+
+// Returns the id of a zone tag, or -1 if no zone has it.
+int Stage::findZoneTag(const char *tag) {
+  return zoneTagBuckets_[findZoneTagBucket(tag)];
+}
+
+int Stage::findTagZones(int tagId, int **zoneIndexes) {
+  *zoneIndexes = &(tagZones_[tagZoneStarts_[tagId]]);
+  return tagZoneStarts_[tagId + 1] - tagZoneStarts_[tagId];
+}
+
 Zone** Stage::getZones() {
   return zones_;
 }
@@ -166,10 +330,22 @@ bool Stage::inZone(Ship *ship, Zone *zone) {
   return false;
 }
 
+// For tags with only a few zones, we just check each of them. Otherwise we
+// check the zones near the ship and skip those with other tags.
 bool Stage::inZone(Ship *ship, const char *tag) {
-  for (int x = 0; x < numZones_; x++) {
-    Zone *zone = zones_[x];
-    if (strcmp(zone->getTag(), tag) == 0 && inZone(ship, zone)) {
+  int tagId = findZoneTag(tag);
+  if (tagId == -1) {
+    return false;
+  }
+  int *zoneIndexes;
+  int numZones = findTagZones(tagId, &zoneIndexes);
+  if (numZones >= MIN_INDEXED_GEOMETRY) {
+    numZones = zoneIndex_->findCandidates(ship->x, ship->y, ship->x, ship->y);
+    zoneIndexes = zoneIndex_->getCandidates();
+  }
+  for (int x = 0; x < numZones; x++) {
+    int zoneIndex = zoneIndexes[x];
+    if (zoneTagIds_[zoneIndex] == tagId && inZone(ship, zones_[zoneIndex])) {
       return true;
     }
   }
@@ -177,49 +353,216 @@ bool Stage::inZone(Ship *ship, const char *tag) {
 }
 
 bool Stage::inAnyZone(Ship *ship) {
-  for (int x = 0; x < numZones_; x++) {
-    if (inZone(ship, zones_[x])) {
+  int numZones =
+      zoneIndex_->findCandidates(ship->x, ship->y, ship->x, ship->y);
+  int *zoneIndexes = zoneIndex_->getCandidates();
+  for (int x = 0; x < numZones; x++) {
+    if (inZone(ship, zones_[zoneIndexes[x]])) {
       return true;
     }
   }
   return false;
 }
 
-bool Stage::touchedZone(Ship *oldShip, Ship *ship, Zone *zone) {
-  if (inZone(ship, zone)) {
+bool Stage::touchedZone(Ship *ship, Line2D *line, int zoneIndex) {
+  if (inZone(ship, zones_[zoneIndex])) {
     return true;
   }
+  return zoneLineBatch_->intersectsAny(line, zoneIndex * 4, 4);
+}
 
-  Line2D *line = new Line2D(oldShip->x, oldShip->y, ship->x, ship->y);
-  Line2D **zoneLines = zone->getLines();
-  for (int x = 0; x < 4; x++) {
-    Line2D *zoneLine = zoneLines[x];
-    if (zoneLine->intersects(line)) {
-      delete line;
+bool Stage::touchedZone(Ship *oldShip, Ship *ship, const char *tag) {
+  int tagId = findZoneTag(tag);
+  if (tagId == -1) {
+    return false;
+  }
+  Line2D line(oldShip->x, oldShip->y, ship->x, ship->y);
+  int *zoneIndexes;
+  int numZones = findTagZones(tagId, &zoneIndexes);
+  if (numZones >= MIN_INDEXED_GEOMETRY) {
+    numZones = zoneIndex_->findCandidates(&line);
+    zoneIndexes = zoneIndex_->getCandidates();
+  }
+  for (int x = 0; x < numZones; x++) {
+    int zoneIndex = zoneIndexes[x];
+    if (zoneTagIds_[zoneIndex] == tagId
+        && touchedZone(ship, &line, zoneIndex)) {
       return true;
     }
   }
-  delete line;
   return false;
 }
 
-bool Stage::touchedZone(Ship *oldShip, Ship *ship, const char *tag) {
-  for (int x = 0; x < numZones_; x++) {
-    Zone *zone = zones_[x];
-    if (strcmp(zone->getTag(), tag) == 0 && touchedZone(oldShip, ship, zone)) {
+bool Stage::touchedAnyZone(Ship *oldShip, Ship *ship) {
+  Line2D line(oldShip->x, oldShip->y, ship->x, ship->y);
+  int numZones = zoneIndex_->findCandidates(&line);
+  int *zoneIndexes = zoneIndex_->getCandidates();
+  for (int x = 0; x < numZones; x++) {
+    if (touchedZone(ship, &line, zoneIndexes[x])) {
       return true;
     }
   }
   return false;
 }
 
-bool Stage::touchedAnyZone(Ship *oldShip, Ship *ship) {
-  for (int x = 0; x < numZones_; x++) {
-    if (touchedZone(oldShip, ship, zones_[x])) {
-      return true;
+// Fills zoneIndexes with every zone the ship touched moving from oldShip to
+// ship, in zone order, and returns how many there are. zoneIndexes needs room
+// for all the zones on the stage.
+int Stage::touchedZones(Ship *oldShip, Ship *ship, int *zoneIndexes) {
+  Line2D line(oldShip->x, oldShip->y, ship->x, ship->y);
+  int numCandidates = zoneIndex_->findCandidates(&line);
+  int *candidates = zoneIndex_->getCandidates();
+  int numZones = 0;
+  for (int x = 0; x < numCandidates; x++) {
+    if (touchedZone(ship, &line, candidates[x])) {
+      zoneIndexes[numZones++] = candidates[x];
     }
   }
-  return false;
+  return numZones;
+}
+
+// Finds the first wall line hit by a ray, or returns false if there's none
+// within maxDistance. A maxDistance of 0 or less reaches across the stage.
+bool Stage::raycast(double x, double y, double angle, double maxDistance,
+                    double *hitX, double *hitY, double *hitDistance) {
+  if (!isfinite(x) || !isfinite(y) || !isfinite(angle)
+      || !isfinite(maxDistance)) {
+    return false;
+  }
+  if (maxDistance <= 0) {
+    maxDistance = abs(x) + abs(y) + width_ + height_;
+  }
+  double dx = cos(angle) * maxDistance;
+  double dy = sin(angle) * maxDistance;
+  Line2D ray(x, y, x + dx, y + dy);
+  int numCandidates = wallLineIndex_->findCandidates(&ray);
+  int *candidates = wallLineIndex_->getCandidates();
+  double rayLengthSq = square(dx) + square(dy);
+  double bestT = DBL_MAX;
+  for (int c = 0; c < numCandidates; c++) {
+    Line2D *wallLine = wallLines_[candidates[c]];
+    double px = wallLine->x1() - x;
+    double py = wallLine->y1() - y;
+    double sx = wallLine->x2() - wallLine->x1();
+    double sy = wallLine->y2() - wallLine->y1();
+    double denominator = (dx * sy) - (dy * sx);
+    double t;
+    if (denominator == 0) {
+      // Parallel, so it's only a hit if the wall line is on the ray, at
+      // whichever end of the overlap is closest.
+      if ((px * dy) - (py * dx) != 0) {
+        continue;
+      }
+      double t1 = ((px * dx) + (py * dy)) / rayLengthSq;
+      double t2 = (((px + sx) * dx) + ((py + sy) * dy)) / rayLengthSq;
+      if (t1 > t2) {
+        std::swap(t1, t2);
+      }
+      if (t2 < 0 || t1 > 1) {
+        continue;
+      }
+      t = std::max(t1, 0.0);
+    } else {
+      t = ((px * sy) - (py * sx)) / denominator;
+      double u = ((px * dy) - (py * dx)) / denominator;
+      if (t < 0 || t > 1 || u < 0 || u > 1) {
+        continue;
+      }
+    }
+    bestT = std::min(bestT, t);
+  }
+
+  if (bestT == DBL_MAX) {
+    return false;
+  }
+  *hitX = x + (bestT * dx);
+  *hitY = y + (bestT * dy);
+  *hitDistance = bestT * maxDistance;
+  return true;
+}
+
+// Same test as ship vision, so only the stage's inner walls block it.
+bool Stage::lineOfSight(double x1, double y1, double x2, double y2) {
+  if (visibilityGrid_ == 0) {
+    return true;
+  }
+  Line2D line(x1, y1, x2, y2);
+  return visibilityGrid_->hasVision(&line);
+}
+
+// Finds the closest point on any wall line. Searches a box around the point
+// that doubles in size until it holds a wall line closer than its edges. The
+// box starts out reaching the stage, so points far off it don't take many
+// doublings. Squared distances from points that far out can overflow, so we
+// track whether we've found a wall separately.
+bool Stage::nearestWall(double x, double y, double *wallX, double *wallY,
+                        double *wallDistance) {
+  int numWallLines = wallLineIndex_->getItemCount();
+  if (numWallLines == 0 || !isfinite(x) || !isfinite(y)) {
+    return false;
+  }
+  bool found = false;
+  double bestDistanceSq = DBL_MAX;
+  double radius = std::max((double) GEOMETRY_CELL_SIZE,
+      std::max(std::max(-x, x - width_), std::max(-y, y - height_)));
+  while (true) {
+    int numCandidates = wallLineIndex_->findCandidates(
+        x - radius, y - radius, x + radius, y + radius);
+    int *candidates = wallLineIndex_->getCandidates();
+    for (int c = 0; c < numCandidates; c++) {
+      Line2D *wallLine = wallLines_[candidates[c]];
+      double sx = wallLine->x2() - wallLine->x1();
+      double sy = wallLine->y2() - wallLine->y1();
+      double lengthSq = square(sx) + square(sy);
+      double t = 0;
+      if (lengthSq > 0) {
+        t = (((x - wallLine->x1()) * sx) + ((y - wallLine->y1()) * sy))
+            / lengthSq;
+        t = limit(0, t, 1);
+      }
+      double closestX = wallLine->x1() + (t * sx);
+      double closestY = wallLine->y1() + (t * sy);
+      double distanceSq = square(closestX - x) + square(closestY - y);
+      if (!found || distanceSq < bestDistanceSq) {
+        found = true;
+        bestDistanceSq = distanceSq;
+        *wallX = closestX;
+        *wallY = closestY;
+      }
+    }
+    if ((found && bestDistanceSq <= square(radius))
+        || numCandidates == numWallLines) {
+      break;
+    }
+    radius *= 2;
+  }
+  if (!found) {
+    return false;
+  }
+  *wallDistance = hypot(*wallX - x, *wallY - y);
+  return true;
+}
+
+// Returns the number of waypoints on a path a ship could take from (x1, y1)
+// to (x2, y2), ending at (x2, y2), or -1 if there's none.
+int Stage::findPath(double x1, double y1, double x2, double y2,
+                    double *waypoints, int maxWaypoints) {
+  return navigationGrid_->findPath(x1, y1, x2, y2, waypoints, maxWaypoints);
+}
+
+double Stage::getPathDistance(double x1, double y1, double x2, double y2) {
+  return navigationGrid_->getPathDistance(x1, y1, x2, y2);
+}
+
+// Random ship placement on the stage comes from its own stream, so it only
+// depends on this seed.
+void Stage::setRandomSeed(unsigned int randomSeed) {
+  random_->setSeed(randomSeed);
+}
+
+// The profiler isn't owned by the stage.
+void Stage::setProfiler(TickProfiler *profiler) {
+  profiler_ = profiler;
 }
 
 int Stage::addStart(double x, double y) {
@@ -234,18 +577,21 @@ int Stage::addStart(double x, double y) {
 Point2D* Stage::getStart() {
   double x, y;
   if (startIndex_ >= numStarts_) {
-    x = SHIP_RADIUS + (rand() % (width_ - SHIP_SIZE));
-    y = SHIP_RADIUS + (rand() % (height_ - SHIP_SIZE));
+    x = SHIP_RADIUS + random_->nextInt(width_ - SHIP_SIZE);
+    y = SHIP_RADIUS + random_->nextInt(height_ - SHIP_SIZE);
   } else {
     Point2D *p = starts_[startIndex_++];
     x = p->getX();
     y = p->getY();
   }
 
-  while (isShipInWall(x, y)) {
-    x = limit(SHIP_RADIUS, x + (rand() % SHIP_SIZE) - SHIP_RADIUS,
+  for (int steps = 0; isShipInWall(x, y); steps++) {
+    if (steps == MAX_PLACEMENT_STEPS && findFreePosition(0, &x, &y)) {
+      break;
+    }
+    x = limit(SHIP_RADIUS, x + random_->nextInt(SHIP_SIZE) - SHIP_RADIUS,
         width_ - SHIP_RADIUS);
-    y = limit(SHIP_RADIUS, y + (rand() % SHIP_SIZE) - SHIP_RADIUS,
+    y = limit(SHIP_RADIUS, y + random_->nextInt(SHIP_SIZE) - SHIP_RADIUS,
         height_ - SHIP_RADIUS);
   }
   return new Point2D(x, y);
@@ -277,8 +623,15 @@ int Stage::getStageShipCount() {
 }
 
 bool Stage::isShipInWall(double x, double y) {
-  for (int z = 0; z < numWalls_; z++) {
-    Wall *wall = walls_[z];
+  int space = freeSpaceMap_->getSpace(x, y);
+  if (space != SPACE_PARTIAL) {
+    return (space == SPACE_BLOCKED);
+  }
+
+  int numCandidates = wallIndex_->findCandidates(x, y, x, y);
+  int *candidates = wallIndex_->getCandidates();
+  for (int z = 0; z < numCandidates; z++) {
+    Wall *wall = walls_[candidates[z]];
     double left = wall->getLeft();
     double bottom = wall->getBottom();
     if (x > left && x < left + wall->getWidth() && y > bottom
@@ -287,34 +640,52 @@ bool Stage::isShipInWall(double x, double y) {
     }
   }
 
-  Circle2D *shipCircle = new Circle2D(x, y, SHIP_RADIUS);
-  for (int z = 0; z < numWallLines_; z++) {
-    Line2D* line = wallLines_[z];
-    if (shipCircle->intersects(line)) {
-      delete shipCircle;
+  Circle2D shipCircle(x, y, SHIP_RADIUS);
+  numCandidates = wallLineIndex_->findCandidates(&shipCircle);
+  candidates = wallLineIndex_->getCandidates();
+  for (int z = 0; z < numCandidates; z++) {
+    Line2D* line = wallLines_[candidates[z]];
+    if (shipCircle.intersects(line)) {
       return true;
     }
   }
-  delete shipCircle;
   return false;
 }
 
 bool Stage::isShipInShip(int shipIndex, double x, double y) {
-  Circle2D *shipCircle = new Circle2D(x, y, SHIP_RADIUS);
-  bool shipInShip = false;
-  for (int z = 0; z < numShips_ && !shipInShip; z++) {
+  Circle2D shipCircle(x, y, SHIP_RADIUS);
+  for (int z = 0; z < numShips_; z++) {
     if (shipIndex != z && ships_[z]->alive) {
       Ship *otherShip = ships_[z];
-      Circle2D *otherShipCircle =
-          new Circle2D(otherShip->x, otherShip->y, SHIP_RADIUS);
-      if (shipCircle->overlaps(otherShipCircle)) {
-        shipInShip = true;
+      Circle2D otherShipCircle(otherShip->x, otherShip->y, SHIP_RADIUS);
+      if (shipCircle.overlaps(&otherShipCircle)) {
+        return true;
       }
-      delete otherShipCircle;
     }
   }
-  delete shipCircle;
-  return shipInShip;
+  return false;
+}
+
+// Picks a random free cell on the stage and puts the ship in the middle of
+// it. If a ship is given, skips cells where it would overlap another ship.
+// Returns false if there's nowhere to put it.
+bool Stage::findFreePosition(Ship *ship, double *x, double *y) {
+  int numFreeCells = freeSpaceMap_->getFreeCellCount();
+  if (numFreeCells == 0) {
+    return false;
+  }
+  int firstCell = random_->nextInt(numFreeCells);
+  for (int z = 0; z < numFreeCells; z++) {
+    double cellX, cellY;
+    freeSpaceMap_->getFreeCellCenter(
+        (firstCell + z) % numFreeCells, &cellX, &cellY);
+    if (ship == 0 || !isShipInShip(ship->index, cellX, cellY)) {
+      *x = cellX;
+      *y = cellY;
+      return true;
+    }
+  }
+  return false;
 }
 
 int Stage::addStageText(int gameTime, const char *text, double x, double y,
@@ -381,11 +752,41 @@ void Stage::disableUserGfx() {
   userGfxDisabled_ = true;
 }
 
+// Each team, and the stage, keeps the first tick any of its user gfx goes
+// stale, so we only scan its lists on those ticks.
 void Stage::clearStaleUserGfxs(int gameTime) {
-  clearStaleUserGfxRectangles(gameTime);
-  clearStaleUserGfxLines(gameTime);
-  clearStaleUserGfxCircles(gameTime);
-  clearStaleUserGfxTexts(gameTime);
+  for (int x = 0; x < numTeams_; x++) {
+    Team *team = teams_[x];
+    if (gameTime >= team->gfxExpiry) {
+      team->gfxExpiry = INT_MAX;
+      team->numRectangles = clearStaleUserGfxRectangles(gameTime,
+          team->gfxRectangles, team->numRectangles, &(team->gfxExpiry));
+      team->numLines = clearStaleUserGfxLines(gameTime, team->gfxLines,
+          team->numLines, &(team->gfxExpiry));
+      team->numCircles = clearStaleUserGfxCircles(gameTime, team->gfxCircles,
+          team->numCircles, &(team->gfxExpiry));
+      team->numTexts = clearStaleUserGfxTexts(gameTime, team->gfxTexts,
+          team->numTexts, &(team->gfxExpiry));
+    }
+  }
+  if (gameTime >= gfxExpiry_) {
+    gfxExpiry_ = INT_MAX;
+    numGfxRectangles_ = clearStaleUserGfxRectangles(gameTime, gfxRectangles_,
+        numGfxRectangles_, &gfxExpiry_);
+    numGfxLines_ = clearStaleUserGfxLines(gameTime, gfxLines_, numGfxLines_,
+                                          &gfxExpiry_);
+    numGfxCircles_ = clearStaleUserGfxCircles(gameTime, gfxCircles_,
+                                              numGfxCircles_, &gfxExpiry_);
+    numGfxTexts_ = clearStaleUserGfxTexts(gameTime, gfxTexts_, numGfxTexts_,
+                                          &gfxExpiry_);
+  }
+}
+
+// Stale once gameTime - startTime >= drawTicks, without overflowing.
+void Stage::updateGfxExpiry(int *gfxExpiry, int startTime, int drawTicks) {
+  int expiry = (drawTicks > INT_MAX - startTime)
+      ? INT_MAX : startTime + drawTicks;
+  *gfxExpiry = std::min(*gfxExpiry, expiry);
 }
 
 int Stage::addUserGfxRectangle(Team *team, int gameTime, double left,
@@ -420,8 +821,10 @@ int Stage::addUserGfxRectangle(Team *team, int gameTime, double left,
     rectangle->drawTicks = drawTicks;
     if (team == 0) {
       gfxRectangles_[numGfxRectangles_++] = rectangle;
+      updateGfxExpiry(&gfxExpiry_, gameTime, drawTicks);
     } else {
       team->gfxRectangles[team->numRectangles++] = rectangle;
+      updateGfxExpiry(&(team->gfxExpiry), gameTime, drawTicks);
     }
     return 1;
   }
@@ -443,19 +846,8 @@ int Stage::getStageGfxRectangleCount() {
   return numGfxRectangles_;
 }
 
-void Stage::clearStaleUserGfxRectangles(int gameTime) {
-  for (int x = 0; x < numTeams_; x++) {
-    Team *team = teams_[x];
-    team->numRectangles =
-        clearStaleUserGfxRectangles(gameTime, team->gfxRectangles,
-                                    team->numRectangles);
-  }
-  numGfxRectangles_ = clearStaleUserGfxRectangles(gameTime, gfxRectangles_,
-                                                  numGfxRectangles_);
-}
-
 int Stage::clearStaleUserGfxRectangles(int gameTime,
-      UserGfxRectangle** gfxRectangles, int numRectangles) {
+    UserGfxRectangle** gfxRectangles, int numRectangles, int *gfxExpiry) {
   for (int y = 0; y < numRectangles; y++) {
     UserGfxRectangle *rectangle = gfxRectangles[y];
     if (gameTime - rectangle->startTime >= rectangle->drawTicks) {
@@ -465,6 +857,8 @@ int Stage::clearStaleUserGfxRectangles(int gameTime,
       delete rectangle;
       numRectangles--;
       y--;
+    } else {
+      updateGfxExpiry(gfxExpiry, rectangle->startTime, rectangle->drawTicks);
     }
   }
   return numRectangles;
@@ -500,8 +894,10 @@ int Stage::addUserGfxLine(Team *team, int gameTime, double x, double y,
     line->drawTicks = drawTicks;
     if (team == 0) {
       gfxLines_[numGfxLines_++] = line;
+      updateGfxExpiry(&gfxExpiry_, gameTime, drawTicks);
     } else {
       team->gfxLines[team->numLines++] = line;
+      updateGfxExpiry(&(team->gfxExpiry), gameTime, drawTicks);
     }
     return 1;
   }
@@ -523,17 +919,8 @@ int Stage::getStageGfxLineCount() {
   return numGfxLines_;
 }
 
-void Stage::clearStaleUserGfxLines(int gameTime) {
-  for (int x = 0; x < numTeams_; x++) {
-    Team *team = teams_[x];
-    team->numLines = clearStaleUserGfxLines(gameTime, team->gfxLines,
-                                            team->numLines);
-  }
-  numGfxLines_ = clearStaleUserGfxLines(gameTime, gfxLines_, numGfxLines_);
-}
-
-int Stage::clearStaleUserGfxLines(int gameTime, UserGfxLine** gfxLines,
-                                  int numLines) {
+int Stage::clearStaleUserGfxLines(int gameTime,
+    UserGfxLine** gfxLines, int numLines, int *gfxExpiry) {
   for (int y = 0; y < numLines; y++) {
     UserGfxLine *line = gfxLines[y];
     if (gameTime - line->startTime >= line->drawTicks) {
@@ -543,6 +930,8 @@ int Stage::clearStaleUserGfxLines(int gameTime, UserGfxLine** gfxLines,
       delete line;
       numLines--;
       y--;
+    } else {
+      updateGfxExpiry(gfxExpiry, line->startTime, line->drawTicks);
     }
   }
   return numLines;
@@ -577,8 +966,10 @@ int Stage::addUserGfxCircle(Team *team, int gameTime, double x, double y,
     circle->drawTicks = drawTicks;
     if (team == 0) {
       gfxCircles_[numGfxCircles_++] = circle;
+      updateGfxExpiry(&gfxExpiry_, gameTime, drawTicks);
     } else {
       team->gfxCircles[team->numCircles++] = circle;
+      updateGfxExpiry(&(team->gfxExpiry), gameTime, drawTicks);
     }
     return 1;
   }
@@ -600,18 +991,8 @@ int Stage::getStageGfxCircleCount() {
   return numGfxCircles_;
 }
 
-void Stage::clearStaleUserGfxCircles(int gameTime) {
-  for (int x = 0; x < numTeams_; x++) {
-    Team *team = teams_[x];
-    team->numCircles = clearStaleUserGfxCircles(gameTime, team->gfxCircles,
-                                                team->numCircles);
-  }
-  numGfxCircles_ = clearStaleUserGfxCircles(gameTime, gfxCircles_,
-                                            numGfxCircles_);
-}
-
-int Stage::clearStaleUserGfxCircles(int gameTime, UserGfxCircle** gfxCircles,
-                                    int numCircles) {
+int Stage::clearStaleUserGfxCircles(int gameTime,
+    UserGfxCircle** gfxCircles, int numCircles, int *gfxExpiry) {
   for (int y = 0; y < numCircles; y++) {
     UserGfxCircle *circle = gfxCircles[y];
     if (gameTime - circle->startTime >= circle->drawTicks) {
@@ -621,6 +1002,8 @@ int Stage::clearStaleUserGfxCircles(int gameTime, UserGfxCircle** gfxCircles,
       delete circle;
       numCircles--;
       y--;
+    } else {
+      updateGfxExpiry(gfxExpiry, circle->startTime, circle->drawTicks);
     }
   }
   return numCircles;
@@ -651,8 +1034,10 @@ int Stage::addUserGfxText(Team *team, int gameTime, const char *text,
     userText->drawTicks = drawTicks;
     if (team == 0) {
       gfxTexts_[numGfxTexts_++] = userText;
+      updateGfxExpiry(&gfxExpiry_, gameTime, drawTicks);
     } else {
       team->gfxTexts[team->numTexts++] = userText;
+      updateGfxExpiry(&(team->gfxExpiry), gameTime, drawTicks);
     }
     return 1;
   }
@@ -674,17 +1059,8 @@ int Stage::getStageGfxTextCount() {
   return numGfxTexts_;
 }
 
-void Stage::clearStaleUserGfxTexts(int gameTime) {
-  for (int x = 0; x < numTeams_; x++) {
-    Team *team = teams_[x];
-    team->numTexts = clearStaleUserGfxTexts(gameTime, team->gfxTexts,
-                                            team->numTexts);
-  }
-  numGfxTexts_ = clearStaleUserGfxTexts(gameTime, gfxTexts_, numGfxTexts_);
-}
-
-int Stage::clearStaleUserGfxTexts(int gameTime, UserGfxText** gfxTexts,
-                                  int numTexts) {
+int Stage::clearStaleUserGfxTexts(int gameTime,
+    UserGfxText** gfxTexts, int numTexts, int *gfxExpiry) {
   for (int y = 0; y < numTexts; y++) {
     UserGfxText *userText = gfxTexts[y];
     if (gameTime - userText->startTime >= userText->drawTicks) {
@@ -694,6 +1070,8 @@ int Stage::clearStaleUserGfxTexts(int gameTime, UserGfxText** gfxTexts,
       delete userText;
       numTexts--;
       y--;
+    } else {
+      updateGfxExpiry(gfxExpiry, userText->startTime, userText->drawTicks);
     }
   }
   return numTexts;
@@ -710,7 +1088,12 @@ void Stage::setTeamsAndShips(
 
 void Stage::moveAndCheckCollisions(
     Ship **oldShips, Ship **ships, int numShips, int gameTime) {
-  ShipMoveData *shipData = new ShipMoveData[numShips];
+  unsigned long long profileTime = 0;
+  if (profiler_ != 0) {
+    profileTime = profiler_->now();
+  }
+  resetPhysicsScratch(numShips);
+  ShipMoveData *shipData = shipData_;
 
   // Calculate initial movement and decide on a common sub-tick interval.
   int intervals = 1;
@@ -738,17 +1121,15 @@ void Stage::moveAndCheckCollisions(
       ship->hitShip = false;
       setSpeedAndHeading(oldShip, ship, &shipDatum);
   
-      shipDatum.shipCircle = new Circle2D(oldShip->x, oldShip->y, SHIP_RADIUS);
-      shipDatum.nextShipCircle = new Circle2D(0, 0, SHIP_RADIUS);
+      shipDatum.shipCircle = &(shipCircles_[x]);
+      shipDatum.shipCircle->setPosition(oldShip->x, oldShip->y);
+      shipDatum.nextShipCircle = &(nextShipCircles_[x]);
+      shipDatum.nextShipCircle->setPosition(0, 0);
       shipDatum.wallCollision = false;
       shipDatum.minWallImpactDiff = M_PI;
       shipDatum.wallImpactAngle = 0;
       shipDatum.wallImpactLine = 0;
       shipDatum.shipCollision = false;
-      shipDatum.shipCollisionData = new ShipCollisionData*[numShips];
-      for (int y = 0; y < numShips; y++) {
-        shipDatum.shipCollisionData[y] = 0;
-      }
       shipDatum.stopped = false;
   
       double moveDistance =
@@ -766,6 +1147,23 @@ void Stage::moveAndCheckCollisions(
     }
   }
 
+  // With swept collision checks, we find the walls and ships each ship could
+  // touch over the whole tick up front. Ships only test those walls in each
+  // interval, ships that aren't moving only test them once, and the ship
+  // pairs are only found once. Every interval still moves every ship, so we
+  // find the same collisions as testing everything in every interval.
+  int numTickPairs = 0;
+  if (sweptCollisionChecks_) {
+    numWallCandidates_ = 0;
+    for (int x = 0; x < numShips; x++) {
+      if (ships[x]->alive) {
+        findWallCandidates(oldShips[x], &(shipData[x]), intervals);
+      }
+    }
+    numTickPairs =
+        findShipCollisionCandidates(ships, shipData, numShips, intervals);
+  }
+
   for (int x = 0; x < intervals; x++) {
     // Move ships one interval and check for wall collisions.
     for (int y = 0; y < numShips; y++) {
@@ -776,29 +1174,39 @@ void Stage::moveAndCheckCollisions(
           shipDatum->nextShipCircle->setPosition(
               oldShip->x + (shipDatum->dx * (x + 1)),
               oldShip->y + (shipDatum->dy * (x + 1)));
-          for (int z = 0; z < numWallLines_; z++) {
-            Line2D* line = wallLines_[z];
-            Point2D *p1 = 0;
-            Point2D *p2 = 0;
-            if (shipDatum->nextShipCircle->intersects(line, &p1, &p2)) {
+          int numCandidates;
+          int *candidates;
+          if (sweptCollisionChecks_) {
+            bool moving = (shipDatum->dx != 0 || shipDatum->dy != 0);
+            numCandidates = (x == 0 || moving)
+                ? shipDatum->numWallCandidates : 0;
+            candidates = &(wallCandidates_[shipDatum->firstWallCandidate]);
+          } else {
+            numCandidates =
+                wallLineIndex_->findCandidates(shipDatum->nextShipCircle);
+            candidates = wallLineIndex_->getCandidates();
+          }
+          for (int z = 0; z < numCandidates; z++) {
+            Line2D* line = wallLines_[candidates[z]];
+            Point2D p1(0, 0);
+            Point2D p2(0, 0);
+            int numPoints = 0;
+            if (shipDatum->nextShipCircle->intersects(
+                    line, &p1, &p2, &numPoints)) {
               double thisX = shipDatum->shipCircle->h();
               double thisY = shipDatum->shipCircle->k();
               bool valid = true;
-              if (p1 != 0) {
+              if (numPoints > 0) {
                 Line2D vertexSightLine1(thisX, thisY,
-                    p1->getX() - (signum(p1->getX() - thisX) * VERTEX_FUDGE),
-                    p1->getY() - (signum(p1->getY() - thisY) * VERTEX_FUDGE));
+                    p1.getX() - (signum(p1.getX() - thisX) * VERTEX_FUDGE),
+                    p1.getY() - (signum(p1.getY() - thisY) * VERTEX_FUDGE));
                 valid = hasVision(&vertexSightLine1);
-                delete p1;
               }
-              if (p2 != 0) {
-                if (valid) {
-                  Line2D vertexSightLine2(thisX, thisY,
-                      p2->getX() - (signum(p2->getX() - thisX) * VERTEX_FUDGE),
-                      p2->getY() - (signum(p2->getY() - thisY) * VERTEX_FUDGE));
-                  valid = hasVision(&vertexSightLine2);
-                }
-                delete p2;
+              if (numPoints > 1 && valid) {
+                Line2D vertexSightLine2(thisX, thisY,
+                    p2.getX() - (signum(p2.getX() - thisX) * VERTEX_FUDGE),
+                    p2.getY() - (signum(p2.getY() - thisY) * VERTEX_FUDGE));
+                valid = hasVision(&vertexSightLine2);
               }
               if (valid) {
                 shipDatum->stopped = shipDatum->wallCollision = true;
@@ -824,26 +1232,28 @@ void Stage::moveAndCheckCollisions(
       }
     }
 
-    // Check for ship-ship collisions.
-    for (int y = 0; y < numShips; y++) {
+    // Check for ship-ship collisions. Candidate pairs are sorted by ship
+    // index, so we visit them in the same order as a full pairwise scan.
+    int numPairs = sweptCollisionChecks_ ? numTickPairs
+        : findShipCollisionCandidates(ships, shipData, numShips, 0);
+    int pairIndex = 0;
+    while (pairIndex < numPairs) {
+      int y = sweepPairs_[pairIndex] / numShips;
       ShipMoveData *shipDatum = &(shipData[y]);
-      if (ships[y]->alive && !shipDatum->stopped) {
-        for (int z = 0; z < numShips; z++) {
-          if (y != z && ships[z]->alive) {
-            ShipMoveData *shipDatum2 = &(shipData[z]);
-            if (shipDatum->nextShipCircle->overlaps(shipDatum2->shipCircle)
-                || (!shipDatum2->stopped
-                    && shipDatum->nextShipCircle->overlaps(
-                        shipDatum2->nextShipCircle))) {
-              shipDatum->stopped = shipDatum2->stopped =
-                  shipDatum->shipCollision = shipDatum2->shipCollision = true;
-              if (shipDatum->shipCollisionData[z] == 0) {
-                shipDatum->shipCollisionData[z] = new ShipCollisionData;
-              }
-              if (shipDatum2->shipCollisionData[y] == 0) {
-                shipDatum2->shipCollisionData[y] = new ShipCollisionData;
-              }
-            }
+      bool checkShip = !shipDatum->stopped;
+      for (; pairIndex < numPairs && sweepPairs_[pairIndex] / numShips == y;
+           pairIndex++) {
+        if (checkShip) {
+          int z = sweepPairs_[pairIndex] % numShips;
+          ShipMoveData *shipDatum2 = &(shipData[z]);
+          if (shipDatum->nextShipCircle->overlaps(shipDatum2->shipCircle)
+              || (!shipDatum2->stopped
+                  && shipDatum->nextShipCircle->overlaps(
+                      shipDatum2->nextShipCircle))) {
+            shipDatum->stopped = shipDatum2->stopped =
+                shipDatum->shipCollision = shipDatum2->shipCollision = true;
+            addShipCollision(y, z, numShips);
+            addShipCollision(z, y, numShips);
           }
         }
       }
@@ -860,6 +1270,9 @@ void Stage::moveAndCheckCollisions(
       }
     }
   }
+  if (profiler_ != 0) {
+    profileTime = profiler_->record(PROFILE_SHIP_MOVES, -1, profileTime);
+  }
 
   // Calculate impact of wall collisions.
   for (int x = 0; x < numShips; x++) {
@@ -906,85 +1319,70 @@ void Stage::moveAndCheckCollisions(
     }
   }
 
-  // Calculate momentum to be transferred between all colliding ships.
-  for (int x = 0; x < numShips; x++) {
-    ShipMoveData *shipDatum = &(shipData[x]);
+  // Calculate momentum to be transferred between all colliding ships. Sorting
+  // the collision keys groups them by ship, in the same order we'd get from
+  // looping over all pairs of ships.
+  std::sort(shipCollisionKeys_, shipCollisionKeys_ + numShipCollisions_);
+  int collisionIndex = 0;
+  while (collisionIndex < numShipCollisions_) {
+    int x = shipCollisionKeys_[collisionIndex] / numShips;
     Ship *ship = ships[x];
-    if (ship-> alive && shipDatum->shipCollision) {
-      double totalForce = 0;
-      for (int y = 0; y < numShips; y++) {
-        if (x != y && ships[y]->alive) {
-          ShipCollisionData *collisionData = shipDatum->shipCollisionData[y];
-          if (collisionData != 0) {
-            collisionData->angle =
-                atan2(ships[y]->y - ship->y, ships[y]->x - ship->x);
-            collisionData->force =
-                cos(ship->heading - collisionData->angle) * ship->speed;
-            totalForce += collisionData->force;
-          }
-        }
-      }
-      if (totalForce > ship->speed) {
-        for (int y = 0; y < numShips; y++) {
-          if (x != y) {
-            ShipCollisionData *collisionData = shipDatum->shipCollisionData[y];
-            if (collisionData != 0) {
-              collisionData->force *= ship->speed / totalForce;
-            }
-          }
-        }
+    int firstIndex = collisionIndex;
+    double totalForce = 0;
+    for (; collisionIndex < numShipCollisions_
+           && shipCollisionKeys_[collisionIndex] / numShips == x;
+         collisionIndex++) {
+      int y = shipCollisionKeys_[collisionIndex] % numShips;
+      ShipCollisionData *collisionData = &(shipCollisionData_[collisionIndex]);
+      collisionData->angle =
+          atan2(ships[y]->y - ship->y, ships[y]->x - ship->x);
+      collisionData->force =
+          cos(ship->heading - collisionData->angle) * ship->speed;
+      totalForce += collisionData->force;
+    }
+    if (totalForce > ship->speed) {
+      for (int y = firstIndex; y < collisionIndex; y++) {
+        shipCollisionData_[y].force *= ship->speed / totalForce;
       }
     }
   }
 
   // Apply momentum transfers.
-  for (int x = 0; x < numShips; x++) {
+  for (int c = 0; c < numShipCollisions_; c++) {
+    int x = shipCollisionKeys_[c] / numShips;
+    int y = shipCollisionKeys_[c] % numShips;
     ShipMoveData *shipDatum = &(shipData[x]);
-    if (ships[x]->alive && shipDatum->shipCollision) {
-      for (int y = 0; y < numShips; y++) {
-        if (x != y && ships[y]->alive) {
-          ShipMoveData *shipDatum2 = &(shipData[y]);
-          ShipCollisionData *collisionData = shipDatum->shipCollisionData[y];
-          if (collisionData != 0) {
-            double xForce = cos(collisionData->angle) * collisionData->force;
-            double yForce = sin(collisionData->angle) * collisionData->force;
-            shipDatum->xSpeed -= xForce;
-            shipDatum->ySpeed -= yForce;
-            setSpeedAndHeading(oldShips[x], ships[x], shipDatum);
-            shipDatum2->xSpeed += xForce;
-            shipDatum2->ySpeed += yForce;
-            setSpeedAndHeading(oldShips[y], ships[y], shipDatum2);
-
-            ShipCollisionData *collisionData2 =
-                shipDatum2->shipCollisionData[x];
-            for (int z = 0; z < numEventHandlers_; z++) {
-              eventHandlers_[z]->handleShipHitShip(ships[x], ships[y],
-                  collisionData->angle, collisionData->force,
-                  collisionData2->angle, collisionData2->force, gameTime);
-            }
-          }
-        }
-      }
+    ShipMoveData *shipDatum2 = &(shipData[y]);
+    ShipCollisionData *collisionData = &(shipCollisionData_[c]);
+    double xForce = cos(collisionData->angle) * collisionData->force;
+    double yForce = sin(collisionData->angle) * collisionData->force;
+    shipDatum->xSpeed -= xForce;
+    shipDatum->ySpeed -= yForce;
+    setSpeedAndHeading(oldShips[x], ships[x], shipDatum);
+    shipDatum2->xSpeed += xForce;
+    shipDatum2->ySpeed += yForce;
+    setSpeedAndHeading(oldShips[y], ships[y], shipDatum2);
+
+    ShipCollisionData *collisionData2 = getShipCollisionData(y, x, numShips);
+    for (int z = 0; z < numEventHandlers_; z++) {
+      eventHandlers_[z]->handleShipHitShip(ships[x], ships[y],
+          collisionData->angle, collisionData->force,
+          collisionData2->angle, collisionData2->force, gameTime);
     }
   }
+  if (profiler_ != 0) {
+    profileTime = profiler_->record(PROFILE_SHIP_COLLISIONS, -1, profileTime);
+  }
 
   // Check for laser-ship collisions, laser-wall collisions, log destroys and
   // damage, remove dead lasers.
-  bool **laserHits = new bool*[numShips];
   for (int x = 0; x < numShips; x++) {
-    laserHits[x] = new bool[numShips];
-    for (int y = 0; y < numShips; y++) {
-      laserHits[x][y] = false;
-    }
-  }
-  bool *wasAlive = new bool[numShips];
-  for (int x = 0; x < numShips; x++) {
-    wasAlive[x] = ships[x]->alive;
+    wasAlive_[x] = ships[x]->alive;
   }
 
   // For lasers fired this tick, check if they intersect any other ships at
   // their initial position (0-25 from origin) before moving the first time.
-  checkLaserShipCollisions(ships, shipData, numShips, laserHits, numLasers_,
+  checkLaserShipCollisions(ships, shipData, numShips, laserHits_, numLasers_,
                            gameTime, true);
 
   // Move lasers one whole tick.
@@ -995,83 +1393,33 @@ void Stage::moveAndCheckCollisions(
     laserLines_[x]->shift(laser->dx, laser->dy);
   }
   
-  checkLaserShipCollisions(ships, shipData, numShips, laserHits, numLasers_,
+  checkLaserShipCollisions(ships, shipData, numShips, laserHits_, numLasers_,
                            gameTime, false);
-
-  for (int x = 0; x < numShips; x++) {
-    Ship *ship = ships[x];
-    if (wasAlive[x] && !ship->alive) {
-      int numDestroyers = 0;
-      for (int y = 0; y < numShips; y++) {
-        if (laserHits[y][x]) {
-          numDestroyers++;
-        }
-      }
-      Ship **destroyers = new Ship*[numDestroyers];
-      int destroyerIndex = 0;
-      for (int y = 0; y < numShips; y++) {
-        if (laserHits[y][x]) {
-          destroyers[destroyerIndex++] = ships[y];
-        }
-      }
-      
-      for (int y = 0; y < numShips; y++) {
-        if (laserHits[y][x]) {
-          double destroyScore = 1.0 / numDestroyers;
-          if (ship->teamIndex == ships[y]->teamIndex) {
-            ships[y]->friendlyKills += destroyScore;
-          } else {
-            ships[y]->kills += destroyScore;
-          }
-        }
-      }
-
-      for (int z = 0; z < numEventHandlers_; z++) {
-        eventHandlers_[z]->handleShipDestroyed(ship, gameTime, destroyers,
-                                               numDestroyers);
-      }
-      delete destroyers;
-    }
-  }
+  logShipDestroys(ships, numShips, laserHits_, gameTime);
   for (int x = 0; x < numLasers_; x++) {
     Laser *laser = lasers_[x];
     Line2D *laserLine = laserLines_[x];
-    for (int y = 0; y < numWallLines_ && !lasers_[x]->dead; y++) {
-      Line2D *wallLine = wallLines_[y];
-      if (wallLine->intersects(laserLine)) {
-        lasers_[x]->dead = true;
-      }
+    if (!laser->dead) {
+      int numCandidates = wallLineIndex_->findCandidates(laserLine);
+      laser->dead = wallLineBatch_->intersectsAny(
+          laserLine, wallLineIndex_->getCandidates(), numCandidates);
     }
     if (laser->dead) {
-      if (numLasers_ > 1) {
-        lasers_[x] = lasers_[numLasers_ - 1];
-        laserLines_[x] = laserLines_[numLasers_ - 1];
-      }
       for (int y = 0; y < numEventHandlers_; y++) {
         eventHandlers_[y]->handleLaserDestroyed(laser, gameTime);
       }
-      delete laser;
-      delete laserLine;
-      numLasers_--;
+      removeLaser(x);
       x--;
     }
   }
-  for (int x = 0; x < numShips; x++) {
-    delete laserHits[x];
+  if (profiler_ != 0) {
+    profileTime = profiler_->record(PROFILE_LASERS, -1, profileTime);
   }
-  delete laserHits;
 
   // Move torpedoes and check for collisions.
   for (int x = 0; x < numShips; x++) {
     Ship *ship = ships[x];
-    wasAlive[x] = ship->alive;
-  }
-  bool **torpedoHits = new bool*[numShips];
-  for (int x = 0; x < numShips; x++) {
-    torpedoHits[x] = new bool[numShips];
-    for (int y = 0; y < numShips; y++) {
-      torpedoHits[x][y] = false;
-    }
+    wasAlive_[x] = ship->alive;
   }
   for (int x = 0; x < numTorpedos_; x++) {
     Torpedo *torpedo = torpedos_[x];
@@ -1090,7 +1438,7 @@ void Stage::moveAndCheckCollisions(
               square(torpedo->x - ship->x) + square(torpedo->y - ship->y);
           if (distSq < square(TORPEDO_BLAST_RADIUS)) {
             int firingShipIndex = torpedo->shipIndex;
-            torpedoHits[firingShipIndex][y] = true;
+            setBit(torpedoHits_, (firingShipIndex * numShips) + y);
             ShipMoveData *shipDatum = &(shipData[y]);
             double blastDistance = sqrt(distSq);
             double blastFactor =
@@ -1128,87 +1476,276 @@ void Stage::moveAndCheckCollisions(
         eventHandlers_[z]->handleTorpedoExploded(torpedo, gameTime);
       }
 
-      if (numTorpedos_ > 1) {
-        torpedos_[x] = torpedos_[numTorpedos_ - 1];
-      }
-      delete torpedo;
-      numTorpedos_--;
+      removeTorpedo(x);
       x--;
     }
   }
+  logShipDestroys(ships, numShips, torpedoHits_, gameTime);
+  if (profiler_ != 0) {
+    profiler_->record(PROFILE_TORPEDOS, -1, profileTime);
+  }
+}
+
+// Logs kills and destroy events for ships that died since wasAlive_ was set,
+// crediting every ship that hit them, according to the given hits bitset.
+void Stage::logShipDestroys(
+    Ship **ships, int numShips, unsigned int *hits, int gameTime) {
   for (int x = 0; x < numShips; x++) {
     Ship *ship = ships[x];
-    if (wasAlive[x] && !ship->alive) {
+    if (wasAlive_[x] && !ship->alive) {
       int numDestroyers = 0;
       for (int y = 0; y < numShips; y++) {
-        if (torpedoHits[y][x]) {
-          numDestroyers++;
-        }
-      }
-      Ship **destroyers = new Ship*[numDestroyers];
-      int destroyerIndex = 0;
-      for (int y = 0; y < numShips; y++) {
-        if (torpedoHits[y][x]) {
-          destroyers[destroyerIndex++] = ships[y];
+        if (getBit(hits, (y * numShips) + x)) {
+          destroyers_[numDestroyers++] = ships[y];
         }
       }
 
-      for (int y = 0; y < numShips; y++) {
-        if (torpedoHits[y][x]) {
-          double destroyScore = 1.0 / numDestroyers;
-          if (ship->teamIndex == ships[y]->teamIndex) {
-            ships[y]->friendlyKills += destroyScore;
-          } else {
-            ships[y]->kills += destroyScore;
-          }
+      for (int y = 0; y < numDestroyers; y++) {
+        Ship *destroyer = destroyers_[y];
+        double destroyScore = 1.0 / numDestroyers;
+        if (ship->teamIndex == destroyer->teamIndex) {
+          destroyer->friendlyKills += destroyScore;
+        } else {
+          destroyer->kills += destroyScore;
         }
       }
+
       for (int z = 0; z < numEventHandlers_; z++) {
-        eventHandlers_[z]->handleShipDestroyed(ship, gameTime, destroyers,
+        eventHandlers_[z]->handleShipDestroyed(ship, gameTime, destroyers_,
                                                numDestroyers);
       }
-      delete destroyers;
     }
   }
+}
+
+void Stage::resetPhysicsScratch(int numShips) {
+  if (numScratchShips_ != numShips) {
+    deletePhysicsScratch();
+    numScratchShips_ = numShips;
+    shipData_ = new ShipMoveData[numShips];
+    shipCircles_ = new Circle2D[numShips];
+    nextShipCircles_ = new Circle2D[numShips];
+    for (int x = 0; x < numShips; x++) {
+      shipCircles_[x] = nextShipCircles_[x] = Circle2D(0, 0, SHIP_RADIUS);
+    }
+    int numBitWords = ((numShips * numShips) + 31) / 32;
+    shipCollisionBits_ = new unsigned int[numBitWords];
+    laserHits_ = new unsigned int[numBitWords];
+    torpedoHits_ = new unsigned int[numBitWords];
+    memset(shipCollisionBits_, 0, sizeof(unsigned int) * numBitWords);
+    wasAlive_ = new bool[numShips];
+    destroyers_ = new Ship*[numShips];
+    numShipCollisions_ = 0;
+    sweepShips_ = new int[numShips];
+    sweepMinX_ = new double[numShips];
+    sweepMaxX_ = new double[numShips];
+    for (int x = 0; x < numShips; x++) {
+      sweepShips_[x] = x;
+    }
+  }
+
+  for (int x = 0; x < numShipCollisions_; x++) {
+    clearBit(shipCollisionBits_, shipCollisionKeys_[x]);
+  }
+  numShipCollisions_ = 0;
+  int numBitWords = ((numShips * numShips) + 31) / 32;
+  memset(laserHits_, 0, sizeof(unsigned int) * numBitWords);
+  memset(torpedoHits_, 0, sizeof(unsigned int) * numBitWords);
+}
+
+void Stage::deletePhysicsScratch() {
+  if (shipData_ != 0) {
+    delete shipData_;
+    delete shipCircles_;
+    delete nextShipCircles_;
+    delete shipCollisionBits_;
+    delete laserHits_;
+    delete torpedoHits_;
+    delete wasAlive_;
+    delete destroyers_;
+    delete sweepShips_;
+    delete sweepMinX_;
+    delete sweepMaxX_;
+    shipData_ = 0;
+  }
+}
+
+void Stage::addShipCollision(int shipIndex1, int shipIndex2, int numShips) {
+  int key = (shipIndex1 * numShips) + shipIndex2;
+  if (!getBit(shipCollisionBits_, key)) {
+    setBit(shipCollisionBits_, key);
+    if (numShipCollisions_ >= maxShipCollisions_) {
+      int maxCollisions = std::max(64, maxShipCollisions_ * 2);
+      int *keys = new int[maxCollisions];
+      for (int x = 0; x < numShipCollisions_; x++) {
+        keys[x] = shipCollisionKeys_[x];
+      }
+      if (shipCollisionKeys_ != 0) {
+        delete shipCollisionKeys_;
+        delete shipCollisionData_;
+      }
+      shipCollisionKeys_ = keys;
+      shipCollisionData_ = new ShipCollisionData[maxCollisions];
+      maxShipCollisions_ = maxCollisions;
+    }
+    shipCollisionKeys_[numShipCollisions_++] = key;
+  }
+}
 
+// Only valid after the collision keys have been sorted.
+ShipCollisionData* Stage::getShipCollisionData(
+    int shipIndex1, int shipIndex2, int numShips) {
+  int key = (shipIndex1 * numShips) + shipIndex2;
+  int *keyPtr = std::lower_bound(
+      shipCollisionKeys_, shipCollisionKeys_ + numShipCollisions_, key);
+  return &(shipCollisionData_[keyPtr - shipCollisionKeys_]);
+}
+
+// Sweep and prune on x: keeps ships sorted by the left edge of the area they
+// cover this interval and returns every pair of live ships whose x extents
+// overlap, in both directions, sorted by (shipIndex1, shipIndex2). The sort
+// order carries over between intervals and ticks, so the insertion sort
+// usually has little to do.
+int Stage::findShipCollisionCandidates(
+    Ship **ships, ShipMoveData *shipData, int numShips, int intervals) {
   for (int x = 0; x < numShips; x++) {
-    delete torpedoHits[x];
+    if (ships[x]->alive) {
+      ShipMoveData *shipDatum = &(shipData[x]);
+      double x1 = shipDatum->shipCircle->h();
+      double x2 = (intervals == 0) ? shipDatum->nextShipCircle->h()
+          : x1 + (shipDatum->dx * intervals);
+      sweepMinX_[x] = std::min(x1, x2) - SHIP_RADIUS - SWEEP_MARGIN;
+      sweepMaxX_[x] = std::max(x1, x2) + SHIP_RADIUS + SWEEP_MARGIN;
+    } else {
+      sweepMinX_[x] = sweepMaxX_[x] = ships[x]->x;
+    }
+  }
+
+  for (int x = 1; x < numShips; x++) {
+    int shipIndex = sweepShips_[x];
+    double minX = sweepMinX_[shipIndex];
+    int y = x - 1;
+    while (y >= 0 && sweepMinX_[sweepShips_[y]] > minX) {
+      sweepShips_[y + 1] = sweepShips_[y];
+      y--;
+    }
+    sweepShips_[y + 1] = shipIndex;
   }
-  delete torpedoHits;
-  delete wasAlive;
 
+  int numPairs = 0;
   for (int x = 0; x < numShips; x++) {
-    ShipMoveData *shipDatum = &(shipData[x]);
-    if (shipDatum->initialized) {
-      delete shipDatum->shipCircle;
-      delete shipDatum->nextShipCircle;
-      for (int y = 0; y < numShips; y++) {
-        ShipCollisionData *collisionData = shipDatum->shipCollisionData[y];
-        if (collisionData != 0) {
-          delete collisionData;
+    int shipIndex1 = sweepShips_[x];
+    if (ships[shipIndex1]->alive) {
+      double maxX = sweepMaxX_[shipIndex1];
+      for (int y = x + 1;
+           y < numShips && sweepMinX_[sweepShips_[y]] <= maxX; y++) {
+        int shipIndex2 = sweepShips_[y];
+        if (ships[shipIndex2]->alive) {
+          addSweepPair(shipIndex1, shipIndex2, numShips, &numPairs);
+          addSweepPair(shipIndex2, shipIndex1, numShips, &numPairs);
         }
       }
-      delete shipDatum->shipCollisionData;
     }
   }
-  delete shipData;
+  std::sort(sweepPairs_, sweepPairs_ + numPairs);
+  return numPairs;
+}
+
+// Finds the walls a ship could hit anywhere along its path this tick. These
+// are a superset of the walls near it in each interval, in the same order.
+void Stage::findWallCandidates(
+    Ship *oldShip, ShipMoveData *shipDatum, int intervals) {
+  double x1 = oldShip->x;
+  double y1 = oldShip->y;
+  double x2 = x1 + (shipDatum->dx * intervals);
+  double y2 = y1 + (shipDatum->dy * intervals);
+  int numCandidates = wallLineIndex_->findCandidates(
+      std::min(x1, x2) - SHIP_RADIUS, std::min(y1, y2) - SHIP_RADIUS,
+      std::max(x1, x2) + SHIP_RADIUS, std::max(y1, y2) + SHIP_RADIUS);
+  int *candidates = wallLineIndex_->getCandidates();
+
+  if (numWallCandidates_ + numCandidates > maxWallCandidates_) {
+    int maxCandidates = std::max(256, maxWallCandidates_ * 2);
+    while (maxCandidates < numWallCandidates_ + numCandidates) {
+      maxCandidates *= 2;
+    }
+    int *wallCandidates = new int[maxCandidates];
+    for (int x = 0; x < numWallCandidates_; x++) {
+      wallCandidates[x] = wallCandidates_[x];
+    }
+    if (wallCandidates_ != 0) {
+      delete wallCandidates_;
+    }
+    wallCandidates_ = wallCandidates;
+    maxWallCandidates_ = maxCandidates;
+  }
+  shipDatum->firstWallCandidate = numWallCandidates_;
+  shipDatum->numWallCandidates = numCandidates;
+  for (int x = 0; x < numCandidates; x++) {
+    wallCandidates_[numWallCandidates_++] = candidates[x];
+  }
+}
+
+void Stage::addSweepPair(
+    int shipIndex1, int shipIndex2, int numShips, int *numPairs) {
+  if (*numPairs >= maxSweepPairs_) {
+    int maxPairs = std::max(64, maxSweepPairs_ * 2);
+    int *pairs = new int[maxPairs];
+    for (int x = 0; x < *numPairs; x++) {
+      pairs[x] = sweepPairs_[x];
+    }
+    if (sweepPairs_ != 0) {
+      delete sweepPairs_;
+    }
+    sweepPairs_ = pairs;
+    maxSweepPairs_ = maxPairs;
+  }
+  sweepPairs_[(*numPairs)++] = (shipIndex1 * numShips) + shipIndex2;
 }
 
 void Stage::checkLaserShipCollisions(Ship **ships, ShipMoveData *shipData,
-    int numShips, bool **laserHits, int numLasers, int gameTime,
+    int numShips, unsigned int *laserHits, int numLasers, int gameTime,
     bool firstTickLasers) {
+  // With lots of ships and lasers, bin the lasers into a grid so each ship
+  // only tests the lasers near it. Otherwise building the grid costs more than
+  // it saves, so just test every laser. Either way candidates are in laser
+  // order, so hits and events are in the same order as testing every laser.
+  int numIndexedLasers = 0;
+  for (int y = 0; y < numLasers; y++) {
+    if (!firstTickLasers || lasers_[y]->fireTime == gameTime) {
+      indexedLasers_[numIndexedLasers++] = y;
+    }
+  }
+  if (numIndexedLasers == 0) {
+    return;
+  }
+  bool useIndex = (numShips * numIndexedLasers >= MIN_INDEXED_LASER_CHECKS);
+  if (useIndex) {
+    laserIndex_->clear();
+    for (int c = 0; c < numIndexedLasers; c++) {
+      laserIndex_->addLine(laserLines_[indexedLasers_[c]]);
+    }
+    laserIndex_->build();
+  }
+
   for (int x = 0; x < numShips; x++) {
     Ship *ship = ships[x];
     ShipMoveData *shipDatum = &(shipData[x]);
     if (ship->alive) {
-      for (int y = 0; y < numLasers; y++) {
+      int numCandidates = numIndexedLasers;
+      int *candidates = 0;
+      if (useIndex) {
+        numCandidates = laserIndex_->findCandidates(shipDatum->shipCircle);
+        candidates = laserIndex_->getCandidates();
+      }
+      for (int c = 0; c < numCandidates; c++) {
+        int y = indexedLasers_[useIndex ? candidates[c] : c];
         Laser *laser = lasers_[y];
-        if (((firstTickLasers && laser->fireTime == gameTime
-                 && laser->shipIndex != ship->index)
-            || !firstTickLasers)
+        if (((firstTickLasers && laser->shipIndex != ship->index)
+                || !firstTickLasers)
             && shipDatum->shipCircle->intersects(laserLines_[y])) {
           int firingShipIndex = laser->shipIndex;
-          laserHits[firingShipIndex][x] = true;
+          setBit(laserHits, (firingShipIndex * numShips) + x);
           double laserDamage = (ship->energyEnabled ? LASER_DAMAGE : 0);
           double damageScore = (laserDamage / DEFAULT_ENERGY);
           if (ship->teamIndex == ships[firingShipIndex]->teamIndex) {
@@ -1248,6 +1785,17 @@ bool Stage::shipStopped(Ship *oldShip, Ship *ship) {
       && (oldShip->hitWall || oldShip->hitShip));
 }
 
+// When enabled (the default), ship movement finds the walls and ships each
+// ship could touch once per tick, instead of in every interval. Results are
+// the same either way.
+void Stage::setSweptCollisionChecks(bool enabled) {
+  sweptCollisionChecks_ = enabled;
+}
+
+bool Stage::getSweptCollisionChecks() {
+  return sweptCollisionChecks_;
+}
+
 void Stage::updateTeamVision(
     Team **teams, int numTeams, Ship** ships, int numShips, bool** teamVision) {
   for (int x = 0; x < numTeams; x++) {
@@ -1263,6 +1811,7 @@ void Stage::updateTeamVision(
     return;
   }
 
+  resetVisionCache(ships, numShips);
   for (int x = 0; x < numTeams; x++) {
     Team *team = teams[x];
     for (int y = 0; y < numShips; y++) {
@@ -1273,9 +1822,7 @@ void Stage::updateTeamVision(
           int teamShipIndex = team->firstShipIndex + z;
           Ship *teamShip = ships[teamShipIndex];
           if (teamShip->alive) {
-            Line2D visionLine(
-                teamShip->x, teamShip->y, visibleShip->x, visibleShip->y);
-            teamHasVision = hasVision(&visionLine);
+            teamHasVision = hasVision(ships, numShips, teamShipIndex, y);
           }
         }
         teamVision[x][y] = teamHasVision;
@@ -1284,21 +1831,81 @@ void Stage::updateTeamVision(
   }
 }
 
-bool Stage::hasVision(Line2D *visionLine) {
-  for (int z = 0; z < numInnerWallLines_; z++) {
-    Line2D* wallLine = innerWallLines_[z];
-    if (wallLine->intersects(visionLine)) {
-      return false;
+// Only tests the walls if either ship has moved since we last checked.
+bool Stage::hasVision(
+    Ship **ships, int numShips, int shipIndex1, int shipIndex2) {
+  int key = (shipIndex1 * numShips) + shipIndex2;
+  int pairTime = visionPairTimes_[key];
+  if (pairTime >= shipMoveTimes_[shipIndex1]
+      && pairTime >= shipMoveTimes_[shipIndex2]) {
+    return visionPairs_[key];
+  }
+
+  Ship *ship1 = ships[shipIndex1];
+  Ship *ship2 = ships[shipIndex2];
+  Line2D visionLine(ship1->x, ship1->y, ship2->x, ship2->y);
+  bool shipHasVision = visibilityGrid_->hasVision(&visionLine);
+  visionPairTimes_[key] = visionTime_;
+  visionPairs_[key] = shipHasVision;
+  return shipHasVision;
+}
+
+void Stage::resetVisionCache(Ship **ships, int numShips) {
+  if (numVisionShips_ != numShips) {
+    deleteVisionCache();
+    numVisionShips_ = numShips;
+    visionX_ = new double[numShips];
+    visionY_ = new double[numShips];
+    shipMoveTimes_ = new int[numShips];
+    visionPairTimes_ = new int[numShips * numShips];
+    visionPairs_ = new bool[numShips * numShips];
+    for (int x = 0; x < numShips; x++) {
+      visionX_[x] = ships[x]->x;
+      visionY_[x] = ships[x]->y;
+      shipMoveTimes_[x] = visionTime_;
+    }
+    for (int x = 0; x < numShips * numShips; x++) {
+      visionPairTimes_[x] = -1;
     }
   }
-  return true;
+
+  visionTime_++;
+  for (int x = 0; x < numShips; x++) {
+    Ship *ship = ships[x];
+    if (ship->x != visionX_[x] || ship->y != visionY_[x]) {
+      visionX_[x] = ship->x;
+      visionY_[x] = ship->y;
+      shipMoveTimes_[x] = visionTime_;
+    }
+  }
+}
+
+void Stage::deleteVisionCache() {
+  if (visionX_ != 0) {
+    delete visionX_;
+    delete visionY_;
+    delete shipMoveTimes_;
+    delete visionPairTimes_;
+    delete visionPairs_;
+    visionX_ = 0;
+  }
+}
+
+bool Stage::hasVision(Line2D *visionLine) {
+  int numCandidates = innerWallLineIndex_->findCandidates(visionLine);
+  return !innerWallLineBatch_->intersectsAny(
+      visionLine, innerWallLineIndex_->getCandidates(), numCandidates);
 }
 
 void Stage::updateShipPosition(Ship *ship, double x, double y) {
-  while (isShipInWall(x, y) || isShipInShip(ship->index, x, y)) {
-    x = limit(SHIP_RADIUS, x + (rand() % SHIP_SIZE) - SHIP_RADIUS,
+  for (int steps = 0;
+       isShipInWall(x, y) || isShipInShip(ship->index, x, y); steps++) {
+    if (steps == MAX_PLACEMENT_STEPS && findFreePosition(ship, &x, &y)) {
+      break;
+    }
+    x = limit(SHIP_RADIUS, x + random_->nextInt(SHIP_SIZE) - SHIP_RADIUS,
               width_ - SHIP_RADIUS);
-    y = limit(SHIP_RADIUS, y + (rand() % SHIP_SIZE) - SHIP_RADIUS,
+    y = limit(SHIP_RADIUS, y + random_->nextInt(SHIP_SIZE) - SHIP_RADIUS,
               height_ - SHIP_RADIUS);
   }
   ship->x = x;
@@ -1306,7 +1913,7 @@ void Stage::updateShipPosition(Ship *ship, double x, double y) {
 }
 
 int Stage::fireLaser(Ship *ship, double heading, int gameTime) {
-  if (ship->laserGunHeat > 0 || numLasers_ >= MAX_LASERS) {
+  if (ship->laserGunHeat > 0 || numLasers_ >= maxLasers_) {
     return 0;
   } else {
     double cosHeading = cos(heading);
@@ -1315,7 +1922,11 @@ int Stage::fireLaser(Ship *ship, double heading, int gameTime) {
     double laserY = ship->y + (sinHeading * LASER_SPEED);
     Line2D laserStartLine(ship->x, ship->y, laserX, laserY);
     if (hasVision(&laserStartLine)) {
-      Laser *laser = new Laser;
+      if (numFreeLasers_ == 0) {
+        growLaserPool();
+      }
+      int slot = freeLasers_[--numFreeLasers_];
+      Laser *laser = &(laserPool_[slot]);
       laser->id = nextLaserId_++;
       laser->shipIndex = ship->index;
       laser->fireTime = gameTime;
@@ -1329,9 +1940,10 @@ int Stage::fireLaser(Ship *ship, double heading, int gameTime) {
       laser->dx = dx;
       laser->dy = dy;
       laser->dead = false;
-      lasers_[numLasers_] = laser;
-      laserLines_[numLasers_++] = new Line2D(
+      laserLinePool_[slot] = Line2D(
           laser->x - laser->dx, laser->y - laser->dy, laser->x, laser->y);
+      lasers_[numLasers_] = laser;
+      laserLines_[numLasers_++] = &(laserLinePool_[slot]);
 
       for (int z = 0; z < numEventHandlers_; z++) {
         eventHandlers_[z]->handleShipFiredLaser(ship, laser);
@@ -1344,10 +1956,13 @@ int Stage::fireLaser(Ship *ship, double heading, int gameTime) {
 
 int Stage::fireTorpedo(
     Ship *ship, double heading, double distance, int gameTime) {
-  if (ship->torpedoGunHeat > 0 || numTorpedos_ >= MAX_TORPEDOS) {
+  if (ship->torpedoGunHeat > 0 || numTorpedos_ >= maxTorpedos_) {
     return 0;
   } else {
-    Torpedo *torpedo = new Torpedo;
+    if (numFreeTorpedos_ == 0) {
+      growTorpedoPool();
+    }
+    Torpedo *torpedo = &(torpedoPool_[freeTorpedos_[--numFreeTorpedos_]]);
     torpedo->id = nextTorpedoId_++;
     torpedo->shipIndex = ship->index;
     torpedo->fireTime = gameTime;
@@ -1390,6 +2005,117 @@ int Stage::getTorpedoCount() {
   return numTorpedos_;
 }
 
+void Stage::setMaxLasers(int maxLasers) {
+  maxLasers_ = std::max(std::max(1, laserPoolSize_), maxLasers);
+}
+
+int Stage::getMaxLasers() {
+  return maxLasers_;
+}
+
+void Stage::setMaxTorpedos(int maxTorpedos) {
+  maxTorpedos_ = std::max(std::max(1, torpedoPoolSize_), maxTorpedos);
+}
+
+int Stage::getMaxTorpedos() {
+  return maxTorpedos_;
+}
+
+// Doubles the laser pool, up to maxLasers_. Live lasers keep their slots, but
+// move to the new pool.
+void Stage::growLaserPool() {
+  int poolSize = std::min(maxLasers_, std::max(64, laserPoolSize_ * 2));
+  Laser *laserPool = new Laser[poolSize];
+  Line2D *laserLinePool = new Line2D[poolSize];
+  for (int x = 0; x < laserPoolSize_; x++) {
+    laserPool[x] = laserPool_[x];
+    laserLinePool[x] = laserLinePool_[x];
+  }
+  Laser **lasers = new Laser*[poolSize];
+  Line2D **laserLines = new Line2D*[poolSize];
+  for (int x = 0; x < numLasers_; x++) {
+    int slot = (int) (lasers_[x] - laserPool_);
+    lasers[x] = &(laserPool[slot]);
+    laserLines[x] = &(laserLinePool[slot]);
+  }
+  int *freeLasers = new int[poolSize];
+  for (int x = 0; x < numFreeLasers_; x++) {
+    freeLasers[x] = freeLasers_[x];
+  }
+  for (int x = poolSize - 1; x >= laserPoolSize_; x--) {
+    freeLasers[numFreeLasers_++] = x;
+  }
+
+  if (laserPool_ != 0) {
+    delete laserPool_;
+    delete laserLinePool_;
+    delete lasers_;
+    delete laserLines_;
+    delete freeLasers_;
+    delete indexedLasers_;
+    delete laserIndex_;
+  }
+  laserPool_ = laserPool;
+  laserLinePool_ = laserLinePool;
+  lasers_ = lasers;
+  laserLines_ = laserLines;
+  freeLasers_ = freeLasers;
+  indexedLasers_ = new int[poolSize];
+  laserIndex_ = new StageGeometryIndex(poolSize);
+  // A laser is shorter than a grid cell, so it's in at most 4 cells. Lasers
+  // reach up to a tick past the walls before they're removed, so that's as
+  // much of the stage as the grid has to cover.
+  laserIndex_->reserve(
+      (((width_ + (LASER_SPEED * 2)) / GEOMETRY_CELL_SIZE) + 1)
+          * (((height_ + (LASER_SPEED * 2)) / GEOMETRY_CELL_SIZE) + 1),
+      poolSize * 4);
+  laserPoolSize_ = poolSize;
+}
+
+void Stage::growTorpedoPool() {
+  int poolSize = std::min(maxTorpedos_, std::max(16, torpedoPoolSize_ * 2));
+  Torpedo *torpedoPool = new Torpedo[poolSize];
+  for (int x = 0; x < torpedoPoolSize_; x++) {
+    torpedoPool[x] = torpedoPool_[x];
+  }
+  Torpedo **torpedos = new Torpedo*[poolSize];
+  for (int x = 0; x < numTorpedos_; x++) {
+    torpedos[x] = &(torpedoPool[torpedos_[x] - torpedoPool_]);
+  }
+  int *freeTorpedos = new int[poolSize];
+  for (int x = 0; x < numFreeTorpedos_; x++) {
+    freeTorpedos[x] = freeTorpedos_[x];
+  }
+  for (int x = poolSize - 1; x >= torpedoPoolSize_; x--) {
+    freeTorpedos[numFreeTorpedos_++] = x;
+  }
+
+  if (torpedoPool_ != 0) {
+    delete torpedoPool_;
+    delete torpedos_;
+    delete freeTorpedos_;
+  }
+  torpedoPool_ = torpedoPool;
+  torpedos_ = torpedos;
+  freeTorpedos_ = freeTorpedos;
+  torpedoPoolSize_ = poolSize;
+}
+
+// Frees a laser's slot and moves the last laser into its place.
+void Stage::removeLaser(int laserIndex) {
+  freeLasers_[numFreeLasers_++] = (int) (lasers_[laserIndex] - laserPool_);
+  lasers_[laserIndex] = lasers_[numLasers_ - 1];
+  laserLines_[laserIndex] = laserLines_[numLasers_ - 1];
+  numLasers_--;
+}
+
+void Stage::removeTorpedo(int torpedoIndex) {
+  freeTorpedos_[numFreeTorpedos_++] =
+      (int) (torpedos_[torpedoIndex] - torpedoPool_);
+  torpedos_[torpedoIndex] = torpedos_[numTorpedos_ - 1];
+  numTorpedos_--;
+}
+
 void Stage::destroyShip(Ship *ship, int gameTime) {
   if (ship->alive) {
     ship->alive = false;
@@ -1414,15 +2140,14 @@ void Stage::reset(int time) {
     for (int y = 0; y < numEventHandlers_; y++) {
       eventHandlers_[y]->handleLaserDestroyed(lasers_[x], time);
     }
-    delete lasers_[x];
-    delete laserLines_[x];
+    freeLasers_[numFreeLasers_++] = (int) (lasers_[x] - laserPool_);
   }
   numLasers_ = 0;
   for (int x = 0; x < numTorpedos_; x++) {
     for (int y = 0; y < numEventHandlers_; y++) {
       eventHandlers_[y]->handleTorpedoDestroyed(torpedos_[x], time);
     }
-    delete torpedos_[x];
+    freeTorpedos_[numFreeTorpedos_++] = (int) (torpedos_[x] - torpedoPool_);
   }
   numTorpedos_ = 0;
   for (int x = 0; x < numStageTexts_; x++) {
@@ -1454,16 +2179,56 @@ Stage::~Stage() {
     delete stageTexts_[x]->text;
     delete stageTexts_[x];
   }
-  for (int x = 0; x < numLasers_; x++) {
-    delete lasers_[x];
-    delete laserLines_[x];
+  if (laserPool_ != 0) {
+    delete laserPool_;
+    delete laserLinePool_;
+    delete lasers_;
+    delete laserLines_;
+    delete freeLasers_;
+    delete indexedLasers_;
+    delete laserIndex_;
   }
-  for (int x = 0; x < numTorpedos_; x++) {
-    delete torpedos_[x];
+  if (torpedoPool_ != 0) {
+    delete torpedoPool_;
+    delete torpedos_;
+    delete freeTorpedos_;
   }
   for (int x = 0; x < numStageShips_; x++) {
     delete stageShips_[x];
   }
+  if (sweepPairs_ != 0) {
+    delete sweepPairs_;
+  }
+  if (wallCandidates_ != 0) {
+    delete wallCandidates_;
+  }
+  deletePhysicsScratch();
+  deleteVisionCache();
+  delete zoneLineBatch_;
+  if (wallLineBatch_ != 0) {
+    delete wallLineBatch_;
+    delete innerWallLineBatch_;
+  }
+  if (visibilityGrid_ != 0) {
+    delete visibilityGrid_;
+  }
+  if (freeSpaceMap_ != 0) {
+    delete freeSpaceMap_;
+  }
+  if (navigationGrid_ != 0) {
+    delete navigationGrid_;
+  }
+  delete random_;
+  if (shipCollisionKeys_ != 0) {
+    delete shipCollisionKeys_;
+    delete shipCollisionData_;
+  }
+  if (wallIndex_ != 0) {
+    delete wallIndex_;
+    delete wallLineIndex_;
+    delete innerWallLineIndex_;
+    delete zoneIndex_;
+  }
   delete ships_;
   delete fileManager_;
 }
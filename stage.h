@@ -30,12 +30,29 @@
 #include "zone.h"
 #include "eventhandler.h"
 #include "filemanager.h"
+#include "stagegeometryindex.h"
+#include "linebatch.h"
+#include "visibilitygrid.h"
+#include "freespacemap.h"
+#include "navigationgrid.h"
+#include "randomgenerator.h"
+#include "tickprofiler.h"
 
 // Check if we have vision to intersection points with walls to ensure that
 // we're not hitting the far side of a wall. Don't test all the way to
 // intersection point or it will intersect with wall itself.
 #define VERTEX_FUDGE        0.0001
 #define MAX_EVENT_HANDLERS  8
+// Padding on the x extents used to find candidate ship-ship collisions, so
+// rounding can't make us skip a pair that Circle2D::overlaps would report.
+#define SWEEP_MARGIN        0.01
+// Below this many ship-laser pairs, testing them all beats binning lasers.
+#define MIN_INDEXED_LASER_CHECKS  1024
+// Random steps to try when nudging a ship out of walls or other ships, before
+// just picking a free spot on the stage.
+#define MAX_PLACEMENT_STEPS 1000
+// Hash buckets for zone tags. A power of 2, at least twice MAX_ZONES.
+#define ZONE_TAG_BUCKETS    2048
 
 typedef struct {
   double angle;
@@ -59,8 +76,9 @@ typedef struct {
   double wallImpactAngle;
   Line2D *wallImpactLine;
   bool shipCollision;
-  ShipCollisionData** shipCollisionData;
   bool stopped;
+  int firstWallCandidate;
+  int numWallCandidates;
 } ShipMoveData;
 
 class Stage {
@@ -72,7 +90,33 @@ class Stage {
   Line2D* wallLines_[MAX_WALLS * 4];
   Line2D* innerWallLines_[MAX_WALLS * 4];
   Line2D* baseWallLines_[4];
+  StageGeometryIndex *wallIndex_;
+  StageGeometryIndex *wallLineIndex_;
+  StageGeometryIndex *innerWallLineIndex_;
+  StageGeometryIndex *laserIndex_;
+  LineBatch *wallLineBatch_;
+  LineBatch *innerWallLineBatch_;
+  LineBatch *zoneLineBatch_;
+  VisibilityGrid *visibilityGrid_;
+  FreeSpaceMap *freeSpaceMap_;
+  NavigationGrid *navigationGrid_;
+  RandomGenerator *random_;
+  TickProfiler *profiler_;
+  int* indexedLasers_;
   Zone* zones_[MAX_ZONES];
+
+  // Zones by tag and by location. Each distinct tag gets an id when its first
+  // zone is added, with untagged zones sharing the id of the empty tag. Tag
+  // ids are found through a hash table, and each tag's zones are listed
+  // together in tagZones_, in zone order.
+  StageGeometryIndex *zoneIndex_;
+  int zoneTagIds_[MAX_ZONES];
+  const char* zoneTags_[MAX_ZONES];
+  int numZoneTags_;
+  int zoneTagBuckets_[ZONE_TAG_BUCKETS];
+  int tagZoneStarts_[MAX_ZONES + 1];
+  int tagZones_[MAX_ZONES];
+
   Point2D* starts_[MAX_STARTS];
   char* stageShips_[MAX_STAGE_SHIPS]; // the ships loaded by the stage
   StageText* stageTexts_[MAX_STAGE_TEXTS];
@@ -80,11 +124,27 @@ class Stage {
   int numTeams_;
   Ship** ships_;
   int numShips_;
-  Laser* lasers_[MAX_LASERS];
-  Line2D* laserLines_[MAX_LASERS];
+
+  // Lasers and torpedoes are kept in pools that grow as needed, up to
+  // maxLasers_ and maxTorpedos_, with lists of the free slots so destroyed
+  // ones are reused. lasers_, laserLines_ and torpedos_ point to the live
+  // ones in the pools.
+  int maxLasers_, maxTorpedos_;
+  Laser* laserPool_;
+  Line2D* laserLinePool_;
+  int laserPoolSize_;
+  int* freeLasers_;
+  int numFreeLasers_;
+  Laser** lasers_;
+  Line2D** laserLines_;
   int numLasers_;
-  Torpedo* torpedos_[MAX_TORPEDOS];
+  Torpedo* torpedoPool_;
+  int torpedoPoolSize_;
+  int* freeTorpedos_;
+  int numFreeTorpedos_;
+  Torpedo** torpedos_;
   int numTorpedos_;
+
   EventHandler* eventHandlers_[MAX_EVENT_HANDLERS];
   int numEventHandlers_;
   FileManager *fileManager_;
@@ -97,10 +157,49 @@ class Stage {
   int numGfxCircles_;
   UserGfxText* gfxTexts_[MAX_USER_TEXTS];
   int numGfxTexts_;
+  int gfxExpiry_;
   bool userGfxDisabled_;
   int nextLaserId_;
   int nextTorpedoId_;
 
+  // Scratch space for moveAndCheckCollisions, sized for the number of ships
+  // and reused every tick so the physics step doesn't allocate. Collisions
+  // are stored as (shipIndex1 * numShips) + shipIndex2 keys, with parallel
+  // ShipCollisionData, and the pairs seen so far in a bitset.
+  int numScratchShips_;
+  ShipMoveData* shipData_;
+  Circle2D* shipCircles_;
+  Circle2D* nextShipCircles_;
+  unsigned int* shipCollisionBits_;
+  int* shipCollisionKeys_;
+  ShipCollisionData* shipCollisionData_;
+  int numShipCollisions_;
+  int maxShipCollisions_;
+  unsigned int* laserHits_;
+  unsigned int* torpedoHits_;
+  bool* wasAlive_;
+  Ship** destroyers_;
+  int* sweepShips_;
+  double* sweepMinX_;
+  double* sweepMaxX_;
+  int* sweepPairs_;
+  int maxSweepPairs_;
+  int* wallCandidates_;
+  int numWallCandidates_;
+  int maxWallCandidates_;
+  bool sweptCollisionChecks_;
+
+  // Vision between each pair of ships, kept until either of them moves. Each
+  // call to updateTeamVision is a new vision time, and each pair remembers
+  // when it was last tested.
+  int numVisionShips_;
+  int visionTime_;
+  double* visionX_;
+  double* visionY_;
+  int* shipMoveTimes_;
+  int* visionPairTimes_;
+  bool* visionPairs_;
+
   public:
     Stage(int width, int height);
     ~Stage();
@@ -124,7 +223,18 @@ class Stage {
     bool inAnyZone(Ship *ship);
     bool touchedZone(Ship *oldShip, Ship *ship, const char* tag);
     bool touchedAnyZone(Ship *oldShip, Ship *ship);
+    int touchedZones(Ship *oldShip, Ship *ship, int *zoneIndexes);
+    bool raycast(double x, double y, double angle, double maxDistance,
+                 double *hitX, double *hitY, double *hitDistance);
+    bool lineOfSight(double x1, double y1, double x2, double y2);
+    bool nearestWall(double x, double y, double *wallX, double *wallY,
+                     double *wallDistance);
+    int findPath(double x1, double y1, double x2, double y2,
+                 double *waypoints, int maxWaypoints);
+    double getPathDistance(double x1, double y1, double x2, double y2);
 
+    void setRandomSeed(unsigned int randomSeed);
+    void setProfiler(TickProfiler *profiler);
     int addStart(double x, double y);
     Point2D* getStart();
     int getStartCount();
@@ -180,41 +290,71 @@ class Stage {
         Team **teams, int numTeams, Ship **ships, int numShips);
     void moveAndCheckCollisions(
         Ship **oldShips, Ship **ships, int numShips, int gameTime);
+    void setSweptCollisionChecks(bool enabled);
+    bool getSweptCollisionChecks();
     void updateTeamVision(Team **teams, int numTeams, Ship **ships,
         int numShips, bool **teamVision);
     void updateShipPosition(Ship *ship, double x, double y);
+    bool findFreePosition(Ship *ship, double *x, double *y);
     int fireLaser(Ship *ship, double heading, int gameTime);
     int fireTorpedo(Ship *ship, double heading, double distance, int gameTime);
     Laser** getLasers();
     int getLaserCount();
     Torpedo** getTorpedos();
     int getTorpedoCount();
+    void setMaxLasers(int maxLasers);
+    int getMaxLasers();
+    void setMaxTorpedos(int maxTorpedos);
+    int getMaxTorpedos();
     void destroyShip(Ship *ship, int gameTime);
     int addEventHandler(EventHandler *eventHandler);
     void reset(int time);
   private:
+    void buildGeometryIndexes();
+    void growLaserPool();
+    void growTorpedoPool();
+    void removeLaser(int laserIndex);
+    void removeTorpedo(int torpedoIndex);
+    void buildZoneIndex();
+    int findZoneTagBucket(const char *tag);
+    int addZoneTag(const char *tag);
+    int findZoneTag(const char *tag);
+    int findTagZones(int tagId, int **zoneIndexes);
+    void resetPhysicsScratch(int numShips);
+    void deletePhysicsScratch();
+    void addShipCollision(int shipIndex1, int shipIndex2, int numShips);
+    ShipCollisionData* getShipCollisionData(
+        int shipIndex1, int shipIndex2, int numShips);
+    void logShipDestroys(Ship **ships, int numShips, unsigned int *hits,
+                         int gameTime);
+    int findShipCollisionCandidates(
+        Ship **ships, ShipMoveData *shipData, int numShips, int intervals);
+    void findWallCandidates(Ship *oldShip, ShipMoveData *shipData,
+                            int intervals);
+    void addSweepPair(int shipIndex1, int shipIndex2, int numShips,
+                      int *numPairs);
     void checkLaserShipCollisions(Ship **ships, ShipMoveData *shipData,
-        int numShips, bool **laserHits, int numLasers, int gameTime,
+        int numShips, unsigned int *laserHits, int numLasers, int gameTime,
         bool firstTickLasers);
     bool isShipInWall(double x, double y);
     bool isShipInShip(int shipIndex, double x, double y);
     void setSpeedAndHeading(Ship *oldShip, Ship *ship, ShipMoveData *shipData);
     bool shipStopped(Ship *ship1, Ship *ship2);
     bool hasVision(Line2D *visionLine);
+    bool hasVision(Ship **ships, int numShips, int shipIndex1, int shipIndex2);
+    void resetVisionCache(Ship **ships, int numShips);
+    void deleteVisionCache();
     bool inZone(Ship *ship, Zone *zone);
-    bool touchedZone(Ship *oldShip, Ship *ship, Zone *zone);
-    void clearStaleUserGfxRectangles(int gameTime);
-    void clearStaleUserGfxLines(int gameTime);
-    void clearStaleUserGfxCircles(int gameTime);
-    void clearStaleUserGfxTexts(int gameTime);
-    int clearStaleUserGfxRectangles(int gametime,
-        UserGfxRectangle** gfxRectangles, int numRectangles);
+    bool touchedZone(Ship *ship, Line2D *line, int zoneIndex);
+    void updateGfxExpiry(int *gfxExpiry, int startTime, int drawTicks);
+    int clearStaleUserGfxRectangles(int gameTime,
+        UserGfxRectangle** gfxRectangles, int numRectangles, int *gfxExpiry);
     int clearStaleUserGfxLines(int gameTime, UserGfxLine** gfxLines,
-                               int numLines);
+                               int numLines, int *gfxExpiry);
     int clearStaleUserGfxCircles(int gameTime, UserGfxCircle** gfxCircles,
-                                 int numCircles);
+                                 int numCircles, int *gfxExpiry);
     int clearStaleUserGfxTexts(int gameTime, UserGfxText** gfxTexts,
-                               int numTexts);
+                               int numTexts, int *gfxExpiry);
 };
 
 #endif
@@ -0,0 +1,360 @@
+/*
+  Copyright (C) 2015 - Voidious
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+*/
+
+#include <math.h>
+#include <float.h>
+#include <string.h>
+#include <algorithm>
+
+#include "bbutil.h"
+#include "stagegeometryindex.h"
+
+StageGeometryIndex::StageGeometryIndex(int maxItems) {
+  maxItems_ = maxItems;
+  numItems_ = 0;
+  itemLeft_ = new double[maxItems];
+  itemBottom_ = new double[maxItems];
+  itemRight_ = new double[maxItems];
+  itemTop_ = new double[maxItems];
+  cellSize_ = GEOMETRY_CELL_SIZE;
+  left_ = bottom_ = right_ = top_ = 0;
+  numColumns_ = numRows_ = 1;
+  cellStarts_ = 0;
+  cellItems_ = 0;
+  maxCells_ = maxCellItems_ = 0;
+  candidates_ = new int[maxItems];
+  numCandidates_ = 0;
+  numCellsVisited_ = 0;
+  itemStamps_ = new unsigned int[maxItems];
+  stamp_ = 0;
+  singleCell_ = false;
+  built_ = false;
+}
+
+int StageGeometryIndex::addLine(Line2D *line) {
+  return addBox(line->xMin(), line->yMin(), line->xMax(), line->yMax());
+}
+
+int StageGeometryIndex::addRectangle(Rectangle *rectangle) {
+  double left = rectangle->getLeft();
+  double bottom = rectangle->getBottom();
+  return addBox(left, bottom, left + rectangle->getWidth(),
+                bottom + rectangle->getHeight());
+}
+
+int StageGeometryIndex::addBox(
+    double left, double bottom, double right, double top) {
+  if (built_ || numItems_ >= maxItems_) {
+    return 0;
+  }
+  itemLeft_[numItems_] = left;
+  itemBottom_[numItems_] = bottom;
+  itemRight_[numItems_] = right;
+  itemTop_[numItems_] = top;
+  itemStamps_[numItems_] = 0;
+  numItems_++;
+  return 1;
+}
+
+// Can be called again after clear() and adding a new set of items, reusing
+// the grid's storage where possible.
+void StageGeometryIndex::build() {
+  left_ = bottom_ = right_ = top_ = 0;
+  if (numItems_ > 0) {
+    left_ = itemLeft_[0];
+    bottom_ = itemBottom_[0];
+    right_ = itemRight_[0];
+    top_ = itemTop_[0];
+    for (int x = 1; x < numItems_; x++) {
+      left_ = std::min(left_, itemLeft_[x]);
+      bottom_ = std::min(bottom_, itemBottom_[x]);
+      right_ = std::max(right_, itemRight_[x]);
+      top_ = std::max(top_, itemTop_[x]);
+    }
+  }
+
+  // Aim for a few cells per item. Smaller cells cull more walls, but long
+  // vision lines on big, open stages would walk through lots of empty cells.
+  double area = (right_ - left_) * (top_ - bottom_);
+  cellSize_ = std::max((double) GEOMETRY_CELL_SIZE,
+      sqrt(area / (std::max(numItems_, 1) * GEOMETRY_CELLS_PER_ITEM)));
+  if (numItems_ < MIN_INDEXED_GEOMETRY) {
+    cellSize_ = std::max(right_ - left_, top_ - bottom_) + 1;
+  }
+  do {
+    numColumns_ = ((int) floor((right_ - left_) / cellSize_)) + 1;
+    numRows_ = ((int) floor((top_ - bottom_) / cellSize_)) + 1;
+    if (numColumns_ * numRows_ > MAX_GEOMETRY_CELLS) {
+      cellSize_ *= 2;
+    }
+  } while (numColumns_ * numRows_ > MAX_GEOMETRY_CELLS);
+
+  int numCells = numColumns_ * numRows_;
+  reserve(numCells, 0);
+  for (int x = 0; x <= numCells; x++) {
+    cellStarts_[x] = 0;
+  }
+  int numEntries = 0;
+  for (int x = 0; x < numItems_; x++) {
+    int column1 = getColumn(itemLeft_[x]);
+    int column2 = getColumn(itemRight_[x]);
+    int row1 = getRow(itemBottom_[x]);
+    int row2 = getRow(itemTop_[x]);
+    for (int r = row1; r <= row2; r++) {
+      for (int c = column1; c <= column2; c++) {
+        cellStarts_[(r * numColumns_) + c]++;
+        numEntries++;
+      }
+    }
+  }
+  for (int x = 1; x < numCells; x++) {
+    cellStarts_[x] += cellStarts_[x - 1];
+  }
+  cellStarts_[numCells] = numEntries;
+
+  // Each cellStarts_ entry now marks the end of its cell. Filling the cells
+  // from the back in reverse id order leaves it at the start of the cell,
+  // with each cell's items in ascending id order.
+  reserve(numCells, numEntries);
+  for (int x = numItems_ - 1; x >= 0; x--) {
+    int column1 = getColumn(itemLeft_[x]);
+    int column2 = getColumn(itemRight_[x]);
+    int row1 = getRow(itemBottom_[x]);
+    int row2 = getRow(itemTop_[x]);
+    for (int r = row1; r <= row2; r++) {
+      for (int c = column1; c <= column2; c++) {
+        cellItems_[--cellStarts_[(r * numColumns_) + c]] = x;
+      }
+    }
+  }
+
+  // With only one cell, every query returns every item.
+  singleCell_ = (numCells == 1);
+  if (singleCell_) {
+    for (int x = 0; x < numItems_; x++) {
+      candidates_[x] = x;
+    }
+  }
+  built_ = true;
+}
+
+// Makes room for a grid of numCells cells holding numCellItems items in all,
+// so build() won't allocate for an index that fits. Storage that has to grow
+// loses what it held. It grows to at least double its old size, so an index
+// that's rebuilt every tick soon stops allocating even without this.
+void StageGeometryIndex::reserve(int numCells, int numCellItems) {
+  if (numCells + 1 > maxCells_) {
+    if (cellStarts_ != 0) {
+      delete cellStarts_;
+    }
+    maxCells_ = std::max(numCells + 1, maxCells_ * 2);
+    cellStarts_ = new int[maxCells_];
+  }
+  if (numCellItems > maxCellItems_) {
+    if (cellItems_ != 0) {
+      delete cellItems_;
+    }
+    maxCellItems_ = std::max(numCellItems, maxCellItems_ * 2);
+    cellItems_ = new int[maxCellItems_];
+  }
+}
+
+void StageGeometryIndex::clear() {
+  numItems_ = 0;
+  built_ = false;
+}
+
+int StageGeometryIndex::getItemCount() {
+  return numItems_;
+}
+
+int StageGeometryIndex::findCandidates(
+    double left, double bottom, double right, double top) {
+  if (singleCell_) {
+    return numItems_;
+  }
+  startQuery();
+  addCells(getColumn(left - GEOMETRY_QUERY_MARGIN),
+           getRow(bottom - GEOMETRY_QUERY_MARGIN),
+           getColumn(right + GEOMETRY_QUERY_MARGIN),
+           getRow(top + GEOMETRY_QUERY_MARGIN));
+  finishQuery();
+  return numCandidates_;
+}
+
+int StageGeometryIndex::findCandidates(Circle2D *circle) {
+  double r = circle->r();
+  return findCandidates(circle->h() - r, circle->k() - r, circle->h() + r,
+                        circle->k() + r);
+}
+
+int StageGeometryIndex::findCandidates(Line2D *line) {
+  if (singleCell_) {
+    return numItems_;
+  }
+  double x1 = line->x1();
+  double y1 = line->y1();
+  double x2 = line->x2();
+  double y2 = line->y2();
+  double margin = GEOMETRY_QUERY_MARGIN + getRoundingMargin(line);
+
+  startQuery();
+  if (abs(x2 - x1) >= abs(y2 - y1)) {
+    // Walk the columns the line spans, adding the rows it crosses in each.
+    double xMin = std::min(x1, x2);
+    double xMax = std::max(x1, x2);
+    double slope = (x1 == x2) ? 0 : (y2 - y1) / (x2 - x1);
+    int column1 = getColumn(xMin - margin);
+    int column2 = getColumn(xMax + margin);
+    for (int c = column1; c <= column2; c++) {
+      double slabLeft = (c == 0)
+          ? xMin : limit(xMin, left_ + (c * cellSize_), xMax);
+      double slabRight = (c == numColumns_ - 1)
+          ? xMax : limit(xMin, left_ + ((c + 1) * cellSize_), xMax);
+      double ya = y1 + ((slabLeft - x1) * slope);
+      double yb = y1 + ((slabRight - x1) * slope);
+      addCells(c, getRow(std::min(ya, yb) - margin),
+               c, getRow(std::max(ya, yb) + margin));
+    }
+  } else {
+    double yMin = std::min(y1, y2);
+    double yMax = std::max(y1, y2);
+    double slope = (x2 - x1) / (y2 - y1);
+    int row1 = getRow(yMin - margin);
+    int row2 = getRow(yMax + margin);
+    for (int r = row1; r <= row2; r++) {
+      double slabBottom = (r == 0)
+          ? yMin : limit(yMin, bottom_ + (r * cellSize_), yMax);
+      double slabTop = (r == numRows_ - 1)
+          ? yMax : limit(yMin, bottom_ + ((r + 1) * cellSize_), yMax);
+      double xa = x1 + ((slabBottom - y1) * slope);
+      double xb = x1 + ((slabTop - y1) * slope);
+      addCells(getColumn(std::min(xa, xb) - margin), r,
+               getColumn(std::max(xa, xb) + margin), r);
+    }
+  }
+  finishQuery();
+  return numCandidates_;
+}
+
+// Line2D::intersects works in slope/intercept form, so for steep or shallow
+// lines its answer can be off by a rounding error that scales with the slope.
+// This is a generous estimate of that error for a line tested against the
+// items in this index.
+double StageGeometryIndex::getRoundingMargin(Line2D *line) {
+  double x1 = line->x1();
+  double y1 = line->y1();
+  double x2 = line->x2();
+  double y2 = line->y2();
+  double scale = std::max(std::max(abs(left_), abs(right_)),
+                          std::max(abs(bottom_), abs(top_)));
+  scale = std::max(scale, std::max(std::max(abs(x1), abs(x2)),
+                                   std::max(abs(y1), abs(y2))));
+  double margin = 0;
+  if (line->m() != DBL_MAX) {
+    margin += GEOMETRY_ROUNDING_SCALE
+        * ((scale * (1 + abs(line->m()))) + abs(line->b()));
+  }
+  if (y1 != y2) {
+    margin += GEOMETRY_ROUNDING_SCALE * 2 * scale
+        * (1 + abs((x2 - x1) / (y2 - y1)));
+  }
+  return margin;
+}
+
+int* StageGeometryIndex::getCandidates() {
+  return candidates_;
+}
+
+int StageGeometryIndex::getColumn(double x) {
+  double column = floor((x - left_) / cellSize_);
+  if (column >= numColumns_) {
+    return numColumns_ - 1;
+  } else if (column >= 0) {
+    return (int) column;
+  }
+  return 0;
+}
+
+int StageGeometryIndex::getRow(double y) {
+  double row = floor((y - bottom_) / cellSize_);
+  if (row >= numRows_) {
+    return numRows_ - 1;
+  } else if (row >= 0) {
+    return (int) row;
+  }
+  return 0;
+}
+
+void StageGeometryIndex::startQuery() {
+  numCandidates_ = 0;
+  numCellsVisited_ = 0;
+  if (++stamp_ == 0) {
+    memset(itemStamps_, 0, sizeof(unsigned int) * maxItems_);
+    stamp_ = 1;
+  }
+}
+
+void StageGeometryIndex::addCell(int column, int row) {
+  int cell = (row * numColumns_) + column;
+  numCellsVisited_++;
+  int cellEnd = cellStarts_[cell + 1];
+  for (int x = cellStarts_[cell]; x < cellEnd; x++) {
+    int item = cellItems_[x];
+    if (itemStamps_[item] != stamp_) {
+      itemStamps_[item] = stamp_;
+      candidates_[numCandidates_++] = item;
+    }
+  }
+}
+
+void StageGeometryIndex::addCells(
+    int column1, int row1, int column2, int row2) {
+  if (!built_) {
+    return;
+  }
+  for (int r = row1; r <= row2; r++) {
+    for (int c = column1; c <= column2; c++) {
+      addCell(c, r);
+    }
+  }
+}
+
+void StageGeometryIndex::finishQuery() {
+  // A single cell's list is already in id order.
+  if (numCellsVisited_ > 1 && numCandidates_ > 1) {
+    std::sort(candidates_, candidates_ + numCandidates_);
+  }
+}
+
+StageGeometryIndex::~StageGeometryIndex() {
+  delete itemLeft_;
+  delete itemBottom_;
+  delete itemRight_;
+  delete itemTop_;
+  if (cellStarts_ != 0) {
+    delete cellStarts_;
+  }
+  if (cellItems_ != 0) {
+    delete cellItems_;
+  }
+  delete candidates_;
+  delete itemStamps_;
+}
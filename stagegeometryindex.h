@@ -0,0 +1,85 @@
+/*
+  Copyright (C) 2015 - Voidious
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+*/
+
+#ifndef STAGE_GEOMETRY_INDEX_H
+#define STAGE_GEOMETRY_INDEX_H
+
+#include "circle2d.h"
+#include "line2d.h"
+#include "rectangle.h"
+
+#define GEOMETRY_CELL_SIZE      32
+#define GEOMETRY_CELLS_PER_ITEM 4
+#define MAX_GEOMETRY_CELLS      65536
+#define MIN_INDEXED_GEOMETRY    32
+#define GEOMETRY_QUERY_MARGIN   1.0
+#define GEOMETRY_ROUNDING_SCALE 0.000000000001
+
+// A uniform grid over the static geometry of a stage (wall lines or wall
+// rectangles). Each item is bucketed into every cell its bounding box
+// overlaps. Queries return the ids of all items in the cells they touch, in
+// ascending id order, so callers can iterate candidates in the same order as
+// a full scan and get identical results. With only a few items, a full scan
+// is cheaper than walking the grid, so we just use a single cell.
+//
+// Queries are conservative: they may return items that don't intersect, but
+// never miss one that Line2D or Circle2D would report as intersecting. The
+// candidate buffer is reused by each query on the same index.
+class StageGeometryIndex {
+  int maxItems_, numItems_;
+  double *itemLeft_, *itemBottom_, *itemRight_, *itemTop_;
+  double cellSize_, left_, bottom_, right_, top_;
+  int numColumns_, numRows_;
+  int *cellStarts_;
+  int *cellItems_;
+  int maxCells_, maxCellItems_;
+  int *candidates_;
+  int numCandidates_;
+  int numCellsVisited_;
+  unsigned int *itemStamps_;
+  unsigned int stamp_;
+  bool singleCell_;
+  bool built_;
+
+  public:
+    StageGeometryIndex(int maxItems);
+    ~StageGeometryIndex();
+    int addLine(Line2D *line);
+    int addRectangle(Rectangle *rectangle);
+    int addBox(double left, double bottom, double right, double top);
+    void build();
+    void reserve(int numCells, int numCellItems);
+    void clear();
+    int getItemCount();
+    int findCandidates(double left, double bottom, double right, double top);
+    int findCandidates(Circle2D *circle);
+    int findCandidates(Line2D *line);
+    int* getCandidates();
+    double getRoundingMargin(Line2D *line);
+  private:
+    int getColumn(double x);
+    int getRow(double y);
+    void startQuery();
+    void addCell(int column, int row);
+    void addCells(int column1, int row1, int column2, int row2);
+    void finishQuery();
+};
+
+#endif
@@ -18,6 +18,7 @@
   3. This notice may not be removed or altered from any source distribution.
 */
 
+#include <limits.h>
 #include <string.h>
 #include <sstream>
 #include <algorithm>
@@ -302,6 +303,7 @@ char* StagePreview::savePreviewImage(sf::RenderWindow *window,
   teams[0]->numLines = 0;
   teams[0]->numCircles = 0;
   teams[0]->numTexts = 0;
+  teams[0]->gfxExpiry = INT_MAX;
   Ship **ships = new Ship*[1];
   Ship *ship = new Ship;
   ShipProperties *properties = new ShipProperties;
@@ -0,0 +1,125 @@
+/*
+  Copyright (C) 2015 - Voidious
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+*/
+
+
+// Times LineBatch::intersectsAny against a loop over Line2D::intersects, the
+// way Stage checked wall lines before LineBatch. Queries are short lines, like
+// a ship or laser moving for one tick, so most of them don't hit anything and
+// have to test every line.
+
+#include <stdio.h>
+#include "../bbutil.h"
+#include "../line2d.h"
+#include "../linebatch.h"
+#include "../randomgenerator.h"
+
+#define NUM_QUERIES     1000
+#define NUM_REPEATS     200
+#define FIELD_SIZE      1000
+#define QUERY_LENGTH    20
+
+double randomCoordinate(RandomGenerator *random, int limit) {
+  return random->nextInt(limit * 100) / 100.0;
+}
+
+// Half the lines are axis-aligned, like the edges of walls.
+Line2D* randomLine(RandomGenerator *random, int length) {
+  double x1 = randomCoordinate(random, FIELD_SIZE);
+  double y1 = randomCoordinate(random, FIELD_SIZE);
+  double x2 = x1 + randomCoordinate(random, length * 2) - length;
+  double y2 = y1 + randomCoordinate(random, length * 2) - length;
+  int shape = random->nextInt(4);
+  if (shape == 0 || x1 == x2) {
+    x2 = x1;
+    y2 = y1 + length;
+  } else if (shape == 1) {
+    y2 = y1;
+  }
+  return new Line2D(x1, y1, x2, y2);
+}
+
+double microsecondsSince(platformstl::performance_counter *counter) {
+  counter->stop();
+  return counter->get_microseconds();
+}
+
+void runBenchmark(int numLines, RandomGenerator *random) {
+  Line2D **lines = new Line2D*[numLines];
+  LineBatch batch(numLines);
+  for (int x = 0; x < numLines; x++) {
+    lines[x] = randomLine(random, FIELD_SIZE / 10);
+    batch.addLine(lines[x]);
+  }
+  Line2D **queries = new Line2D*[NUM_QUERIES];
+  for (int x = 0; x < NUM_QUERIES; x++) {
+    queries[x] = randomLine(random, QUERY_LENGTH);
+  }
+
+  platformstl::performance_counter counter;
+  int lineHits = 0;
+  counter.start();
+  for (int x = 0; x < NUM_REPEATS; x++) {
+    for (int y = 0; y < NUM_QUERIES; y++) {
+      for (int z = 0; z < numLines; z++) {
+        if (lines[z]->intersects(queries[y])) {
+          lineHits++;
+          break;
+        }
+      }
+    }
+  }
+  double lineTime = microsecondsSince(&counter);
+
+  int batchHits = 0;
+  counter.start();
+  for (int x = 0; x < NUM_REPEATS; x++) {
+    for (int y = 0; y < NUM_QUERIES; y++) {
+      if (batch.intersectsAny(queries[y])) {
+        batchHits++;
+      }
+    }
+  }
+  double batchTime = microsecondsSince(&counter);
+
+  double numCalls = NUM_REPEATS * NUM_QUERIES;
+  printf("%4d lines: Line2D %8.1f ns, LineBatch %8.1f ns, %.2fx%s\n",
+         numLines, lineTime * 1000 / numCalls, batchTime * 1000 / numCalls,
+         lineTime / batchTime,
+         (lineHits == batchHits) ? "" : " (results differ!)");
+
+  for (int x = 0; x < NUM_QUERIES; x++) {
+    delete queries[x];
+  }
+  delete[] queries;
+  for (int x = 0; x < numLines; x++) {
+    delete lines[x];
+  }
+  delete[] lines;
+}
+
+int main(int argc, char *argv[]) {
+  RandomGenerator random(42);
+  printf("Time per query, over %d queries x %d repeats:\n", NUM_QUERIES,
+         NUM_REPEATS);
+  runBenchmark(16, &random);
+  runBenchmark(64, &random);
+  runBenchmark(256, &random);
+  return 0;
+}
@@ -0,0 +1,172 @@
+/*
+  Copyright (C) 2015 - Voidious
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+*/
+
+
+// Checks that LineBatch::intersectsAny gives exactly the same answers as
+// Line2D::intersects, for whichever of the scalar, SSE2 or AVX2 kernels this
+// was compiled with. Most of the random lines have their endpoints on a small
+// grid, so vertical, horizontal, collinear and touching lines come up often.
+
+#include <stdio.h>
+#include "../line2d.h"
+#include "../linebatch.h"
+#include "../randomgenerator.h"
+
+#define MAX_TEST_LINES    16
+#define NUM_RANDOM_TESTS  50000
+#define MAX_MISMATCHES    10
+#define GRID_SIZE         4
+#define FIELD_SIZE        100
+
+int numChecks = 0;
+int numMismatches = 0;
+
+void checkResult(const char *method, Line2D *line, int index, bool expected,
+                 bool result) {
+  numChecks++;
+  if (result != expected) {
+    numMismatches++;
+    if (numMismatches <= MAX_MISMATCHES) {
+      printf("Mismatch in %s: (%.17g, %.17g) - (%.17g, %.17g), line %d, "
+             "expected %s\n", method, line->x1(), line->y1(), line->x2(),
+             line->y2(), index, expected ? "true" : "false");
+    }
+  }
+}
+
+// Compares every way of querying the batch to calling Line2D::intersects on
+// each of the lines.
+void checkLines(Line2D **lines, int numLines, Line2D *line,
+                RandomGenerator *random) {
+  LineBatch batch(numLines);
+  for (int x = 0; x < numLines; x++) {
+    batch.addLine(lines[x]);
+  }
+
+  bool expected[MAX_TEST_LINES];
+  bool anyExpected = false;
+  int indexes[MAX_TEST_LINES];
+  for (int x = 0; x < numLines; x++) {
+    expected[x] = lines[x]->intersects(line);
+    anyExpected = anyExpected || expected[x];
+
+    // One line at a time, through the plain loop and through a full block.
+    checkResult("range", line, x, expected[x],
+                batch.intersectsAny(line, x, 1));
+    for (int y = 0; y < MAX_TEST_LINES; y++) {
+      indexes[y] = x;
+    }
+    checkResult("indexes", line, x, expected[x],
+                batch.intersectsAny(line, indexes, MAX_TEST_LINES));
+  }
+  checkResult("all", line, -1, anyExpected, batch.intersectsAny(line));
+
+  int firstLine = random->nextInt(numLines);
+  int rangeLines = 1 + random->nextInt(numLines - firstLine);
+  bool rangeExpected = false;
+  for (int x = firstLine; x < firstLine + rangeLines; x++) {
+    rangeExpected = rangeExpected || expected[x];
+  }
+  checkResult("range", line, firstLine, rangeExpected,
+              batch.intersectsAny(line, firstLine, rangeLines));
+
+  int numIndexes = 1 + random->nextInt(MAX_TEST_LINES);
+  bool indexesExpected = false;
+  for (int x = 0; x < numIndexes; x++) {
+    indexes[x] = random->nextInt(numLines);
+    indexesExpected = indexesExpected || expected[indexes[x]];
+  }
+  checkResult("indexes", line, indexes[0], indexesExpected,
+              batch.intersectsAny(line, indexes, numIndexes));
+}
+
+double randomCoordinate(RandomGenerator *random, int style) {
+  if (style == 0) {
+    return random->nextInt(GRID_SIZE + 1);
+  } else if (style == 1) {
+    return random->nextInt(GRID_SIZE * 2 + 1) / 2.0;
+  }
+  return random->nextInt(FIELD_SIZE * 1000) / 1000.0;
+}
+
+// Line2D doesn't handle lines of zero length, so neither does this.
+Line2D* randomLine(RandomGenerator *random) {
+  int style = random->nextInt(3);
+  double x1, y1, x2, y2;
+  do {
+    x1 = randomCoordinate(random, style);
+    y1 = randomCoordinate(random, style);
+    x2 = randomCoordinate(random, style);
+    y2 = randomCoordinate(random, style);
+    int shape = random->nextInt(4);
+    if (shape == 0) {
+      x2 = x1;
+    } else if (shape == 1) {
+      y2 = y1;
+    }
+  } while (x1 == x2 && y1 == y2);
+  return new Line2D(x1, y1, x2, y2);
+}
+
+// Cases that have gone wrong before, or would be easy to get wrong: vertical
+// and horizontal lines meeting at or near their ends, collinear overlapping
+// lines, shared endpoints, and lines crossing at a corner of the other's
+// bounding box.
+double fixedLines[][4] = {
+  {0, 0, 0, 4}, {0, 2, 4, 2}, {0, 0, 4, 0}, {0, 4, 4, 4}, {4, 0, 4, 4},
+  {2, 0, 2, 4}, {2, 2, 2, 6}, {-2, 2, 0, 2}, {0, 0, 4, 4}, {4, 4, 8, 8},
+  {2, 2, 6, 6}, {0, 4, 4, 0}, {0, 1, 4, 3}, {1, 0, 3, 4}, {0, 0, 0, 2},
+  {0, 2, 0, 4}, {-1, 0, 1, 0}, {0, 0, 1, 3}, {1e-9, 0, 1e-9, 4},
+  {0, 1e-9, 4, 1e-9}, {0.1, 0.2, 0.3, 0.6}, {0.3, 0.6, 0.4, 0.8}
+};
+
+int main(int argc, char *argv[]) {
+  RandomGenerator random(42);
+  int numFixedLines = sizeof(fixedLines) / sizeof(fixedLines[0]);
+  Line2D *lines[MAX_TEST_LINES];
+  for (int x = 0; x < numFixedLines; x++) {
+    for (int y = 0; y < numFixedLines; y++) {
+      double *a = fixedLines[x];
+      double *b = fixedLines[y];
+      Line2D line1(a[0], a[1], a[2], a[3]);
+      Line2D line2(b[0], b[1], b[2], b[3]);
+      Line2D reversed(b[2], b[3], b[0], b[1]);
+      lines[0] = &line1;
+      checkLines(lines, 1, &line2, &random);
+      checkLines(lines, 1, &reversed, &random);
+    }
+  }
+
+  for (int x = 0; x < NUM_RANDOM_TESTS; x++) {
+    int numLines = 1 + random.nextInt(MAX_TEST_LINES);
+    for (int y = 0; y < numLines; y++) {
+      lines[y] = randomLine(&random);
+    }
+    Line2D *line = randomLine(&random);
+    checkLines(lines, numLines, line, &random);
+    delete line;
+    for (int y = 0; y < numLines; y++) {
+      delete lines[y];
+    }
+  }
+
+  printf("LineBatch: %d checks, %d mismatches\n", numChecks, numMismatches);
+  return (numMismatches == 0) ? 0 : 1;
+}
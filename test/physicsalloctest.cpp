@@ -0,0 +1,152 @@
+/*
+  Copyright (C) 2015 - Voidious
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+*/
+
+
+// Checks that Stage::moveAndCheckCollisions doesn't allocate once it's warmed
+// up. Replaces the global operator new and delete with versions that count
+// calls, then runs a crowded stage with walls, lasers, torpedoes and lots of
+// ship-ship and ship-wall collisions. The warm-up ticks let the buffers that
+// grow as needed (like the lists of collision candidates) reach full size.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+#include "../bbutil.h"
+#include "../stage.h"
+#include "../randomgenerator.h"
+
+#define NUM_TEST_SHIPS    64
+#define STAGE_SIZE        600
+#define WARMUP_TICKS      200
+#define TEST_TICKS        2000
+#define FIRE_CHANCE       2
+
+int numAllocations = 0;
+int numFrees = 0;
+
+void* operator new(size_t size) {
+  numAllocations++;
+  void *p = malloc(size == 0 ? 1 : size);
+  if (p == 0) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void* operator new[](size_t size) {
+  return operator new(size);
+}
+
+void operator delete(void *p) throw() {
+  if (p != 0) {
+    numFrees++;
+    free(p);
+  }
+}
+
+void operator delete[](void *p) throw() {
+  operator delete(p);
+}
+
+void operator delete(void *p, size_t size) throw() {
+  operator delete(p);
+}
+
+void operator delete[](void *p, size_t size) throw() {
+  operator delete(p);
+}
+
+// A laser fired from closer to the edge of the stage than this can start out
+// past the edge, then it never hits a wall and has to be left out of the test
+// so the number of lasers stays steady.
+bool awayFromEdges(Ship *ship) {
+  return ship->x > LASER_SPEED && ship->y > LASER_SPEED
+      && ship->x < STAGE_SIZE - LASER_SPEED
+      && ship->y < STAGE_SIZE - LASER_SPEED;
+}
+
+// Fires some lasers and torpedoes and picks new thrust for each ship, like the
+// ship programs would between physics steps. Ships are kept alive so the
+// number of collisions stays about the same.
+void updateShips(Stage *stage, Ship **ships, Ship **oldShips, int gameTime,
+                 RandomGenerator *random) {
+  for (int x = 0; x < NUM_TEST_SHIPS; x++) {
+    Ship *ship = ships[x];
+    ship->energy = DEFAULT_ENERGY;
+    ship->alive = true;
+    ship->laserGunHeat = ship->torpedoGunHeat = 0;
+    ship->thrusterAngle = random->nextInt(360) * M_PI / 180;
+    ship->thrusterForce = random->nextInt(100) / 100.0;
+    *(oldShips[x]) = *ship;
+    if (random->nextInt(FIRE_CHANCE) == 0 && awayFromEdges(ship)) {
+      double heading = (random->nextInt(360) + 0.5) * M_PI / 180;
+      if (random->nextInt(2) == 0) {
+        stage->fireLaser(ship, heading, gameTime);
+      } else {
+        stage->fireTorpedo(ship, heading, random->nextInt(STAGE_SIZE) + 1,
+                           gameTime);
+      }
+    }
+  }
+}
+
+int main(int argc, char *argv[]) {
+  Stage *stage = new Stage(STAGE_SIZE, STAGE_SIZE);
+  stage->setRandomSeed(42);
+  stage->addWall(100, 100, 50, 200, true);
+  stage->addWall(250, 150, 100, 30, true);
+  stage->buildBaseWalls();
+
+  RandomGenerator random(42);
+  ShipProperties properties;
+  memset(&properties, 0, sizeof(ShipProperties));
+  Ship **ships = new Ship*[NUM_TEST_SHIPS];
+  Ship **oldShips = new Ship*[NUM_TEST_SHIPS];
+  for (int x = 0; x < NUM_TEST_SHIPS; x++) {
+    Ship *ship = ships[x] = new Ship;
+    memset(ship, 0, sizeof(Ship));
+    ship->index = x;
+    ship->teamIndex = x;
+    ship->properties = &properties;
+    ship->laserEnabled = ship->torpedoEnabled = true;
+    ship->thrusterEnabled = ship->energyEnabled = true;
+    stage->findFreePosition(ship, &(ship->x), &(ship->y));
+    oldShips[x] = new Ship;
+  }
+  stage->setTeamsAndShips(0, 0, ships, NUM_TEST_SHIPS);
+
+  int stepAllocations = 0;
+  int stepFrees = 0;
+  for (int x = 0; x < WARMUP_TICKS + TEST_TICKS; x++) {
+    updateShips(stage, ships, oldShips, x, &random);
+    int allocations = numAllocations;
+    int frees = numFrees;
+    stage->moveAndCheckCollisions(oldShips, ships, NUM_TEST_SHIPS, x);
+    if (x >= WARMUP_TICKS) {
+      stepAllocations += numAllocations - allocations;
+      stepFrees += numFrees - frees;
+    }
+  }
+
+  printf("Physics step: %d ticks, %d allocations, %d frees\n", TEST_TICKS,
+         stepAllocations, stepFrees);
+  return (stepAllocations == 0 && stepFrees == 0) ? 0 : 1;
+}
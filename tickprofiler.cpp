@@ -0,0 +1,225 @@
+/*
+  Copyright (C) 2015 - Voidious
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+*/
+
+
+#include <stdio.h>
+#include <string.h>
+#include <fstream>
+#include <iomanip>
+#include <algorithm>
+#include "bbutil.h"
+#include "tickprofiler.h"
+
+#ifdef __WIN32__
+#include <platformstl/performance/performance_counter.hpp>
+#else
+#include <time.h>
+#endif
+
+const char* PROFILE_PHASE_NAMES[NUM_PROFILE_PHASES] = {
+  "team vision", "tick setup", "sensors", "sensor cleanup", "team run",
+  "ship moves", "ship collisions", "lasers", "torpedos", "replay",
+  "stage run"
+};
+
+TickProfiler::TickProfiler() {
+  events_ = new ProfileEvent[PROFILE_EVENTS];
+  nextEvent_ = numEvents_ = 0;
+  epoch_ = getClockTime();
+  gameTime_ = 0;
+  numTicks_ = 0;
+  for (int x = 0; x < NUM_PROFILE_PHASES; x++) {
+    phaseTimes_[x] = phaseMaxTimes_[x] = 0;
+    phaseCounts_[x] = 0;
+  }
+  teamStats_ = 0;
+  numTeamStats_ = 0;
+}
+
+TickProfiler::~TickProfiler() {
+  delete events_;
+  if (teamStats_ != 0) {
+    delete teamStats_;
+  }
+}
+
+unsigned long long TickProfiler::getClockTime() {
+#ifdef __WIN32__
+  return platformstl::performance_counter::get_microseconds(
+      0, platformstl::performance_counter::get_epoch()) * 1000;
+#else
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return (((unsigned long long) time.tv_sec) * 1000000000) + time.tv_nsec;
+#endif
+}
+
+unsigned long long TickProfiler::now() {
+  return getClockTime() - epoch_;
+}
+
+void TickProfiler::startTick(int gameTime) {
+  gameTime_ = gameTime;
+  numTicks_++;
+}
+
+// Records a phase that started at start and ends now. Returns the end time,
+// so the next phase can start from it.
+unsigned long long TickProfiler::record(
+    int phase, int team, unsigned long long start) {
+  unsigned long long end = now();
+  record(phase, team, start, end);
+  return end;
+}
+
+void TickProfiler::record(int phase, int team, unsigned long long start,
+                          unsigned long long end) {
+  unsigned long long duration = end - start;
+  ProfileEvent *event = &(events_[nextEvent_]);
+  event->phase = phase;
+  event->team = team;
+  event->gameTime = gameTime_;
+  event->start = start;
+  event->duration = duration;
+  nextEvent_ = (nextEvent_ + 1) % PROFILE_EVENTS;
+  numEvents_ = std::min(numEvents_ + 1, PROFILE_EVENTS);
+
+  phaseTimes_[phase] += duration;
+  phaseMaxTimes_[phase] = std::max(phaseMaxTimes_[phase], duration);
+  phaseCounts_[phase]++;
+
+  if (team >= 0) {
+    if (team >= numTeamStats_) {
+      int numTeamStats = std::max(team + 1, numTeamStats_ * 2);
+      ProfileTeamStats *teamStats = new ProfileTeamStats[numTeamStats];
+      for (int x = 0; x < numTeamStats; x++) {
+        if (x < numTeamStats_) {
+          teamStats[x] = teamStats_[x];
+        } else {
+          teamStats[x].sensorsTime = teamStats[x].runTime = 0;
+          teamStats[x].runs = 0;
+        }
+      }
+      if (teamStats_ != 0) {
+        delete teamStats_;
+      }
+      teamStats_ = teamStats;
+      numTeamStats_ = numTeamStats;
+    }
+    if (phase == PROFILE_SENSORS || phase == PROFILE_SENSOR_CLEANUP) {
+      teamStats_[team].sensorsTime += duration;
+    } else if (phase == PROFILE_TEAM_RUN) {
+      teamStats_[team].runTime += duration;
+      teamStats_[team].runs++;
+    }
+  }
+}
+
+// A table of the total, mean and max time of each phase, and the time spent
+// building and cleaning up sensors and running each team.
+void TickProfiler::writeSummary(std::ostream &out, Team **teams,
+                                int numTeams) {
+  unsigned long long totalTime = 0;
+  for (int x = 0; x < NUM_PROFILE_PHASES; x++) {
+    totalTime += phaseTimes_[x];
+  }
+  out << "Tick profile: " << numTicks_ << " ticks, "
+      << std::fixed << std::setprecision(3) << (totalTime / 1000000.0)
+      << " ms" << std::endl;
+  out << "  " << std::left << std::setw(18) << "phase" << std::right
+      << std::setw(10) << "calls" << std::setw(12) << "total ms"
+      << std::setw(12) << "mean us" << std::setw(12) << "max us"
+      << std::setw(8) << "%" << std::endl;
+  for (int x = 0; x < NUM_PROFILE_PHASES; x++) {
+    unsigned int count = phaseCounts_[x];
+    out << "  " << std::left << std::setw(18) << PROFILE_PHASE_NAMES[x]
+        << std::right << std::setw(10) << count << std::setprecision(3)
+        << std::setw(12) << (phaseTimes_[x] / 1000000.0)
+        << std::setw(12)
+        << (count == 0 ? 0 : (phaseTimes_[x] / 1000.0) / count)
+        << std::setw(12) << (phaseMaxTimes_[x] / 1000.0)
+        << std::setprecision(1) << std::setw(8)
+        << (totalTime == 0 ? 0 : (phaseTimes_[x] * 100.0) / totalTime)
+        << std::endl;
+  }
+
+  out << "  " << std::left << std::setw(30) << "team" << std::right
+      << std::setw(10) << "runs" << std::setw(12) << "sensors ms"
+      << std::setw(12) << "run ms" << std::endl;
+  for (int x = 0; x < std::min(numTeams, numTeamStats_); x++) {
+    ProfileTeamStats *stats = &(teamStats_[x]);
+    out << "  " << std::left << std::setw(30) << teams[x]->name << std::right
+        << std::setw(10) << stats->runs << std::setprecision(3)
+        << std::setw(12) << (stats->sensorsTime / 1000000.0)
+        << std::setw(12) << (stats->runTime / 1000000.0) << std::endl;
+  }
+  out.unsetf(std::ios::floatfield);
+}
+
+// Writes the events in the ring buffer in the Chrome trace event format. The
+// engine's phases are on one track and each team's on its own.
+bool TickProfiler::writeChromeTrace(const char *filename, Team **teams,
+                                    int numTeams) {
+  std::ofstream out(filename);
+  if (!out.is_open()) {
+    return false;
+  }
+  out << "{\"traceEvents\":[" << std::endl;
+  out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,"
+      << "\"args\":{\"name\":\"engine\"}}";
+  for (int x = 0; x < numTeams; x++) {
+    out << "," << std::endl
+        << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":"
+        << (x + 1) << ",\"args\":{\"name\":";
+    writeJsonString(out, teams[x]->name);
+    out << "}}";
+  }
+
+  out << std::fixed << std::setprecision(3);
+  int firstEvent = (numEvents_ < PROFILE_EVENTS) ? 0 : nextEvent_;
+  for (int x = 0; x < numEvents_; x++) {
+    ProfileEvent *event = &(events_[(firstEvent + x) % PROFILE_EVENTS]);
+    out << "," << std::endl << "{\"name\":\""
+        << PROFILE_PHASE_NAMES[event->phase]
+        << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << (event->team + 1)
+        << ",\"ts\":" << (event->start / 1000.0)
+        << ",\"dur\":" << (event->duration / 1000.0)
+        << ",\"args\":{\"tick\":" << event->gameTime << "}}";
+  }
+  out << std::endl << "]}" << std::endl;
+  out.close();
+  return !out.fail();
+}
+
+void TickProfiler::writeJsonString(std::ostream &out, const char *s) {
+  out << "\"";
+  for (const char *c = s; *c != '\0'; c++) {
+    if (*c == '"' || *c == '\\') {
+      out << "\\" << *c;
+    } else if ((unsigned char) *c < 0x20) {
+      char escaped[8];
+      sprintf(escaped, "\\u%04x", (unsigned char) *c);
+      out << escaped;
+    } else {
+      out << *c;
+    }
+  }
+  out << "\"";
+}
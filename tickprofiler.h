@@ -0,0 +1,92 @@
+/*
+  Copyright (C) 2015 - Voidious
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+*/
+
+
+#ifndef TICK_PROFILER_H
+#define TICK_PROFILER_H
+
+#include <ostream>
+#include "bbutil.h"
+
+#define PROFILE_TEAM_VISION       0
+#define PROFILE_TICK_SETUP        1
+#define PROFILE_SENSORS           2
+#define PROFILE_SENSOR_CLEANUP    3
+#define PROFILE_TEAM_RUN          4
+#define PROFILE_SHIP_MOVES        5
+#define PROFILE_SHIP_COLLISIONS   6
+#define PROFILE_LASERS            7
+#define PROFILE_TORPEDOS          8
+#define PROFILE_REPLAY            9
+#define PROFILE_STAGE_RUN        10
+#define NUM_PROFILE_PHASES       11
+
+#define PROFILE_EVENTS        65536 // most recent events kept for traces
+
+typedef struct {
+  short phase;
+  short team;
+  int gameTime;
+  unsigned long long start;
+  unsigned long long duration;
+} ProfileEvent;
+
+typedef struct {
+  unsigned long long sensorsTime;
+  unsigned long long runTime;
+  unsigned int runs;
+} ProfileTeamStats;
+
+// Times the phases of each tick. Every phase is added to running totals for
+// the summary, and the most recent PROFILE_EVENTS are kept in a ring buffer
+// for a Chrome trace (chrome://tracing). Times are in nanoseconds from when
+// the profiler was created. Team is -1 for phases that aren't for one team.
+//
+// Only used from the engine's main thread. Team 'run' calls on team run
+// threads are timed there and recorded after the threads are done.
+class TickProfiler {
+  ProfileEvent *events_;
+  int nextEvent_;
+  int numEvents_;
+  unsigned long long epoch_;
+  int gameTime_;
+  int numTicks_;
+  unsigned long long phaseTimes_[NUM_PROFILE_PHASES];
+  unsigned long long phaseMaxTimes_[NUM_PROFILE_PHASES];
+  unsigned int phaseCounts_[NUM_PROFILE_PHASES];
+  ProfileTeamStats *teamStats_;
+  int numTeamStats_;
+
+  public:
+    TickProfiler();
+    ~TickProfiler();
+    unsigned long long now();
+    void startTick(int gameTime);
+    unsigned long long record(int phase, int team, unsigned long long start);
+    void record(int phase, int team, unsigned long long start,
+                unsigned long long end);
+    void writeSummary(std::ostream &out, Team **teams, int numTeams);
+    bool writeChromeTrace(const char *filename, Team **teams, int numTeams);
+  private:
+    unsigned long long getClockTime();
+    void writeJsonString(std::ostream &out, const char *s);
+};
+
+#endif
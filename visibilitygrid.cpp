@@ -0,0 +1,301 @@
+/*
+  Copyright (C) 2015 - Voidious
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+*/
+
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+
+#include "visibilitygrid.h"
+
+VisibilityGrid::VisibilityGrid(int width, int height,
+    StageGeometryIndex *wallLineIndex, Line2D **wallLines,
+    LineBatch *wallLineBatch) {
+  wallLineIndex_ = wallLineIndex;
+  wallLines_ = wallLines;
+  wallLineBatch_ = wallLineBatch;
+  width_ = width;
+  height_ = height;
+  cellSize_ = std::max((double) VISION_CELL_SIZE,
+                       sqrt((width_ * height_) / MAX_VISION_CELLS));
+  do {
+    numColumns_ = std::max(1, (int) ceil(width_ / cellSize_));
+    numRows_ = std::max(1, (int) ceil(height_ / cellSize_));
+    if (numColumns_ * numRows_ > MAX_VISION_CELLS) {
+      cellSize_ *= 1.25;
+    }
+  } while (numColumns_ * numRows_ > MAX_VISION_CELLS);
+  numCells_ = numColumns_ * numRows_;
+  cellPairs_ = new unsigned char[numCells_ * numCells_];
+  memset(cellPairs_, VISION_UNKNOWN, numCells_ * numCells_);
+  cellPairWallStarts_ = new int[numCells_ * numCells_];
+  cellPairWalls_ = 0;
+  numCellPairWalls_ = maxCellPairWalls_ = 0;
+  walls_ = new int[std::max(1, wallLineIndex->getItemCount())];
+}
+
+bool VisibilityGrid::hasVision(Line2D *line) {
+  int cell1 = getCell(line->x1(), line->y1());
+  int cell2 = getCell(line->x2(), line->y2());
+  if (cell1 == -1 || cell2 == -1
+      || wallLineIndex_->getRoundingMargin(line) > VISION_MARGIN / 2) {
+    int numCandidates = wallLineIndex_->findCandidates(line);
+    return !wallLineBatch_->intersectsAny(
+        line, wallLineIndex_->getCandidates(), numCandidates);
+  }
+
+  int cellPair = (cell1 * numCells_) + cell2;
+  if (cellPairs_[cellPair] == VISION_UNKNOWN) {
+    int vision = findCellPairVision(cell1, cell2);
+    int inverseCellPair = (cell2 * numCells_) + cell1;
+    cellPairs_[inverseCellPair] = vision;
+    cellPairWallStarts_[inverseCellPair] = cellPairWallStarts_[cellPair];
+    cellPairs_[cellPair] = vision;
+  }
+
+  int vision = cellPairs_[cellPair];
+  if (vision == VISION_CLEAR) {
+    return true;
+  } else if (vision == VISION_BLOCKED) {
+    return false;
+  }
+  int wallStart = cellPairWallStarts_[cellPair];
+  if (wallStart == -1) {
+    int numCandidates = wallLineIndex_->findCandidates(line);
+    return !wallLineBatch_->intersectsAny(
+        line, wallLineIndex_->getCandidates(), numCandidates);
+  }
+  return !wallLineBatch_->intersectsAny(
+      line, &(cellPairWalls_[wallStart + 1]), cellPairWalls_[wallStart]);
+}
+
+int VisibilityGrid::getCell(double x, double y) {
+  if (x < 0 || x > width_ || y < 0 || y > height_) {
+    return -1;
+  }
+  int column = std::min((int) (x / cellSize_), numColumns_ - 1);
+  int row = std::min((int) (y / cellSize_), numRows_ - 1);
+  return (row * numColumns_) + column;
+}
+
+void VisibilityGrid::getCellBox(int cell, double *box) {
+  int column = cell % numColumns_;
+  int row = cell / numColumns_;
+  box[0] = (column * cellSize_) - VISION_MARGIN;
+  box[1] = (row * cellSize_) - VISION_MARGIN;
+  box[2] = ((column + 1) * cellSize_) + VISION_MARGIN;
+  box[3] = ((row + 1) * cellSize_) + VISION_MARGIN;
+}
+
+int VisibilityGrid::findCellPairVision(int cell1, int cell2) {
+  double box1[4], box2[4];
+  getCellBox(cell1, box1);
+  getCellBox(cell2, box2);
+
+  // Every line between the two cells lies in the convex hull of their
+  // corners. Find the hull with a monotone chain, counter-clockwise.
+  double pointX[8], pointY[8];
+  int order[8];
+  for (int x = 0; x < 8; x++) {
+    double *box = (x < 4) ? box1 : box2;
+    pointX[x] = box[(x & 1) ? 2 : 0];
+    pointY[x] = box[(x & 2) ? 3 : 1];
+    order[x] = x;
+  }
+  for (int x = 1; x < 8; x++) {
+    int point = order[x];
+    int y = x;
+    for (; y > 0 && (pointX[order[y - 1]] > pointX[point]
+        || (pointX[order[y - 1]] == pointX[point]
+            && pointY[order[y - 1]] > pointY[point])); y--) {
+      order[y] = order[y - 1];
+    }
+    order[y] = point;
+  }
+  numHullPoints_ = 0;
+  for (int pass = 0; pass < 2; pass++) {
+    int start = numHullPoints_;
+    for (int z = 0; z < 8; z++) {
+      int point = order[pass == 0 ? z : 7 - z];
+      while (numHullPoints_ >= start + 2
+          && ((hullX_[numHullPoints_ - 1] - hullX_[numHullPoints_ - 2])
+                  * (pointY[point] - hullY_[numHullPoints_ - 2])
+              - (hullY_[numHullPoints_ - 1] - hullY_[numHullPoints_ - 2])
+                  * (pointX[point] - hullX_[numHullPoints_ - 2])) <= 0) {
+        numHullPoints_--;
+      }
+      hullX_[numHullPoints_] = pointX[point];
+      hullY_[numHullPoints_++] = pointY[point];
+    }
+    numHullPoints_--;
+  }
+
+  // Project the hull onto the normal of each of its edges, for the separating
+  // axis test against each wall.
+  for (int x = 0; x < numHullPoints_; x++) {
+    int next = (x + 1) % numHullPoints_;
+    axisX_[x] = hullY_[x] - hullY_[next];
+    axisY_[x] = hullX_[next] - hullX_[x];
+    hullMin_[x] = hullMax_[x] =
+        (hullX_[0] * axisX_[x]) + (hullY_[0] * axisY_[x]);
+    for (int y = 1; y < numHullPoints_; y++) {
+      double p = (hullX_[y] * axisX_[x]) + (hullY_[y] * axisY_[x]);
+      hullMin_[x] = std::min(hullMin_[x], p);
+      hullMax_[x] = std::max(hullMax_[x], p);
+    }
+  }
+
+  int numCandidates = wallLineIndex_->findCandidates(
+      std::min(box1[0], box2[0]), std::min(box1[1], box2[1]),
+      std::max(box1[2], box2[2]), std::max(box1[3], box2[3]));
+  int *candidates = wallLineIndex_->getCandidates();
+  int numWalls = 0;
+  for (int x = 0; x < numCandidates; x++) {
+    Line2D *wallLine = wallLines_[candidates[x]];
+    double x1 = wallLine->x1();
+    double y1 = wallLine->y1();
+    double x2 = wallLine->x2();
+    double y2 = wallLine->y2();
+    if (blocksCells(x1, y1, x2, y2, box1, box2)) {
+      return VISION_BLOCKED;
+    } else if (touchesHull(x1, y1, x2, y2)) {
+      walls_[numWalls++] = candidates[x];
+    }
+  }
+  if (numWalls == 0) {
+    return VISION_CLEAR;
+  }
+  cellPairWallStarts_[(cell1 * numCells_) + cell2] =
+      addCellPairWalls(walls_, numWalls);
+  return VISION_PARTIAL;
+}
+
+// Stores a list of walls, prefixed by its length, and returns where it
+// starts, or -1 if we've run out of room.
+int VisibilityGrid::addCellPairWalls(int *walls, int numWalls) {
+  if (numCellPairWalls_ + numWalls + 1 > maxCellPairWalls_) {
+    int maxWalls = std::max(1024, maxCellPairWalls_ * 2);
+    while (maxWalls < numCellPairWalls_ + numWalls + 1) {
+      maxWalls *= 2;
+    }
+    if (maxWalls > MAX_VISION_PAIR_WALLS) {
+      return -1;
+    }
+    int *cellPairWalls = new int[maxWalls];
+    for (int x = 0; x < numCellPairWalls_; x++) {
+      cellPairWalls[x] = cellPairWalls_[x];
+    }
+    if (cellPairWalls_ != 0) {
+      delete cellPairWalls_;
+    }
+    cellPairWalls_ = cellPairWalls;
+    maxCellPairWalls_ = maxWalls;
+  }
+  int wallStart = numCellPairWalls_;
+  cellPairWalls_[numCellPairWalls_++] = numWalls;
+  for (int x = 0; x < numWalls; x++) {
+    cellPairWalls_[numCellPairWalls_++] = walls[x];
+  }
+  return wallStart;
+}
+
+// Separating axis test between a line segment and the current hull. Touching
+// counts as intersecting.
+bool VisibilityGrid::touchesHull(double x1, double y1, double x2, double y2) {
+  for (int x = 0; x < numHullPoints_; x++) {
+    double p1 = (x1 * axisX_[x]) + (y1 * axisY_[x]);
+    double p2 = (x2 * axisX_[x]) + (y2 * axisY_[x]);
+    if (std::max(p1, p2) < hullMin_[x] || std::min(p1, p2) > hullMax_[x]) {
+      return false;
+    }
+  }
+
+  double axisX = y1 - y2;
+  double axisY = x2 - x1;
+  double p = (x1 * axisX) + (y1 * axisY);
+  bool below = false;
+  bool above = false;
+  for (int x = 0; x < numHullPoints_; x++) {
+    double q = (hullX_[x] * axisX) + (hullY_[x] * axisY);
+    below = below || (q <= p);
+    above = above || (q >= p);
+  }
+  return below && above;
+}
+
+// True if an axis-aligned wall line separates the two cells and every line
+// between them crosses it well inside its endpoints.
+bool VisibilityGrid::blocksCells(double x1, double y1, double x2, double y2,
+                                 double *box1, double *box2) {
+  // Work in (u, v) coordinates, where the wall lies along v = wallV.
+  int u1, v1, u2, v2;
+  double wallV, wallUMin, wallUMax;
+  if (y1 == y2 && x1 != x2) {
+    u1 = 0; v1 = 1; u2 = 2; v2 = 3;
+    wallV = y1;
+    wallUMin = std::min(x1, x2);
+    wallUMax = std::max(x1, x2);
+  } else if (x1 == x2 && y1 != y2) {
+    u1 = 1; v1 = 0; u2 = 3; v2 = 2;
+    wallV = x1;
+    wallUMin = std::min(y1, y2);
+    wallUMax = std::max(y1, y2);
+  } else {
+    return false;
+  }
+
+  double *lower, *upper;
+  if (box1[v2] < wallV && box2[v1] > wallV) {
+    lower = box1;
+    upper = box2;
+  } else if (box2[v2] < wallV && box1[v1] > wallV) {
+    lower = box2;
+    upper = box1;
+  } else {
+    return false;
+  }
+
+  // The hull crosses the wall's line between the extreme crossings of lines
+  // from the corners of one cell to the corners of the other.
+  double crossMin = wallUMax;
+  double crossMax = wallUMin;
+  for (int x = 0; x < 4; x++) {
+    double lowerU = lower[(x & 1) ? u2 : u1];
+    double lowerV = lower[(x & 2) ? v2 : v1];
+    for (int y = 0; y < 4; y++) {
+      double upperU = upper[(y & 1) ? u2 : u1];
+      double upperV = upper[(y & 2) ? v2 : v1];
+      double u = lowerU + ((upperU - lowerU)
+          * ((wallV - lowerV) / (upperV - lowerV)));
+      crossMin = std::min(crossMin, u);
+      crossMax = std::max(crossMax, u);
+    }
+  }
+  return (crossMin >= wallUMin + VISION_MARGIN
+          && crossMax <= wallUMax - VISION_MARGIN);
+}
+
+VisibilityGrid::~VisibilityGrid() {
+  delete cellPairs_;
+  delete cellPairWallStarts_;
+  delete walls_;
+  if (cellPairWalls_ != 0) {
+    delete cellPairWalls_;
+  }
+}
@@ -0,0 +1,83 @@
+/*
+  Copyright (C) 2015 - Voidious
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+*/
+
+#ifndef VISIBILITY_GRID_H
+#define VISIBILITY_GRID_H
+
+#include "line2d.h"
+#include "linebatch.h"
+#include "stagegeometryindex.h"
+
+#define VISION_CELL_SIZE      32
+#define MAX_VISION_CELLS      1024
+#define MAX_VISION_PAIR_WALLS 2097152
+#define VISION_MARGIN         2.0
+
+#define VISION_UNKNOWN        0
+#define VISION_CLEAR          1
+#define VISION_BLOCKED        2
+#define VISION_PARTIAL        3
+
+// A potentially visible set for the static walls of a stage. The stage is
+// split into cells, and for each pair of cells we work out whether every line
+// between them misses all the walls (clear), whether some wall cuts every
+// such line (blocked), or neither (partial). For partial cell pairs, we keep
+// the walls that could block a line between them, so we only need to test
+// those. Cell pairs are worked out the first time they're needed and kept for
+// the rest of the match.
+//
+// Cells are padded by VISION_MARGIN when testing them against the walls, so
+// hasVision gives the same answer as testing the line against every wall with
+// Line2D::intersects.
+class VisibilityGrid {
+  StageGeometryIndex *wallLineIndex_;
+  Line2D **wallLines_;
+  LineBatch *wallLineBatch_;
+  double width_, height_, cellSize_;
+  int numColumns_, numRows_, numCells_;
+  unsigned char *cellPairs_;
+  int *cellPairWallStarts_;
+  int *cellPairWalls_;
+  int numCellPairWalls_, maxCellPairWalls_;
+  int *walls_;
+
+  // The convex hull of the cell pair being worked out, with its projections
+  // onto the normal of each of its edges.
+  double hullX_[16], hullY_[16];
+  double axisX_[16], axisY_[16];
+  double hullMin_[16], hullMax_[16];
+  int numHullPoints_;
+
+  public:
+    VisibilityGrid(int width, int height, StageGeometryIndex *wallLineIndex,
+                   Line2D **wallLines, LineBatch *wallLineBatch);
+    ~VisibilityGrid();
+    bool hasVision(Line2D *line);
+  private:
+    int getCell(double x, double y);
+    void getCellBox(int cell, double *box);
+    int findCellPairVision(int cell1, int cell2);
+    bool touchesHull(double x1, double y1, double x2, double y2);
+    bool blocksCells(double x1, double y1, double x2, double y2,
+                     double *box1, double *box2);
+    int addCellPairWalls(int *walls, int numWalls);
+};
+
+#endif